@@ -0,0 +1,23 @@
+#!/bin/sh
+# End-to-end benchmark: bench_sink <- main <- bench_sender, all on this host.
+# Arguments are passed to bench_sender. Results are JSON lines in bench_result.json.
+set -e
+
+BIN=${BENCH_BIN_DIR:-.}
+OUT=${BENCH_OUT:-bench_result.json}
+DURATION=${BENCH_DURATION:-5}
+
+"$BIN/bench_sink" -i 1 -w 1 -t $((DURATION + 15)) > bench_sink.json &
+SINK=$!
+sleep 0.2
+
+MT_RUN_SEC=$((DURATION + 3)) MT_LOG_LEVEL=${MT_LOG_LEVEL:-warn} "$BIN/main" > bench_main.log &
+MAIN=$!
+sleep 0.5
+
+"$BIN/bench_sender" -t "$DURATION" "$@" > bench_sender.json
+
+wait $SINK
+wait $MAIN || true
+cat bench_sender.json bench_sink.json > "$OUT"
+cat "$OUT"
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "../utils/bench_clock.h"
+#include "../utils/log_error.h"
+#include "../utils/message.h"
+#include "../utils/time_utils.h"
+#include "../utils/wire_codec.h"
+
+#define BENCH_MAX_PORTS 16
+#define BENCH_MAX_BATCH 1024
+#define BENCH_DUP_LOOKBACK 1024  // Duplicates reuse one of the last N new IDs
+#define BENCH_FORWARD_DATA 10    // MessageData value the application forwards
+
+/* Load generator settings */
+typedef struct {
+    const char* host;               // Destination IPv4 address
+    int ports[BENCH_MAX_PORTS];     // Every message is sent to each of these ports
+    size_t num_ports;
+    uint64_t rate;                  // Messages per second, 0 = as fast as possible
+    int open_loop;                  // Keep a fixed schedule and time messages from their intended send time
+    double dup_ratio;               // Fraction of messages that repeat a recent ID
+    double forward_ratio;           // Fraction of new IDs with MessageData == 10
+    size_t batch;                   // Messages per sendmmsg call
+    uint64_t count;                 // Messages to send, 0 = until duration ends
+    double duration_sec;            // Seconds to run, 0 = until count is reached
+    uint64_t first_id;              // ID of the first new message
+    const char* clock_path;         // Shared send-time table
+} BenchSenderOptions;
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -H host      destination address (127.0.0.1)\n"
+            "  -p ports     comma separated destination ports, each message goes to all (5000,5001)\n"
+            "  -r rate      messages per second, 0 = unlimited (100000)\n"
+            "  -o           open loop: fixed schedule, latency counted from the intended send time\n"
+            "  -d ratio     fraction of messages that duplicate a recent ID (0.0)\n"
+            "  -f ratio     fraction of new IDs with MessageData == 10 (1.0)\n"
+            "  -b batch     messages per sendmmsg call (32)\n"
+            "  -n count     messages to send, 0 = no limit (0)\n"
+            "  -t seconds   run time, 0 = no limit (5)\n"
+            "  -i id        first message ID (1)\n"
+            "  -c path      shared timestamp table (" BENCH_CLOCK_PATH ")\n",
+            prog);
+}
+
+static size_t parse_ports(const char* value, int* ports, size_t max) {
+    size_t count = 0;
+    while (*value && count < max) {
+        char* end = NULL;
+        long port = strtol(value, &end, 10);
+        if (end == value) break;
+        if (port > 0 && port < 65536) {
+            ports[count++] = (int)port;
+        }
+        value = (*end == ',') ? end + 1 : end;
+    }
+    return count;
+}
+
+/* xorshift64* generator, good enough for picking ratios */
+static inline uint64_t next_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static inline double next_unit(uint64_t* state) {
+    return (double)(next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Sleep (coarse) and then spin (fine) until the monotonic clock reaches deadline */
+static void wait_until(int64_t deadline) {
+    for (;;) {
+        int64_t remaining = deadline - monotonic_ns();
+        if (remaining <= 0) return;
+        if (remaining > 100 * NSEC_PER_USEC) {
+            struct timespec ts = {0, remaining - 50 * NSEC_PER_USEC};
+            nanosleep(&ts, NULL);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    BenchSenderOptions opts = {"127.0.0.1", {5000, 5001}, 2, 100000, 0, 0.0, 1.0, 32, 0, 5.0, 1, BENCH_CLOCK_PATH};
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:r:od:f:b:n:t:i:c:h")) != -1) {
+        switch (opt) {
+            case 'H': opts.host = optarg; break;
+            case 'p': opts.num_ports = parse_ports(optarg, opts.ports, BENCH_MAX_PORTS); break;
+            case 'r': opts.rate = strtoull(optarg, NULL, 10); break;
+            case 'o': opts.open_loop = 1; break;
+            case 'd': opts.dup_ratio = atof(optarg); break;
+            case 'f': opts.forward_ratio = atof(optarg); break;
+            case 'b': opts.batch = strtoull(optarg, NULL, 10); break;
+            case 'n': opts.count = strtoull(optarg, NULL, 10); break;
+            case 't': opts.duration_sec = atof(optarg); break;
+            case 'i': opts.first_id = strtoull(optarg, NULL, 10); break;
+            case 'c': opts.clock_path = optarg; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (opts.num_ports == 0 || opts.batch == 0 || (opts.count == 0 && opts.duration_sec <= 0)) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (opts.batch > BENCH_MAX_BATCH) opts.batch = BENCH_MAX_BATCH;
+
+    BenchClock clock;
+    if (bench_clock_open(&clock, opts.clock_path, 1) < 0) return 1;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        logError("Socket creation failed");
+        return 1;
+    }
+    int sndbuf = 4 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    struct sockaddr_in addrs[BENCH_MAX_PORTS];
+    for (size_t p = 0; p < opts.num_ports; p++) {
+        memset(&addrs[p], 0, sizeof(addrs[p]));
+        addrs[p].sin_family = AF_INET;
+        addrs[p].sin_port = htons((uint16_t)opts.ports[p]);
+        inet_pton(AF_INET, opts.host, &addrs[p].sin_addr);
+    }
+
+    // One datagram per (message, port); each message is encoded once and shared by its datagrams
+    size_t slots = opts.batch * opts.num_ports;
+    uint8_t* frames = (uint8_t*)calloc(opts.batch, WIRE_FRAME_SIZE);
+    struct iovec* iovecs = (struct iovec*)calloc(slots, sizeof(struct iovec));
+    struct mmsghdr* msgs = (struct mmsghdr*)calloc(slots, sizeof(struct mmsghdr));
+    for (size_t m = 0; m < opts.batch; m++) {
+        for (size_t p = 0; p < opts.num_ports; p++) {
+            size_t i = m * opts.num_ports + p;
+            iovecs[i].iov_base = frames + m * WIRE_FRAME_SIZE;
+            iovecs[i].iov_len = WIRE_FRAME_SIZE;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[p];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[p]);
+        }
+    }
+
+    uint64_t rng = 0x9E3779B97F4A7C15ULL ^ (uint64_t)monotonic_ns();
+    uint64_t next_id = opts.first_id;
+    uint64_t sent = 0, unique = 0, forwarded = 0, duplicates = 0;
+    uint64_t datagrams = 0, send_calls = 0, send_errors = 0;
+    int64_t interval_ns = opts.rate ? NSEC_PER_SEC / (int64_t)opts.rate : 0;
+    int64_t start = monotonic_ns();
+    int64_t end = opts.duration_sec > 0 ? start + (int64_t)(opts.duration_sec * NSEC_PER_SEC) : INT64_MAX;
+    int64_t next_send = start;
+    int64_t max_lag_ns = 0;
+
+    while ((opts.count == 0 || sent < opts.count) && monotonic_ns() < end) {
+        size_t n = opts.batch;
+        if (opts.count && opts.count - sent < n) n = (size_t)(opts.count - sent);
+
+        if (opts.rate) {
+            wait_until(next_send);
+        }
+        int64_t now = monotonic_ns();
+        if (now - next_send > max_lag_ns) max_lag_ns = now - next_send;
+
+        for (size_t m = 0; m < n; m++) {
+            uint64_t id, data;
+            if (unique > 0 && opts.dup_ratio > 0 && next_unit(&rng) < opts.dup_ratio) {
+                uint64_t back = unique < BENCH_DUP_LOOKBACK ? unique : BENCH_DUP_LOOKBACK;
+                id = next_id - 1 - next_random(&rng) % back;
+                data = 0;
+                duplicates++;
+            } else {
+                id = next_id++;
+                unique++;
+                data = next_unit(&rng) < opts.forward_ratio ? BENCH_FORWARD_DATA : 1 + id % 9;
+                if (data == BENCH_FORWARD_DATA) forwarded++;
+                // Open loop charges queueing behind a late sender to the message
+                int64_t stamp = opts.open_loop && interval_ns ? next_send + (int64_t)m * interval_ns : now;
+                bench_clock_stamp(&clock, id, stamp);
+            }
+            Message msg = {WIRE_FRAME_SIZE, 1, id, data};
+            wire_encode(frames + m * WIRE_FRAME_SIZE, &msg);
+        }
+
+        size_t total = n * opts.num_ports;
+        size_t done = 0;
+        while (done < total) {
+            int result = sendmmsg(sock, msgs + done, (unsigned int)(total - done), 0);
+            send_calls++;
+            if (result < 0) {
+                if (errno == EINTR || errno == ENOBUFS || errno == EAGAIN) continue;
+                logError("sendmmsg failed");
+                send_errors++;
+                break;
+            }
+            done += (size_t)result;
+        }
+        datagrams += done;
+        sent += n;
+
+        if (opts.rate) {
+            // Open loop keeps the original schedule; closed loop paces from the actual send
+            next_send = (opts.open_loop ? next_send : now) + (int64_t)n * interval_ns;
+        }
+    }
+    int64_t elapsed = monotonic_ns() - start;
+
+    atomic_store(&clock.header->sent_unique, unique);
+    atomic_store(&clock.header->expected_forwarded, forwarded);
+    atomic_store(&clock.header->sender_done, 1);
+
+    double seconds = (double)elapsed / NSEC_PER_SEC;
+    printf("{\"tool\":\"bench_sender\",\"mode\":\"%s\",\"target_rate\":%lu,\"batch\":%zu,\"ports\":%zu,"
+           "\"duration_s\":%.3f,\"messages\":%lu,\"unique\":%lu,\"duplicates\":%lu,\"expected_forwarded\":%lu,"
+           "\"datagrams\":%lu,\"sendmmsg_calls\":%lu,\"send_errors\":%lu,\"achieved_rate\":%.0f,\"max_lag_us\":%.1f}\n",
+           opts.open_loop ? "open" : "closed", opts.rate, opts.batch, opts.num_ports,
+           seconds, sent, unique, duplicates, forwarded,
+           datagrams, send_calls, send_errors, seconds > 0 ? (double)sent / seconds : 0.0,
+           (double)max_lag_ns / NSEC_PER_USEC);
+
+    free(frames);
+    free(iovecs);
+    free(msgs);
+    close(sock);
+    bench_clock_close(&clock);
+    return 0;
+}
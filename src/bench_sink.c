@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "../utils/bench_clock.h"
+#include "../utils/event_loop.h"
+#include "../utils/histogram.h"
+#include "../utils/log_error.h"
+#include "../utils/message.h"
+#include "../utils/stream_framer.h"
+#include "../utils/time_utils.h"
+#include "../utils/wire_codec.h"
+
+#define SINK_READ_BUFFER (256 * 1024)
+#define SINK_MAX_TRACKED_ID (1ULL << 32)  // IDs above this are not checked for downstream duplicates
+
+/* Sink settings */
+typedef struct {
+    int port;                 // TCP port to listen on
+    double max_sec;           // Stop after this long, 0 = no limit
+    double idle_sec;          // Stop this long after the sender finished and traffic went quiet
+    double report_sec;        // Interval between progress lines, 0 = final summary only
+    const char* clock_path;   // Shared send-time table
+} BenchSinkOptions;
+
+/* Everything measured by the sink */
+typedef struct {
+    Histogram total;          // Latency of every timed message (ns)
+    Histogram interval;       // Latency since the last progress line (ns)
+    uint64_t received;        // Frames received
+    uint64_t interval_received;
+    uint64_t untimed;         // Frames without a usable send time
+    uint64_t duplicates;      // IDs received more than once
+    uint64_t* seen;           // Bitmap of received IDs
+    size_t seen_words;        // Words allocated in seen
+    int64_t first_ns;         // Arrival of the first frame
+    int64_t last_ns;          // Arrival of the latest frame
+    uint64_t connections;     // Connections accepted
+} SinkStats;
+
+typedef struct {
+    EventLoop loop;
+    EventHandler listener;
+    BenchClock clock;
+    SinkStats stats;
+} SinkState;
+
+/* One downstream connection */
+typedef struct {
+    EventHandler handler;
+    StreamFramer framer;
+    SinkState* state;
+} SinkConnection;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    interrupted = 1;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -p port      TCP port to listen on (6000)\n"
+            "  -t seconds   stop after this long, 0 = no limit (0)\n"
+            "  -w seconds   stop once the sender is done and no data arrived for this long (1)\n"
+            "  -i seconds   progress line interval, 0 = summary only (1)\n"
+            "  -c path      shared timestamp table (" BENCH_CLOCK_PATH ")\n",
+            prog);
+}
+
+/* Record an ID in the duplicate bitmap. Returns 1 if it was already there */
+static int sink_mark_seen(SinkStats* stats, uint64_t id) {
+    if (id >= SINK_MAX_TRACKED_ID) return 0;
+    size_t word = (size_t)(id >> 6);
+    if (word >= stats->seen_words) {
+        size_t words = stats->seen_words ? stats->seen_words : 1024;
+        while (words <= word) words *= 2;
+        stats->seen = (uint64_t*)realloc(stats->seen, words * sizeof(uint64_t));
+        memset(stats->seen + stats->seen_words, 0, (words - stats->seen_words) * sizeof(uint64_t));
+        stats->seen_words = words;
+    }
+    uint64_t bit = 1ULL << (id & 63);
+    int dup = (stats->seen[word] & bit) != 0;
+    stats->seen[word] |= bit;
+    return dup;
+}
+
+static void sink_record(SinkState* state, const char* frame, int64_t now) {
+    uint64_t id = wire_frame_id((const uint8_t*)frame);
+    SinkStats* stats = &state->stats;
+    if (stats->received == 0) stats->first_ns = now;
+    stats->last_ns = now;
+    stats->received++;
+    stats->interval_received++;
+    if (sink_mark_seen(stats, id)) {
+        stats->duplicates++;
+        return;
+    }
+    int64_t sent = bench_clock_lookup(&state->clock, id);
+    if (sent <= 0 || sent > now) {
+        stats->untimed++;
+        return;
+    }
+    histogram_record(&stats->total, (uint64_t)(now - sent));
+    histogram_record(&stats->interval, (uint64_t)(now - sent));
+}
+
+static void sink_close(SinkState* state, SinkConnection* conn) {
+    event_loop_del(&state->loop, &conn->handler);
+    close(conn->handler.fd);
+    framer_destroy(&conn->framer);
+    free(conn);
+}
+
+/* Drain a connection and time every complete frame */
+static void on_connection_readable(void* ctx, uint32_t events) {
+    SinkConnection* conn = (SinkConnection*)ctx;
+    SinkState* state = conn->state;
+    (void)events;
+    for (;;) {
+        ssize_t n = framer_read(&conn->framer, conn->handler.fd);
+        if (n > 0) {
+            int64_t now = monotonic_ns();
+            size_t frames = framer_frames(&conn->framer);
+            for (size_t i = 0; i < frames; i++) {
+                sink_record(state, framer_frame(&conn->framer, i), now);
+            }
+            framer_consume(&conn->framer, frames);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n < 0 && errno == EINTR) continue;
+        sink_close(state, conn);  // EOF or error
+        return;
+    }
+}
+
+/* Accept every pending connection */
+static void on_listener_readable(void* ctx, uint32_t events) {
+    SinkState* state = (SinkState*)ctx;
+    (void)events;
+    for (;;) {
+        int fd = accept4(state->listener.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                logError("Accept failed");
+            }
+            if (errno == EINTR) continue;
+            return;
+        }
+        SinkConnection* conn = (SinkConnection*)calloc(1, sizeof(SinkConnection));
+        conn->state = state;
+        conn->handler.fd = fd;
+        conn->handler.callback = on_connection_readable;
+        conn->handler.ctx = conn;
+        framer_init(&conn->framer, SINK_READ_BUFFER, WIRE_FRAME_SIZE);
+        event_loop_add(&state->loop, &conn->handler, EPOLLIN | EPOLLRDHUP);
+        state->stats.connections++;
+        on_connection_readable(conn, EPOLLIN);  // Data may have arrived before registration
+    }
+}
+
+static int sink_listen(int port) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        logError("Socket creation failed");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 16) < 0) {
+        logError("Bind/listen failed");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void print_latency(const Histogram* h) {
+    printf("\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,\"mean_us\":%.1f",
+           (double)histogram_percentile(h, 0.50) / NSEC_PER_USEC,
+           (double)histogram_percentile(h, 0.99) / NSEC_PER_USEC,
+           (double)histogram_percentile(h, 0.999) / NSEC_PER_USEC,
+           (double)(h->total ? h->max : 0) / NSEC_PER_USEC,
+           histogram_mean(h) / NSEC_PER_USEC);
+}
+
+int main(int argc, char** argv) {
+    BenchSinkOptions opts = {6000, 0.0, 1.0, 1.0, BENCH_CLOCK_PATH};
+    int opt;
+    while ((opt = getopt(argc, argv, "p:t:w:i:c:h")) != -1) {
+        switch (opt) {
+            case 'p': opts.port = atoi(optarg); break;
+            case 't': opts.max_sec = atof(optarg); break;
+            case 'w': opts.idle_sec = atof(optarg); break;
+            case 'i': opts.report_sec = atof(optarg); break;
+            case 'c': opts.clock_path = optarg; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+
+    SinkState* state = (SinkState*)calloc(1, sizeof(SinkState));
+    histogram_reset(&state->stats.total);
+    histogram_reset(&state->stats.interval);
+    if (bench_clock_open(&state->clock, opts.clock_path, 1) < 0) return 1;
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    int sock = sink_listen(opts.port);
+    if (sock < 0) return 1;
+    event_loop_init(&state->loop, -1);
+    state->listener.fd = sock;
+    state->listener.callback = on_listener_readable;
+    state->listener.ctx = state;
+    event_loop_add(&state->loop, &state->listener, EPOLLIN);
+
+    SinkStats* stats = &state->stats;
+    int64_t start = monotonic_ns();
+    int64_t end = opts.max_sec > 0 ? start + (int64_t)(opts.max_sec * NSEC_PER_SEC) : INT64_MAX;
+    int64_t idle_ns = (int64_t)(opts.idle_sec * NSEC_PER_SEC);
+    int64_t report_ns = (int64_t)(opts.report_sec * NSEC_PER_SEC);
+    int64_t next_report = start + report_ns;
+    int64_t done_seen = 0;
+
+    while (!interrupted) {
+        event_loop_run_once(&state->loop, 50);
+        int64_t now = monotonic_ns();
+        if (report_ns > 0 && now >= next_report) {
+            printf("{\"tool\":\"bench_sink\",\"event\":\"interval\",\"t_s\":%.3f,\"received\":%lu,\"rate\":%.0f,",
+                   (double)(now - start) / NSEC_PER_SEC, stats->received,
+                   (double)stats->interval_received * NSEC_PER_SEC / (double)(report_ns + now - next_report));
+            print_latency(&stats->interval);
+            printf("}\n");
+            fflush(stdout);
+            histogram_reset(&stats->interval);
+            stats->interval_received = 0;
+            next_report = now + report_ns;
+        }
+        if (now >= end) break;
+        if (atomic_load(&state->clock.header->sender_done)) {
+            if (done_seen == 0) done_seen = now;
+            int64_t quiet_since = stats->last_ns > done_seen ? stats->last_ns : done_seen;
+            if (now - quiet_since >= idle_ns) break;
+        }
+    }
+
+    BenchClockHeader* header = state->clock.header;
+    uint64_t expected = atomic_load(&header->expected_forwarded);
+    uint64_t unique = stats->received - stats->duplicates;
+    uint64_t lost = expected > unique ? expected - unique : 0;
+    double active = stats->last_ns > stats->first_ns ? (double)(stats->last_ns - stats->first_ns) / NSEC_PER_SEC : 0.0;
+    printf("{\"tool\":\"bench_sink\",\"event\":\"summary\",\"sender_done\":%d,\"connections\":%lu,"
+           "\"received\":%lu,\"unique\":%lu,\"duplicates\":%lu,\"expected\":%lu,\"lost\":%lu,\"loss_ratio\":%.6f,"
+           "\"untimed\":%lu,\"active_s\":%.3f,\"throughput\":%.0f,\"timed\":%lu,",
+           atomic_load(&header->sender_done), stats->connections,
+           stats->received, unique, stats->duplicates, expected, lost,
+           expected ? (double)lost / (double)expected : 0.0,
+           stats->untimed, active, active > 0 ? (double)stats->received / active : 0.0, stats->total.total);
+    print_latency(&stats->total);
+    printf("}\n");
+
+    event_loop_destroy(&state->loop);
+    close(sock);
+    bench_clock_close(&state->clock);
+    free(stats->seen);
+    free(state);
+    return 0;
+}
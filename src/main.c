@@ -2,40 +2,145 @@
 #include <fcntl.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
-#include <sys/select.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <sched.h>
+#include <signal.h>
+#include "../utils/app_config.h"
+#include "../utils/async_log.h"
+#include "../utils/backpressure.h"
+#include "../utils/batch_filter.h"
+#include "../utils/control_server.h"
 #include "../utils/custom_convectors.h"
 #include "../utils/custom_hash_map.h"
 #include "../utils/custom_output.h"
-#include "../utils/custom_queue.h"
+#include "../utils/event_loop.h"
+#include "../utils/load_balancer.h"
 #include "../utils/log_error.h"
 #include "../utils/message.h"
+#include "../utils/message_log.h"
+#include "../utils/metrics.h"
+#include "../utils/metrics_server.h"
+#include "../utils/mpsc_ring.h"
+#include "../utils/rcu.h"
+#include "../utils/reuseport.h"
+#include "../utils/routing_rules.h"
+#include "../utils/seq_window.h"
+#include "../utils/sharded_store.h"
+#include "../utils/socket_tuning.h"
+#include "../utils/tcp_sender.h"
 #include "../utils/thread_utils.h"
+#include "../utils/time_utils.h"
+#include "../utils/udp_batch.h"
+#include "../utils/uring.h"
+#include "../utils/wire_codec.h"
+
+typedef struct OutputChannel OutputChannel;
+
+/* One endpoint of an output: its own ring, transmitter thread, TCP connection and health */
+typedef struct {
+    char name[ROUTE_NAME_LEN + 4];  // Output name, plus "_<n>" when the output has several endpoints
+    OutputChannel* output;      // Output this endpoint serves
+    size_t index;               // Position in output->downstreams, its bit in output->healthy
+    TcpSenderOptions tcp;       // Connection settings, host and port from the rules
+    MpscRing* ring;             // Lock-free queue of messages to transmit
+    Thread thread;              // Transmitter thread
+    OverflowPolicy policy;      // What happens to the backlog while the ring is throttled
+    size_t high_watermark;      // Ring depth that starts throttling
+    size_t low_watermark;       // Ring depth that ends it
+    size_t tx_buffer_bytes;     // Most bytes the transmitter takes off the ring before they are sent
+    _Atomic int throttled;      // Set by the transmitter between the watermarks, read by the receivers
+    SpillFile spill;            // Backlog moved to disk, owned by the transmitter (spill policy)
+    uint64_t dropped_oldest;    // Totals of the transmitter, logged at shutdown
+    uint64_t spilled;
+    uint64_t replayed;
+    uint64_t handed_off;        // Queued messages moved to other endpoints while this one was down
+} Downstream;
+
+/* A routing output: the endpoints sharing its traffic */
+struct OutputChannel {
+    char name[ROUTE_NAME_LEN];  // Output name from the rules
+    BalanceMode balance;        // How messages are spread over the endpoints
+    Downstream* downstreams;    // Endpoints, a slice of the global downstreams array
+    size_t num_downstreams;
+    uint64_t seeds[BALANCE_MAX_ENDPOINTS];  // Rendezvous seed of each endpoint
+    _Atomic uint32_t healthy;   // Bit per endpoint, cleared by its transmitter while it is disconnected
+};
 
 /* Global variables for shared data and synchronization */
-CustomHashMap* messageStore; // Stores received messages
-CustomQueue* transmitQueue;  // Queue for messages to transmit
-Mutex mtxStore, mtxQueue;    // Mutexes for thread safety
-Cond cv;                     // Condition variable for signaling
+AppConfig config;            // Runtime configuration
+ShardedStore* messageStore;  // Stores received messages
+SeqWindow* seqWindow;        // Sequence window checked before messageStore, NULL in store mode
+MessageLog* messageLog;      // Durable log of accepted messages, NULL when disabled
+RouteConfig routeConfig;     // Outputs and rules loaded at startup
+_Atomic(RouteTable*) routeTable;  // Compiled rules, replaced under RCU on SIGHUP
+RcuDomain routeRcu;          // Tracks receivers that may still use an old routeTable
+OutputChannel* outputs;      // One channel per routeConfig output
+Downstream* downstreams;     // Endpoints of all outputs, in output order
+size_t numDownstreams;
 int done = 0;                // Flag to terminate threads
-ThreadPool* sendPool;        // Pool for async send tasks
+int shutdownFd = -1;         // eventfd signalled once to stop every event loop
+volatile sig_atomic_t reloadRequested = 0;  // Set by SIGHUP
 
-/* Receiver thread function for UDP message reception */
-void* receiverThread(void* arg) {
-    int port = *(int*)arg;
-    char name[16];
-    snprintf(name, sizeof(name), "Receiver %d", port == 5000 ? 1 : 2);
+#define MAX_SOCKETS_PER_RECEIVER 8
+
+#define RECEIVER_NAME_LEN 64  // Fits "Receiver <port>.<thread>" with both numbers at full size_t width
+
+/* Receive state of one UDP socket. A receiver thread may serve several of them */
+typedef struct {
+    EventHandler handler;  // Registration with the thread's event loop
+    EventLoop* loop;       // Loop of the owning receiver thread
+    char name[RECEIVER_NAME_LEN]; // Name used in log lines
+    int port;              // Bound UDP port
+    UdpBatch batch;        // Preallocated recvmmsg buffers
+    Message* msgs;         // Decoded messages of the current batch
+    uint64_t* hashes;      // hash_function() of each decoded MessageId
+    uint32_t* forward;     // Indices of decoded messages routed to at least one output
+    uint32_t* routes;      // Output bitmask per decoded message
+    RcuReader* rcu;        // Read-side state of the owning receiver thread
+    MetricsThread* metrics;// Counters of the owning receiver thread
+    int* accepted;         // Dedup result per decoded message
+    LogRateLimit dupLog;   // Rate limit of the "skipped duplicate" line
+    uint32_t reportedDrops;// Kernel drop count at the last warning
+    LogRateLimit dropLog;  // Rate limit of the kernel drop warning
+    uint64_t lineHigh;     // Highest ID seen on this socket (sequence mode)
+    uint64_t lineGaps;     // IDs skipped on this socket, possibly delivered by the other line
+    uint64_t lineLate;     // IDs that arrived below lineHigh
+    uint64_t lineOutside;  // IDs below the sequence window's floor, checked in the store
+    uint64_t lineExpired;  // IDs that arrived after their block left the sequence window
+    uint64_t seqAccepted;  // New IDs accepted by the sequence window alone
+    uint32_t balanceCursor;// Round-robin position for outputs with several endpoints
+} ReceiverSocket;
+
+/* Sockets served by one receiver thread */
+typedef struct {
+    ReceiverSocket sockets[MAX_SOCKETS_PER_RECEIVER];  // Opened and bound by main
+    size_t num_sockets;                                // Number of sockets
+    int cpu;                                           // CPU to pin the thread to, or -1
+} ReceiverArgs;
+
+/* Create, bind and allocate buffers for one receiver socket.
+ * With reuseport set, several sockets may bind the same port. Returns 0 on success */
+int receiver_socket_open(ReceiverSocket* rs, int port, const char* name, int reuseport) {
+    memset(rs, 0, sizeof(*rs));
+    rs->port = port;
+    snprintf(rs->name, sizeof(rs->name), "%s", name);
 
     // Create UDP socket
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock < 0) {
         char buffer[256];
-        snprintf(buffer, sizeof(buffer), "%s socket creation failed", name);
+        snprintf(buffer, sizeof(buffer), "%s socket creation failed", rs->name);
         logError(buffer);
-        return NULL;
+        return -1;
     }
     fcntl(sock, F_SETFL, O_NONBLOCK);  // Set non-blocking mode
+    if (reuseport && reuseport_enable(sock) < 0) {
+        close(sock);
+        return -1;
+    }
+    SocketTuningResult granted;
+    socket_tuning_apply(sock, &config.sockets, &granted);
 
     // Bind socket to port
     struct sockaddr_in addr;
@@ -44,181 +149,1101 @@ void* receiverThread(void* arg) {
     addr.sin_addr.s_addr = INADDR_ANY;
     if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
         char buffer[256];
-        snprintf(buffer, sizeof(buffer), "%s bind failed on port %d", name, port);
+        snprintf(buffer, sizeof(buffer), "%s bind failed on port %d", rs->name, port);
         logError(buffer);
         close(sock);
-        return NULL;
+        return -1;
+    }
+
+    // Preallocate the recvmmsg batch buffers
+    if (udp_batch_init(&rs->batch, config.recv_batch_size, WIRE_LEGACY_FRAME_SIZE) < 0) {
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer), "%s batch allocation failed", rs->name);
+        logError(buffer);
+        close(sock);
+        return -1;
+    }
+    rs->msgs = (Message*)malloc(sizeof(Message) * rs->batch.capacity);
+    rs->hashes = (uint64_t*)malloc(sizeof(uint64_t) * rs->batch.capacity);
+    rs->forward = (uint32_t*)malloc(sizeof(uint32_t) * rs->batch.capacity);
+    rs->routes = (uint32_t*)malloc(sizeof(uint32_t) * rs->batch.capacity);
+    rs->accepted = (int*)malloc(sizeof(int) * rs->batch.capacity);
+    if (granted.rxq_ovfl > 0) {
+        udp_batch_enable_drop_counter(&rs->batch);
+    }
+    rs->handler.fd = sock;
+
+    // Report what the kernel granted; a capped buffer is the usual cause of drops under burst
+    alog_info(rs->name, "socket granted rcvbuf=%lu, busy_poll_us=%lu, rxq_ovfl=%lu",
+              (uint64_t)granted.rcvbuf, (uint64_t)granted.busy_poll_us, (uint64_t)granted.rxq_ovfl);
+    if (socket_tuning_capped(&config.sockets, &granted)) {
+        alog_write(LOG_LEVEL_WARN, rs->name, 0, "SO_RCVBUF capped at %lu of %lu requested, raise net.core.rmem_max",
+                   (uint64_t)granted.rcvbuf, (uint64_t)config.sockets.rcvbuf, 0);
+    }
+    return 0;
+}
+
+/* Report batch statistics and release a receiver socket */
+void receiver_socket_close(ReceiverSocket* rs) {
+    uint64_t fill = (uint64_t)(udp_batch_avg_fill(&rs->batch) * 100.0 + 0.5);
+    alog_info(rs->name, "batches: %lu, datagrams: %lu", rs->batch.batches, rs->batch.datagrams, 0);
+    alog_info(rs->name, "avg batch fill: %lu.%02lu/%lu", fill / 100, fill % 100, rs->batch.capacity);
+    if (rs->batch.control) {
+        alog_info(rs->name, "kernel drops: %lu", rs->batch.kernel_drops, 0, 0);
+    }
+    if (seqWindow) {
+        alog_info(rs->name, "line gaps: %lu, late: %lu, expired: %lu", rs->lineGaps, rs->lineLate,
+                  rs->lineExpired);
+        if (rs->lineOutside) {
+            alog_info(rs->name, "below recovery floor: %lu", rs->lineOutside, 0, 0);
+        }
+    }
+    close(rs->handler.fd);
+    free(rs->msgs);
+    free(rs->hashes);
+    free(rs->forward);
+    free(rs->routes);
+    free(rs->accepted);
+    udp_batch_destroy(&rs->batch);
+}
+
+/* Endpoint of out that msg goes to under the output's balance mode. *rebalanced counts
+ * IDs that had to leave their first-choice endpoint because it was down */
+static inline Downstream* output_pick(OutputChannel* out, const Message* msg, uint32_t* cursor, size_t* rebalanced) {
+    size_t count = out->num_downstreams;
+    if (count == 1) return &out->downstreams[0];
+    uint32_t healthy = atomic_load_explicit(&out->healthy, memory_order_relaxed);
+    if (out->balance == BALANCE_ROUND_ROBIN) {
+        return &out->downstreams[balance_pick_next(count, healthy, cursor)];
+    }
+    if (out->balance == BALANCE_LEAST_LOADED) {
+        size_t loads[BALANCE_MAX_ENDPOINTS];
+        for (size_t i = 0; i < count; i++) {
+            loads[i] = mpsc_ring_size(out->downstreams[i].ring);
+        }
+        return &out->downstreams[balance_pick_least(loads, count, healthy, cursor)];
+    }
+    int moved;
+    size_t index = balance_pick_hash(out->seeds, count, healthy, msg->MessageId, &moved);
+    *rebalanced += (size_t)moved;
+    return &out->downstreams[index];
+}
+
+/* Full-ring wait of one endpoint within a batch (drop-oldest and spill) */
+typedef struct {
+    const Downstream* out;
+    int64_t deadline;  // Pushes failing after it drop the message
+} ShedWait;
+
+/* Deadline of out's wait in this batch, started at now the first time its ring is full */
+static int64_t shed_wait_deadline(ShedWait* waits, size_t* count, const Downstream* out, int64_t now) {
+    for (size_t i = 0; i < *count; i++) {
+        if (waits[i].out == out) return waits[i].deadline;
+    }
+    waits[*count].out = out;
+    waits[*count].deadline = now + BACKPRESSURE_SHED_WAIT_NS;
+    return waits[(*count)++].deadline;
+}
+
+/* Decode, deduplicate, queue and log one received batch */
+void receiver_process_batch(ReceiverSocket* rs, int received) {
+    int64_t now = monotonic_ns();
+
+    // Decode the batch in one pass when every datagram is a current wire frame
+    size_t count = 0;
+    size_t bytes = 0;
+    int uniform = 1;
+    for (int i = 0; i < received; i++) {
+        size_t len = udp_batch_len(&rs->batch, i);
+        uniform &= len == WIRE_FRAME_SIZE;
+        bytes += len;
+    }
+    if (uniform) {
+        count = wire_decode_batch((const uint8_t*)udp_batch_data(&rs->batch, 0), rs->batch.frame_size,
+                                  (size_t)received, rs->msgs);
+    } else {
+        for (int i = 0; i < received; i++) {
+            const uint8_t* data = (const uint8_t*)udp_batch_data(&rs->batch, i);
+            size_t len = udp_batch_len(&rs->batch, i);
+            if (len == WIRE_FRAME_SIZE) {
+                count += wire_decode(data, &rs->msgs[count]);
+            } else if (len == WIRE_LEGACY_FRAME_SIZE) {
+                wire_decode_legacy(data, &rs->msgs[count++]);
+            }  // Anything else is short, truncated or unknown and is dropped
+        }
+    }
+    Message* msgs = rs->msgs;
+    int* accepted = rs->accepted;
+
+    // Route the whole batch under the current rules; the table stays valid until rcu_read_unlock
+    uint32_t* routes = rs->routes;
+    size_t forwardCount = 0;
+    rcu_read_lock(&routeRcu, rs->rcu);
+    const RouteTable* table = atomic_load(&routeTable);
+    if (table->single_value) {
+        forwardCount = batch_filter_eq(msgs, count, table->single_data, rs->forward);
+        for (size_t k = 0; k < forwardCount; k++) {
+            routes[rs->forward[k]] = 1u << table->single_output;
+        }
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            routes[i] = route_eval(table, &msgs[i]);
+            rs->forward[forwardCount] = (uint32_t)i;
+            forwardCount += routes[i] != 0;
+        }
+    }
+    rcu_read_unlock(rs->rcu);
+
+    size_t inserted = 0;
+    if (seqWindow) {
+        // Sequence mode: one atomic test-and-set per ID, the store only for IDs below the recovery floor
+        size_t gaps = 0, late = 0, outside = 0, expired = 0;
+        for (size_t i = 0; i < count; i++) {
+            uint64_t id = msgs[i].MessageId;
+            if (id > rs->lineHigh) {
+                gaps += rs->lineHigh && id > rs->lineHigh + 1 ? id - rs->lineHigh - 1 : 0;
+                rs->lineHigh = id;
+            } else {
+                late++;
+            }
+            switch (seq_window_mark(seqWindow, id)) {
+                case SEQ_NEW:
+                    accepted[i] = 1;
+                    rs->seqAccepted++;
+                    break;
+                case SEQ_DUPLICATE:
+                    accepted[i] = 0;
+                    break;
+                case SEQ_EXPIRED:
+                    // The block has left the window and the history: a copy arriving this late
+                    // (a line more than the history behind) is dropped, not resent
+                    accepted[i] = 0;
+                    expired++;
+                    break;
+                default:
+                    accepted[i] = store_insert_if_absent(messageStore, &msgs[i], now);
+                    outside++;
+                    break;
+            }
+            inserted += accepted[i] != 0;
+        }
+        rs->lineGaps += gaps;
+        rs->lineLate += late;
+        rs->lineOutside += outside;
+        rs->lineExpired += expired;
+        metrics_add(rs->metrics, METRIC_SEQ_GAPS, gaps);
+        metrics_add(rs->metrics, METRIC_SEQ_LATE, late);
+        metrics_add(rs->metrics, METRIC_SEQ_OUTSIDE, outside);
+        metrics_add(rs->metrics, METRIC_SEQ_EXPIRED, expired);
+    } else {
+        // Deduplicate and store the batch, locking only the shard of each ID
+        batch_hash_ids(msgs, count, rs->hashes);
+        for (size_t i = 0; i < count; i++) {
+            accepted[i] = store_insert_if_absent_hashed(messageStore, &msgs[i], rs->hashes[i], now);
+            inserted += accepted[i] != 0;
+        }
+    }
+
+    // Persist the new IDs. The writer thread owns the files; a full log queue costs durability, not latency
+    size_t logDropped = 0;
+    if (messageLog) {
+        for (size_t i = 0; i < count; i++) {
+            if (accepted[i]) logDropped += !message_log_append(messageLog, &msgs[i], now);
+        }
+    }
+
+    // Queue the new routed messages for the transmitter of each of their outputs. While an
+    // output is throttled, block holds the receiver back until its ring has drained to the low
+    // watermark and drop-newest discards; the other policies let the transmitter shed the backlog,
+    // and on a full ring the receiver waits for it to do so, for at most one wait per output per batch
+    size_t enqueued = 0, full = 0, blocked = 0, droppedNewest = 0, rebalanced = 0;
+    ShedWait waits[ROUTE_MAX_OUTPUTS * BALANCE_MAX_ENDPOINTS];
+    size_t numWaits = 0;
+    for (size_t k = 0; k < forwardCount; k++) {
+        size_t i = rs->forward[k];
+        if (!accepted[i]) continue;
+        for (uint32_t mask = routes[i]; mask; mask &= mask - 1) {
+            Downstream* out = output_pick(&outputs[__builtin_ctz(mask)], &msgs[i], &rs->balanceCursor, &rebalanced);
+            int producerPolicy = out->policy == OVERFLOW_BLOCK || out->policy == OVERFLOW_DROP_NEWEST;
+            if (producerPolicy && atomic_load_explicit(&out->throttled, memory_order_relaxed)) {
+                if (out->policy == OVERFLOW_DROP_NEWEST) {
+                    droppedNewest++;
+                    continue;
+                }
+                blocked++;
+                while (atomic_load_explicit(&out->throttled, memory_order_relaxed) && !done) {
+                    backpressure_park(&out->throttled);  // Until the ring has drained to the low watermark
+                }
+            }
+            int pushed;
+            while (!(pushed = mpsc_ring_push(out->ring, &msgs[i], now)) && !done) {
+                full++;
+                if (out->policy == OVERFLOW_DROP_NEWEST) break;  // Ring full: shed the newest
+                if (out->policy != OVERFLOW_BLOCK) {
+                    // Ring full: the transmitter sheds the oldest down to the low watermark, unless it is
+                    // stuck. Once this output's wait has expired, the rest of the batch drops straight away
+                    int64_t t = monotonic_ns();
+                    if (t >= shed_wait_deadline(waits, &numWaits, out, t)) break;
+                } else if (atomic_load_explicit(&out->throttled, memory_order_relaxed)) {
+                    backpressure_park(&out->throttled);  // Full and throttled: wait for the drain
+                    continue;
+                }
+                sched_yield();  // Ring full, let the transmitter catch up (or mark it throttled)
+            }
+            enqueued += pushed;
+            droppedNewest += !pushed && out->policy != OVERFLOW_BLOCK;
+        }
     }
 
-    // Use select to wait for incoming data
-    fd_set read_fds;
-    struct timeval tv;
-    char buffer[sizeof(Message)];
-    while (!done) {
-        FD_ZERO(&read_fds);
-        FD_SET(sock, &read_fds);
-        tv.tv_sec = 0;
-        tv.tv_usec = 10000;  // 10ms timeout to check done flag
-
-        int ready = select(sock + 1, &read_fds, NULL, NULL, &tv);
-        if (ready < 0) {
-            char buffer[256];
-            snprintf(buffer, sizeof(buffer), "%s select failed", name);
-            logError(buffer);
+    MetricsThread* m = rs->metrics;
+    metrics_add(m, METRIC_RX_BATCHES, 1);
+    metrics_add(m, METRIC_RX_DATAGRAMS, (uint64_t)received);
+    metrics_add(m, METRIC_RX_BYTES, bytes);
+    metrics_add(m, METRIC_RX_INVALID, (uint64_t)received - count);
+    metrics_add(m, METRIC_STORE_INSERTS, inserted);
+    metrics_add(m, METRIC_DUPLICATES, count - inserted);
+    metrics_add(m, METRIC_ENQUEUED, enqueued);
+    metrics_add(m, METRIC_QUEUE_FULL, full);
+    metrics_add(m, METRIC_QUEUE_BLOCKED, blocked);
+    metrics_add(m, METRIC_QUEUE_DROP_NEWEST, droppedNewest);
+    metrics_add(m, METRIC_REBALANCED, rebalanced);
+    metrics_add(m, METRIC_LOG_DROPPED, logDropped);
+    metrics_record(m, METRIC_HIST_BATCH_NS, (uint64_t)(monotonic_ns() - now));
+
+    // Record log entries; formatting and output happen on the async logger thread
+    for (size_t i = 0; i < count; i++) {
+        if (accepted[i]) {
+            alog_info(rs->name, "received: ID=%lu, Data=%lu", msgs[i].MessageId, msgs[i].MessageData, 0);
+        } else if (alog_enabled(LOG_LEVEL_INFO) && alog_rate_allow(&rs->dupLog, config.log_dup_rate, rs->name)) {
+            alog_info(rs->name, "skipped duplicate ID=%lu", msgs[i].MessageId, 0, 0);
+        }
+    }
+}
+
+/* Warn about datagrams lost in the kernel (full receive buffer) since the last warning */
+void receiver_report_drops(ReceiverSocket* rs) {
+    uint32_t drops = rs->batch.kernel_drops - rs->reportedDrops;
+    if (drops > 0 && alog_rate_allow(&rs->dropLog, 1, rs->name)) {
+        alog_write(LOG_LEVEL_WARN, rs->name, 0, "kernel dropped %lu datagrams (total %lu)",
+                   drops, rs->batch.kernel_drops, 0);
+        metrics_add(rs->metrics, METRIC_KERNEL_DROPS, drops);
+        rs->reportedDrops = rs->batch.kernel_drops;
+    }
+}
+
+/* Readable callback: the socket is edge-triggered, so drain it until EAGAIN */
+void receiver_on_readable(void* ctx, uint32_t events) {
+    ReceiverSocket* rs = (ReceiverSocket*)ctx;
+    (void)events;
+    int received;
+    while ((received = udp_batch_recv(&rs->batch, rs->handler.fd)) > 0) {
+        receiver_process_batch(rs, received);
+    }
+    if (received < 0) {
+        alog_errno(rs->name, "recvmmsg failed", 0);
+        event_loop_stop(rs->loop);
+    }
+    receiver_report_drops(rs);
+}
+
+#define URING_SHUTDOWN_TAG UINT64_MAX  // user_data of the poll on the shutdown fd
+
+/* Arm a multishot recvmsg on registered socket index. Each completion carries one datagram
+ * in a buffer picked from group index, laid out as io_uring_recvmsg_out, control, payload */
+static void receiver_uring_arm(Uring* ring, unsigned index, struct msghdr* hdr) {
+    struct io_uring_sqe* sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->fd = (int)index;
+    sqe->addr = (uint64_t)(uintptr_t)hdr;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = (uint16_t)index;
+    sqe->user_data = index;
+}
+
+/* io_uring receive loop: every socket keeps a multishot recvmsg armed on a provided buffer
+ * ring, so datagrams arrive as completions without a syscall per batch or per datagram.
+ * Completions are gathered into each socket's UdpBatch and handed to receiver_process_batch.
+ * Returns 0 after shutdown, or -1 if the ring could not be set up before anything was
+ * received, in which case the caller falls back to epoll. */
+int receiver_run_uring(ReceiverArgs* args) {
+    size_t n = args->num_sockets;
+    Uring ring;
+    int err = uring_init(&ring, 256);
+    if (err < 0) {
+        alog_write(LOG_LEVEL_WARN, args->sockets[0].name, 0, "io_uring setup failed (errno %lu), using epoll",
+                   (uint64_t)-err, 0, 0);
+        return -1;
+    }
+
+    // Sockets are registered files 0..n-1, the shutdown eventfd is file n
+    int fds[MAX_SOCKETS_PER_RECEIVER + 1];
+    for (size_t i = 0; i < n; i++) {
+        fds[i] = args->sockets[i].handler.fd;
+    }
+    fds[n] = shutdownFd;
+    err = uring_register_files(&ring, fds, (unsigned)n + 1);
+
+    // One buffer ring per socket, each buffer sized for one datagram slot plus its headers
+    UringBufRing bufs[MAX_SOCKETS_PER_RECEIVER];
+    struct msghdr hdrs[MAX_SOCKETS_PER_RECEIVER];
+    size_t fill[MAX_SOCKETS_PER_RECEIVER] = {0};
+    int rearm[MAX_SOCKETS_PER_RECEIVER] = {0};
+    uint64_t completions[MAX_SOCKETS_PER_RECEIVER] = {0};
+    size_t ready = 0;
+    for (; err == 0 && ready < n; ready++) {
+        ReceiverSocket* rs = &args->sockets[ready];
+        unsigned entries = 1024;
+        while (entries < 4 * rs->batch.capacity && entries < 32768) entries *= 2;
+        memset(&hdrs[ready], 0, sizeof(hdrs[ready]));
+        hdrs[ready].msg_controllen = rs->batch.control ? UDP_BATCH_CONTROL_SIZE : 0;
+        size_t size = sizeof(struct io_uring_recvmsg_out) + hdrs[ready].msg_controllen + rs->batch.frame_size;
+        err = uring_buf_ring_setup(&ring, &bufs[ready], (uint16_t)ready, entries, (size + 15) & ~(size_t)15);
+        if (err == 0) receiver_uring_arm(&ring, (unsigned)ready, &hdrs[ready]);
+    }
+    if (err == 0) {
+        struct io_uring_sqe* sqe = uring_get_sqe(&ring);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->fd = (int)n;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = URING_SHUTDOWN_TAG;
+        err = uring_submit_and_wait(&ring, 0);
+        err = err < 0 ? err : 0;
+    }
+
+    int stopped = 0;
+    int fallback = err < 0;
+    while (!stopped && !fallback) {
+        err = uring_submit_and_wait(&ring, 1);
+        if (err < 0 && err != -EINTR) {
+            alog_write(LOG_LEVEL_ERROR, args->sockets[0].name, 0, "io_uring_enter failed (errno %lu)",
+                       (uint64_t)-err, 0, 0);
             break;
         }
-        if (ready == 0) {
-            continue;  // Timeout, check done flag
-        }
-
-        if (FD_ISSET(sock, &read_fds)) {
-            int bytes = recvfrom(sock, buffer, sizeof(Message), 0, NULL, NULL);
-            if (bytes == sizeof(Message)) {
-                Message msg;
-                memcpy(&msg, buffer, sizeof(Message));
-                msg.MessageSize = ntohs(msg.MessageSize);
-                msg.MessageId = ntohll(msg.MessageId);
-                msg.MessageData = ntohll(msg.MessageData);
-
-                // Thread-safe insertion into messageStore
-                mutex_lock(&mtxStore);
-                if (!hash_map_contains(messageStore, msg.MessageId)) {
-                    hash_map_insert(messageStore, msg.MessageId, msg);
-                    char outBuffer[256];
-                    snprintf(outBuffer, sizeof(outBuffer), "%s received: ID=%lu, Data=%lu\n", name, msg.MessageId, msg.MessageData);
-                    print_out(outBuffer);
-
-                    // Queue for transmission if MessageData == 10
-                    if (msg.MessageData == 10) {
-                        // Dynamically allocate the message to avoid dangling pointer
-                        Message* msg_ptr = (Message*)malloc(sizeof(Message));
-                        *msg_ptr = msg;
-                        mutex_lock(&mtxQueue);
-                        queue_push(transmitQueue, msg_ptr);  // Push the pointer to the allocated message
-                        cond_signal(&cv);
-                        mutex_unlock(&mtxQueue);
-                    }
-                } else {
-                    char outBuffer[256];
-                    snprintf(outBuffer, sizeof(outBuffer), "%s skipped duplicate ID=%lu\n", name, msg.MessageId);
-                    print_out(outBuffer);
+
+        struct io_uring_cqe* cqe;
+        while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+            uint64_t tag = cqe->user_data;
+            int res = cqe->res;
+            uint32_t flags = cqe->flags;
+            uring_cqe_seen(&ring);
+            if (tag == URING_SHUTDOWN_TAG) {
+                stopped = 1;
+                continue;
+            }
+            ReceiverSocket* rs = &args->sockets[tag];
+            if (!(flags & IORING_CQE_F_MORE)) {
+                rearm[tag] = 1;  // Multishot ended: out of buffers, CQ overflow or an error
+            }
+            if (res < 0) {
+                if (res == -EINVAL && completions[tag] == 0) {
+                    fallback = 1;  // Kernel without multishot recvmsg
+                } else if (res != -ENOBUFS) {
+                    alog_write(LOG_LEVEL_ERROR, rs->name, 0, "io_uring recvmsg failed (errno %lu)",
+                               (uint64_t)-res, 0, 0);
+                    stopped = 1;
                 }
-                mutex_unlock(&mtxStore);
-            } else if (bytes < 0 && errno != EAGAIN) {
-                char buffer[256];
-                snprintf(buffer, sizeof(buffer), "%s recvfrom failed", name);
-                logError(buffer);
-                break;
+                continue;
+            }
+            completions[tag]++;
+            if (!(flags & IORING_CQE_F_BUFFER)) continue;
+
+            // Copy the datagram into the batch and give the buffer straight back
+            unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            char* buf = uring_buf_ring_buffer(&bufs[tag], bid);
+            struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*)buf;
+            char* control = buf + sizeof(*out) + hdrs[tag].msg_namelen;
+            if (rs->batch.control && out->controllen > 0) {
+                struct msghdr received;
+                memset(&received, 0, sizeof(received));
+                received.msg_control = control;
+                received.msg_controllen = out->controllen;
+                udp_batch_parse_drops(&rs->batch, &received);
+            }
+            udp_batch_store(&rs->batch, fill[tag]++, control + hdrs[tag].msg_controllen, out->payloadlen,
+                            (int)(out->flags & MSG_TRUNC));
+            uring_buf_ring_recycle(&bufs[tag], bid);
+            if (fill[tag] == rs->batch.capacity) {
+                udp_batch_commit(&rs->batch, fill[tag]);
+                receiver_process_batch(rs, (int)fill[tag]);
+                fill[tag] = 0;
             }
         }
+
+        for (size_t i = 0; i < n; i++) {
+            ReceiverSocket* rs = &args->sockets[i];
+            if (fill[i] > 0) {
+                udp_batch_commit(&rs->batch, fill[i]);
+                receiver_process_batch(rs, (int)fill[i]);
+                fill[i] = 0;
+            }
+            uring_buf_ring_publish(&bufs[i]);
+            if (rearm[i] && !stopped && !fallback) {
+                receiver_uring_arm(&ring, (unsigned)i, &hdrs[i]);
+                rearm[i] = 0;
+            }
+            receiver_report_drops(rs);
+        }
     }
-    close(sock);
-    return NULL;
+
+    if (fallback) {
+        alog_write(LOG_LEVEL_WARN, args->sockets[0].name, 0, "io_uring receive setup failed, using epoll",
+                   0, 0, 0);
+    }
+    uring_destroy(&ring);  // Cancels the armed requests before their buffers go away
+    for (size_t i = 0; i < ready; i++) {
+        uring_buf_ring_destroy(&ring, &bufs[i]);
+    }
+    return fallback ? -1 : 0;
 }
 
-/* Transmitter thread function for TCP sending */
-void* transmitterThread(void* arg) {
-    // Create TCP socket
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        logError("Transmitter socket creation failed");
+/* Receiver thread function for UDP message reception.
+ * Serves every socket in its ReceiverArgs from one io_uring or epoll loop that also watches the shutdown eventfd. */
+/* Close every socket of a receiver thread, on exit or when it cannot start */
+static void receiver_close_sockets(ReceiverArgs* args) {
+    for (size_t i = 0; i < args->num_sockets; i++) {
+        receiver_socket_close(&args->sockets[i]);
+    }
+}
+
+void* receiverThread(void* arg) {
+    ReceiverArgs* args = (ReceiverArgs*)arg;
+    if (args->cpu >= 0 && thread_pin_cpu(args->cpu) != 0) {
+        logError("Receiver CPU pinning failed");
+    }
+
+    RcuReader* rcu = rcu_register(&routeRcu);
+    if (!rcu) {
+        // Without a reader slot a route table swap could free the table under this thread
+        alog_write(LOG_LEVEL_ERROR, args->num_sockets > 0 ? args->sockets[0].name : NULL, 0,
+                   "no RCU reader slot left, receiver not started", 0, 0, 0);
+        receiver_close_sockets(args);
+        return NULL;
+    }
+    MetricsThread* metrics = metrics_thread_register(args->num_sockets > 0 ? args->sockets[0].name : "Receiver");
+    if (!metrics) {
+        alog_write(LOG_LEVEL_ERROR, args->num_sockets > 0 ? args->sockets[0].name : NULL, 0,
+                   "metrics allocation failed, receiver not started", 0, 0, 0);
+        receiver_close_sockets(args);
+        return NULL;
+    }
+    for (size_t i = 0; i < args->num_sockets; i++) {
+        args->sockets[i].rcu = rcu;
+        args->sockets[i].metrics = metrics;
+    }
+    if (config.io_backend == IO_BACKEND_URING && args->num_sockets > 0 && receiver_run_uring(args) == 0) {
+        receiver_close_sockets(args);
         return NULL;
     }
-    fcntl(sock, F_SETFL, O_NONBLOCK);
 
-    // Connect to TCP receiver
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(6000);
-    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
-
-    int retries = 5;
-    while (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 && retries > 0) {
-        if (errno == EINPROGRESS) {
-            fd_set write_fds;
-            FD_ZERO(&write_fds);
-            FD_SET(sock, &write_fds);
-            struct timeval tv = {0, 100000}; // 100ms timeout
-            select(sock + 1, NULL, &write_fds, NULL, &tv);
-            if (FD_ISSET(sock, &write_fds)) {
-                break;
+    EventLoop loop;
+    if (event_loop_init(&loop, shutdownFd) < 0) {
+        receiver_close_sockets(args);
+        return NULL;
+    }
+    for (size_t i = 0; i < args->num_sockets; i++) {
+        ReceiverSocket* rs = &args->sockets[i];
+        rs->loop = &loop;
+        rs->handler.callback = receiver_on_readable;
+        rs->handler.ctx = rs;
+        event_loop_add(&loop, &rs->handler, EPOLLIN);
+        receiver_on_readable(rs, EPOLLIN);  // Pick up anything that arrived before registration
+    }
+
+    if (args->num_sockets > 0) {
+        event_loop_run(&loop);
+    }
+    receiver_close_sockets(args);
+    event_loop_destroy(&loop);
+    return NULL;
+}
+
+/* Open receivers_per_port sockets on every configured port, in bind order, and
+ * give each its own thread. The sockets of one port form a SO_REUSEPORT group. */
+size_t start_receivers(ReceiverArgs* args, Thread* threads) {
+    size_t per_port = config.receivers_per_port;
+    int reuseport = per_port > 1;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t count = 0;
+    for (size_t p = 0; p < config.num_udp_ports; p++) {
+        int port = config.udp_ports[p];
+        size_t group_start = count;
+        for (size_t k = 0; k < per_port; k++) {
+            char name[RECEIVER_NAME_LEN];
+            if (per_port > 1) {
+                snprintf(name, sizeof(name), "Receiver %zu.%zu", p + 1, k + 1);
+            } else {
+                snprintf(name, sizeof(name), "Receiver %zu", p + 1);
+            }
+            ReceiverArgs* a = &args[count];
+            a->num_sockets = 0;
+            a->cpu = (config.reuseport_cpu_steering && cpus > 0) ? (int)(k % (size_t)cpus) : -1;
+            if (receiver_socket_open(&a->sockets[0], port, name, reuseport) == 0) {
+                a->num_sockets = 1;
+                count++;
             }
         }
-        logError("TCP connect failed, retrying...");
-        retries--;
-        usleep(100000);
+        // Steer each datagram to the socket whose thread is pinned to the receiving CPU
+        if (reuseport && config.reuseport_cpu_steering && count > group_start) {
+            reuseport_attach_cpu_steering(args[group_start].sockets[0].handler.fd, (unsigned)(count - group_start));
+        }
     }
-    if (retries == 0) {
-        logError("TCP connection failed after retries");
-        close(sock);
-        return NULL;
+    for (size_t i = 0; i < count; i++) {
+        thread_create(&threads[i], receiverThread, &args[i]);
     }
+    return count;
+}
+
+/* Messages the transmitter may still take off its ring without exceeding tx_buffer_bytes
+ * of unsent data. Past that the backlog stays in the bounded ring, where the overflow policy sees it */
+static size_t transmitter_room(const Downstream* out, const TcpSender* sender) {
+    size_t pending = tcp_sender_pending(sender);
+    return pending < out->tx_buffer_bytes ? (out->tx_buffer_bytes - pending) / WIRE_FRAME_SIZE : 0;
+}
 
-    // Process transmit queue
-    while (!done || !queue_empty(transmitQueue)) {
-        mutex_lock(&mtxQueue);
-        if (queue_empty(transmitQueue)) {
-            cond_wait(&cv, &mtxQueue);  // Wait for new messages
-            mutex_unlock(&mtxQueue);
-            continue;
+/* Shed the backlog of a throttled ring down to the low watermark: move it to the spill
+ * file, or discard it under drop-oldest and once the spill file is full or unusable */
+static void transmitter_shed(Downstream* out, MetricsThread* m, Message* batch, int64_t* stamps) {
+    size_t depth = mpsc_ring_size(out->ring);
+    size_t excess = depth > out->low_watermark ? depth - out->low_watermark : 0;
+    SpillRecord records[256];
+    uint64_t spilled = 0, dropped = 0;
+    while (excess > 0) {
+        size_t count = mpsc_ring_pop(out->ring, batch, stamps, excess < 256 ? excess : 256);
+        if (count == 0) break;
+        excess -= count;
+        size_t written = 0;
+        if (out->policy == OVERFLOW_SPILL) {
+            for (size_t i = 0; i < count; i++) {
+                records[i].msg = batch[i];
+                records[i].stamp = stamps[i];
+            }
+            written = spill_write(&out->spill, records, count);
         }
-        Message* msg_ptr = (Message*)queue_pop(transmitQueue);
-        Message msg = *msg_ptr;  // Copy the message
-        free(msg_ptr);           // Free the allocated memory
-        mutex_unlock(&mtxQueue);
+        spilled += written;
+        dropped += count - written;
+    }
+    out->spilled += spilled;
+    out->dropped_oldest += dropped;
+    if (m) {
+        metrics_add(m, METRIC_QUEUE_SPILLED, spilled);
+        metrics_add(m, METRIC_QUEUE_DROP_OLDEST, dropped);
+    }
+}
 
-        // Create and add task to thread pool
-        SendTask task;
-        task.sock = dup(sock);  // Duplicate socket for thread safety
-        task.msg = msg;
-        pool_add_task(sendPool, task);
+/* Queue up to room spilled messages for sending, oldest first. Returns the number queued */
+static size_t transmitter_replay(Downstream* out, TcpSender* sender, size_t room) {
+    SpillRecord records[256];
+    size_t replayed = 0;
+    while (replayed < room) {
+        size_t want = room - replayed < 256 ? room - replayed : 256;
+        size_t count = spill_read(&out->spill, records, want);
+        if (count == 0) break;
+        for (size_t i = 0; i < count; i++) {
+            tcp_sender_append(sender, &records[i].msg, records[i].stamp);
+        }
+        replayed += count;
     }
-    close(sock);
+    out->replayed += replayed;
+    if (sender->metrics) metrics_add(sender->metrics, METRIC_QUEUE_REPLAYED, replayed);
+    return replayed;
+}
+
+/* Move the queued messages of a disconnected endpoint to the healthy endpoints of
+ * its output, chosen as the receivers would choose them now. What finds no room
+ * there goes back to the end of the own ring, or is dropped if that is full too */
+static void transmitter_hand_off(Downstream* out, MetricsThread* m, Message* batch, int64_t* stamps) {
+    uint32_t cursor = 0;
+    size_t rebalanced = 0, handed = 0, dropped = 0;
+    size_t remaining = mpsc_ring_size(out->ring);  // Requeued messages are not popped again
+    while (remaining > 0) {
+        size_t count = mpsc_ring_pop(out->ring, batch, stamps, remaining < 256 ? remaining : 256);
+        if (count == 0) break;
+        remaining -= count;
+        for (size_t i = 0; i < count; i++) {
+            Downstream* to = output_pick(out->output, &batch[i], &cursor, &rebalanced);
+            if (to != out && mpsc_ring_push(to->ring, &batch[i], stamps[i])) {
+                handed++;
+            } else if (!mpsc_ring_push(out->ring, &batch[i], stamps[i])) {
+                dropped++;
+            }
+        }
+    }
+    out->handed_off += handed;
+    out->dropped_oldest += dropped;
+    if (m) {
+        metrics_add(m, METRIC_REBALANCED, handed);
+        metrics_add(m, METRIC_QUEUE_DROP_OLDEST, dropped);
+    }
+}
+
+/* Publish whether the endpoint is connected. Receivers stop choosing it while it is not */
+static void transmitter_set_health(Downstream* out, int up) {
+    uint32_t bit = 1u << out->index;
+    if (up) {
+        atomic_fetch_or(&out->output->healthy, bit);
+        alog_info(out->name, "Downstream up", 0, 0, 0);
+    } else {
+        atomic_fetch_and(&out->output->healthy, ~bit);
+        alog_write(LOG_LEVEL_WARN, out->name, 0, "Downstream down, %lu of %lu endpoints of the output up",
+                   (uint64_t)__builtin_popcount(atomic_load(&out->output->healthy)), out->output->num_downstreams, 0);
+    }
+}
+
+/* Transmitter thread function for TCP sending, one per endpoint.
+ * Owns the downstream connection and coalesces everything queued into one send per wakeup.
+ * At most tx_buffer_bytes are held unsent; while the downstream is slow or gone the rest
+ * waits in the ring, which the transmitter keeps marked throttled between the watermarks.
+ * An endpoint that shares its output with others keeps probing while disconnected and
+ * hands its queue to them, so traffic moves over when it goes down and back when it returns. */
+void* transmitterThread(void* arg) {
+    Downstream* out = (Downstream*)arg;
+    MpscRing* transmitRing = out->ring;
+    TcpSender sender;
+    tcp_sender_init(&sender, &out->tcp);
+    sender.metrics = metrics_thread_register(out->name);  // NULL if allocation failed; every use checks
+    sender.name = out->name;
+    tcp_sender_connect(&sender);
+
+    Message batch[256];
+    int64_t stamps[256];
+    int64_t shutdown_deadline = -1;
+    int throttled = 0;
+    int healthy = 1;
+    int shared = out->output->num_downstreams > 1;
+    // Under the shedding policies receivers wait for room on a full ring, so stalls are kept short
+    int sheds = out->policy == OVERFLOW_DROP_OLDEST || out->policy == OVERFLOW_SPILL;
+    int64_t nap = (sheds ? 1 : 10) * NSEC_PER_MSEC;
+    for (;;) {
+        int closed = atomic_load(&transmitRing->closed);
+        if (shared && !closed && !tcp_sender_connected(&sender)) {
+            tcp_sender_connect(&sender);  // Health probe; waits out the backoff
+        }
+        if (tcp_sender_connected(&sender) != healthy) {
+            healthy = !healthy;
+            transmitter_set_health(out, healthy);
+        }
+
+        size_t depth = mpsc_ring_size(transmitRing);
+        int next = backpressure_throttled(throttled, depth, out->high_watermark, out->low_watermark);
+        if (next != throttled) {
+            throttled = next;
+            if (throttled) {
+                atomic_store_explicit(&out->throttled, 1, memory_order_relaxed);
+                alog_write(LOG_LEVEL_WARN, out->name, 0, "Output queue above high watermark: depth %lu, %lu bytes unsent",
+                           depth, tcp_sender_pending(&sender), 0);
+            } else {
+                backpressure_release(&out->throttled);  // Wake the receivers parked by block
+                alog_info(out->name, "Output queue back below low watermark: depth %lu", depth, 0, 0);
+            }
+        }
+
+        size_t room = transmitter_room(out, &sender);
+        uint32_t others = atomic_load_explicit(&out->output->healthy, memory_order_relaxed) & ~(1u << out->index);
+        if (!healthy && others && !closed) {
+            // Down while other endpoints are up: they take the queue, this one waits for its reconnect
+            transmitter_hand_off(out, sender.metrics, batch, stamps);
+            int64_t wait = tcp_sender_time_to_connect(&sender, monotonic_ns());
+            usleep((useconds_t)((wait < 0 || wait > 10 * NSEC_PER_MSEC ? 10 * NSEC_PER_MSEC : wait) / NSEC_PER_USEC));
+            room = 0;
+        } else {
+            // Spilled messages are older than anything in the ring, so they go out first
+            if (room > 0 && spill_pending(&out->spill) > 0) {
+                room -= transmitter_replay(out, &sender, room);
+            }
+            if (room > 0 && spill_pending(&out->spill) == 0) {
+                // Sleep until messages arrive, the flush deadline expires or a reconnect (or probe) is due
+                int64_t now = monotonic_ns();
+                int64_t timeout = tcp_sender_next_wakeup(&sender, now);
+                int64_t probe = shared ? tcp_sender_time_to_connect(&sender, now) : -1;
+                if (probe >= 0 && (timeout < 0 || probe < timeout)) timeout = probe;
+                if (timeout < 0 && tcp_sender_corked(&sender)) {
+                    timeout = out->tcp.flush_deadline_ns;  // Keep the cork for one more coalescing window
+                }
+                size_t count = mpsc_ring_pop_wait(transmitRing, batch, stamps, room < 256 ? room : 256, timeout);
+                if (count == 0 && tcp_sender_pending(&sender) == 0) {
+                    tcp_sender_uncork(&sender);  // Idle for a whole window: push the partial segment
+                }
+                while (count > 0) {
+                    for (size_t i = 0; i < count; i++) {
+                        tcp_sender_append(&sender, &batch[i], stamps[i]);
+                    }
+                    room -= count;
+                    if (room == 0 || tcp_sender_pending(&sender) >= out->tcp.flush_bytes) break;
+                    count = mpsc_ring_pop(transmitRing, batch, stamps, room < 256 ? room : 256);  // Drain what is already queued
+                }
+            } else if (room == 0) {
+                // The downstream is not taking data: shed the backlog, then wait for the socket or the next reconnect
+                if (throttled && sheds) {
+                    transmitter_shed(out, sender.metrics, batch, stamps);
+                }
+            }
+        }
+
+        if (closed || tcp_sender_flush_due(&sender, monotonic_ns())) {
+            if (tcp_sender_flush(&sender) == 0 && tcp_sender_connected(&sender) && tcp_sender_pending(&sender) > 0) {
+                // Socket buffer full, wait for it to drain; briefly while the backlog may need shedding
+                tcp_sender_wait_writable(&sender, room == 0 ? (int)(nap / NSEC_PER_MSEC) : 100);
+            }
+        }
+        if (!tcp_sender_connected(&sender) && tcp_sender_pending(&sender) > 0 && (room == 0 || closed)) {
+            // Nothing more can be taken off the ring: sleep until the reconnect, at most one nap
+            int64_t wait = tcp_sender_next_wakeup(&sender, monotonic_ns());
+            usleep((useconds_t)((wait > nap ? nap : wait) / NSEC_PER_USEC));
+        }
+
+        if (closed) {
+            if (mpsc_ring_finished(transmitRing) && spill_pending(&out->spill) == 0 &&
+                tcp_sender_pending(&sender) == 0) {
+                break;
+            }
+            if (shutdown_deadline < 0) {
+                shutdown_deadline = monotonic_ns() + NSEC_PER_SEC;
+            } else if (monotonic_ns() > shutdown_deadline) {
+                alog_write(LOG_LEVEL_ERROR, out->name, 0,
+                           "Transmitter dropped %lu unsent bytes, %lu queued and %lu spilled messages on shutdown",
+                           tcp_sender_pending(&sender), mpsc_ring_size(transmitRing), spill_pending(&out->spill));
+                break;
+            }
+        }
+    }
+
+    alog_info(out->name, "Transmitter messages: %lu, send calls: %lu, reconnects: %lu",
+              sender.messages, sender.send_calls, sender.reconnects);
+    if (out->dropped_oldest || out->spilled) {
+        alog_info(out->name, "Transmitter backlog: %lu spilled, %lu replayed, %lu dropped oldest",
+                  out->spilled, out->replayed, out->dropped_oldest);
+    }
+    if (out->handed_off) {
+        alog_info(out->name, "Transmitter handed %lu queued messages to other endpoints", out->handed_off, 0, 0);
+    }
+    tcp_sender_destroy(&sender);
     return NULL;
 }
 
+/* Gauges sampled by the metrics aggregator */
+uint64_t gauge_ring_depth(void* ctx) {
+    return mpsc_ring_size((MpscRing*)ctx);
+}
+
+uint64_t gauge_endpoints_up(void* ctx) {
+    return (uint64_t)__builtin_popcount(atomic_load_explicit(&((OutputChannel*)ctx)->healthy, memory_order_relaxed));
+}
+
+uint64_t gauge_store_size(void* ctx) {
+    return store_size((ShardedStore*)ctx);
+}
+
+uint64_t gauge_seq_missed(void* ctx) {
+    return atomic_load_explicit(&((SeqWindow*)ctx)->missed, memory_order_relaxed);
+}
+
+uint64_t gauge_filter_fp_ppm(void* ctx) {
+    StoreFilterStats stats;
+    store_filter_stats((ShardedStore*)ctx, &stats);
+    return store_filter_fp_ppm(&stats);
+}
+
+uint64_t gauge_filter_skips(void* ctx) {
+    StoreFilterStats stats;
+    store_filter_stats((ShardedStore*)ctx, &stats);
+    return stats.skips;
+}
+
+/* SIGHUP handler: ask the main loop to reload the rules file */
+void on_sighup(int sig) {
+    (void)sig;
+    reloadRequested = 1;
+}
+
+/* Re-read the rules file and publish the compiled table. Receivers keep running:
+ * the old table is freed only after every read section that could see it has ended.
+ * Outputs are fixed at startup, so a file that changes them is rejected. */
+void reload_routes(void) {
+    if (!config.rules_file) return;
+    RouteConfig fresh;
+    char err[256];
+    if (route_config_load(config.rules_file, &fresh, err, sizeof(err)) < 0) {
+        char buffer[320];
+        snprintf(buffer, sizeof(buffer), "[ERROR] Rules reload failed, keeping current rules: %s\n", err);
+        print_err(buffer);
+        return;
+    }
+    if (!route_outputs_equal(&fresh, &routeConfig)) {
+        print_err("[ERROR] Rules reload rejected: outputs cannot change while running\n");
+        return;
+    }
+    RouteTable* old = atomic_exchange(&routeTable, route_table_compile(&fresh));
+    rcu_synchronize(&routeRcu);
+    route_table_destroy(old);
+    alog_info(NULL, "Routing rules reloaded: %lu rules", fresh.num_rules, 0, 0);
+}
+
 int main() {
     // Initialize global data structures
-    messageStore = hash_map_create(16);
-    transmitQueue = queue_create();
-    sendPool = pool_create(2);  // Use 2 worker threads for TCP sends
-    mutex_init(&mtxStore);
-    mutex_init(&mtxQueue);
-    cond_init(&cv);
+    config_load(&config);
+    if (config.rules_file) {
+        char err[256];
+        if (route_config_load(config.rules_file, &routeConfig, err, sizeof(err)) < 0) {
+            char buffer[320];
+            snprintf(buffer, sizeof(buffer), "[ERROR] %s\n", err);
+            print_err(buffer);
+            return 1;
+        }
+    } else {
+        route_config_default(&routeConfig, config.tcp.host, config.tcp.port);
+        routeConfig.outputs[0].balance = config.balance;
+        if (config.tcp_endpoints && route_parse_endpoints(config.tcp_endpoints, &routeConfig.outputs[0]) < 0) {
+            print_err("[ERROR] MT_TCP_ENDPOINTS must be <host>:<port>[,<host>:<port>...]\n");
+            return 1;
+        }
+    }
+    alog_start(config.log_level);
+    alog_info(batch_simd_name(batch_filter_init(config.simd_level)), "batch kernels selected", 0, 0, 0);
+    messageStore = store_create(config.store_shards, 16, config.dedup_window_count, config.dedup_window_ns);
+    if (config.filter_expected_ids > 0 &&
+        store_enable_filter(messageStore, config.filter_expected_ids, config.filter_bits_per_key) < 0) {
+        alog_write(LOG_LEVEL_WARN, NULL, 0, "Store pre-filter allocation failed, running without it", 0, 0, 0);
+    }
+
+    // Rebuild the dedup state from the message log before any receiver starts
+    MessageLog msgLog;
+    Thread msgLogThread;
+    if (config.msglog.dir) {
+        if (message_log_open(&msgLog, &config.msglog, messageStore, config.dedup_window_count) < 0) {
+            print_err("[ERROR] Message log unusable, exiting\n");
+            return 1;
+        }
+        alog_info(NULL, "Message log recovered %lu IDs from %lu segments in %lu ms", msgLog.recovered,
+                  msgLog.recovered_segments, (uint64_t)(msgLog.recovery_ns / NSEC_PER_MSEC));
+        msgLog.metrics = metrics_thread_register("Message log");
+        messageLog = &msgLog;
+        thread_create(&msgLogThread, messageLogThread, &msgLog);
+    }
+
+    // In sequence mode IDs up to the largest recovered one stay with the store, which holds them
+    SeqWindow window;
+    if (config.dedup_mode == DEDUP_MODE_SEQ) {
+        uint64_t floor = messageLog && messageLog->recovered ? messageLog->recovered_max_id + 1 : 0;
+        if (seq_window_init(&window, config.seq_window_ids, config.seq_history_ids, floor) < 0) {
+            print_err("[ERROR] Sequence window allocation failed\n");
+            return 1;
+        }
+        seqWindow = &window;
+        alog_info(NULL, "Sequence dedup window: %lu IDs, history %lu IDs, floor %lu", seq_window_ids(&window),
+                  seq_window_history_ids(&window), floor);
+    }
+    atomic_init(&routeTable, route_table_compile(&routeConfig));
+    shutdownFd = shutdown_fd_create();
+    signal(SIGHUP, on_sighup);
+    if (config.io_backend != IO_BACKEND_EPOLL) {
+        int available = uring_probe();
+        if (!available && config.io_backend == IO_BACKEND_URING) {
+            alog_write(LOG_LEVEL_WARN, NULL, 0, "io_uring unavailable, using epoll", 0, 0, 0);
+        }
+        config.io_backend = available ? IO_BACKEND_URING : IO_BACKEND_EPOLL;
+    }
+    alog_info(io_backend_name(config.io_backend), "I/O backend selected", 0, 0, 0);
 
     // Start threads
-    int port1 = 5000, port2 = 5001;
-    Thread t1, t2, t3;
-    thread_create(&t1, receiverThread, &port1);
-    thread_create(&t2, receiverThread, &port2);
-    thread_create(&t3, transmitterThread, NULL);
-
-    // Run for 10 seconds
-    sleep(10);
+    size_t maxReceivers = config.num_udp_ports * config.receivers_per_port;
+    if (rcu_domain_init(&routeRcu, maxReceivers) < 0) {
+        print_err("[ERROR] RCU reader allocation failed\n");
+        return 1;
+    }
+    ReceiverArgs* receiverArgs = (ReceiverArgs*)calloc(maxReceivers, sizeof(ReceiverArgs));
+    Thread* receivers = (Thread*)calloc(maxReceivers, sizeof(Thread));
+    size_t numOutputs = routeConfig.num_outputs;
+    outputs = (OutputChannel*)calloc(numOutputs, sizeof(OutputChannel));
+    numDownstreams = 0;
+    for (size_t i = 0; i < numOutputs; i++) {
+        numDownstreams += routeConfig.outputs[i].num_endpoints;
+    }
+    downstreams = (Downstream*)calloc(numDownstreams, sizeof(Downstream));
+    Downstream* nextDownstream = downstreams;
+    for (size_t i = 0; i < numOutputs; i++) {
+        const RouteOutput* route = &routeConfig.outputs[i];
+        OutputChannel* channel = &outputs[i];
+        snprintf(channel->name, sizeof(channel->name), "%s", route->name);
+        channel->balance = route->balance;
+        channel->downstreams = nextDownstream;
+        channel->num_downstreams = route->num_endpoints;
+        atomic_init(&channel->healthy, route->num_endpoints >= 32 ? UINT32_MAX : (1u << route->num_endpoints) - 1);
+        nextDownstream += route->num_endpoints;
+        for (size_t e = 0; e < route->num_endpoints; e++) {
+            Downstream* out = &channel->downstreams[e];
+            if (route->num_endpoints == 1) {
+                snprintf(out->name, sizeof(out->name), "%s", route->name);
+            } else {
+                snprintf(out->name, sizeof(out->name), "%s_%zu", route->name, e);
+            }
+            out->output = channel;
+            out->index = e;
+            out->tcp = config.tcp;
+            out->tcp.host = route->endpoints[e].host;
+            out->tcp.port = route->endpoints[e].port;
+            channel->seeds[e] = balance_seed(route->endpoints[e].host, route->endpoints[e].port);
+            out->ring = mpsc_ring_create(config.queue_capacity);
+            out->policy = config.backpressure.policy;
+            backpressure_watermarks(&config.backpressure, out->ring->capacity, &out->high_watermark, &out->low_watermark);
+            out->tx_buffer_bytes = config.backpressure.tx_buffer_bytes;
+            if (out->tx_buffer_bytes < out->tcp.flush_bytes + WIRE_FRAME_SIZE) {
+                out->tx_buffer_bytes = out->tcp.flush_bytes + WIRE_FRAME_SIZE;  // Room for one full flush
+            }
+            atomic_init(&out->throttled, 0);
+            if (spill_open(&out->spill, out->policy == OVERFLOW_SPILL ? config.backpressure.spill_dir : NULL, out->name,
+                           config.backpressure.spill_max_bytes) < 0 && out->policy == OVERFLOW_SPILL) {
+                alog_write(LOG_LEVEL_WARN, out->name, 0, "No usable MT_SPILL_DIR, spill falls back to drop-oldest", 0, 0, 0);
+            }
+        }
+        if (route->num_endpoints > 1) {
+            alog_info(balance_mode_name(route->balance), "Balance mode of output %lu, spread over %lu endpoints", i,
+                      route->num_endpoints, 0);
+        }
+    }
+    alog_info(overflow_policy_name(config.backpressure.policy), "Output overflow policy, watermarks %lu / %lu",
+              numDownstreams ? downstreams[0].high_watermark : 0, numDownstreams ? downstreams[0].low_watermark : 0, 0);
+    size_t numReceivers = start_receivers(receiverArgs, receivers);
+    for (size_t i = 0; i < numDownstreams; i++) {
+        thread_create(&downstreams[i].thread, transmitterThread, &downstreams[i]);
+    }
+
+    // Aggregate the per-thread metrics and export them when an endpoint or dump file is configured
+    MetricsServer metricsServer;
+    Thread metricsThread;
+    int exporting = (config.metrics.port > 0 || config.metrics.path) &&
+                    metrics_server_init(&metricsServer, &config.metrics, shutdownFd) == 0;
+    if (exporting) {
+        for (size_t i = 0; i < numDownstreams; i++) {
+            char gauge[METRICS_NAME_LEN];
+            snprintf(gauge, sizeof(gauge), "queue_depth_%s", downstreams[i].name);
+            metrics_gauge_register(gauge, gauge_ring_depth, downstreams[i].ring);
+        }
+        for (size_t i = 0; i < numOutputs; i++) {
+            if (outputs[i].num_downstreams < 2) continue;
+            char gauge[METRICS_NAME_LEN];
+            snprintf(gauge, sizeof(gauge), "endpoints_up_%s", outputs[i].name);
+            metrics_gauge_register(gauge, gauge_endpoints_up, &outputs[i]);
+        }
+        metrics_gauge_register("store_size", gauge_store_size, messageStore);
+        if (seqWindow) {
+            metrics_gauge_register("seq_missed", gauge_seq_missed, seqWindow);
+        }
+        if (config.filter_expected_ids > 0) {
+            metrics_gauge_register("store_filter_skips", gauge_filter_skips, messageStore);
+            metrics_gauge_register("store_filter_fp_ppm", gauge_filter_fp_ppm, messageStore);
+        }
+        thread_create(&metricsThread, metricsServerThread, &metricsServer);
+    }
+
+    // Serve lock-free store queries on the control socket when one is configured
+    ControlServer controlServer;
+    Thread controlThread;
+    int controlling = config.control_socket &&
+                      control_server_init(&controlServer, config.control_socket, messageStore, shutdownFd) == 0;
+    if (controlling) {
+        thread_create(&controlThread, controlServerThread, &controlServer);
+    }
+
+    // Run for the configured time, ageing out dedup entries and reporting the store once per second
+    int windowed = config.dedup_window_count > 0 || config.dedup_window_ns > 0;
+    uint64_t lastEvictions = 0;
+    for (size_t tick = 1; tick <= config.run_sec * 10; tick++) {
+        usleep(100000);
+        if (reloadRequested) {
+            reloadRequested = 0;
+            reload_routes();
+        }
+        store_expire(messageStore, monotonic_ns(), 256);
+        store_reclaim(messageStore);  // Free map arrays replaced by resizes once queries are done with them
+        if (windowed && tick % 10 == 0) {
+            uint64_t evictions = store_evictions(messageStore);
+            alog_info(NULL, "Store resident: %lu, evictions: %lu, eviction rate: %lu/s",
+                      store_size(messageStore), evictions, evictions - lastEvictions);
+            lastEvictions = evictions;
+        }
+    }
     done = 1;
-    cond_signal(&cv);
+    shutdown_fd_trigger(shutdownFd);
+    for (size_t i = 0; i < numDownstreams; i++) {
+        backpressure_release(&downstreams[i].throttled);  // Receivers parked by block see done
+        mpsc_ring_close(downstreams[i].ring);
+    }
 
     // Wait for threads to finish
-    thread_join(t1);
-    thread_join(t2);
-    thread_join(t3);
-
-    // Clean up any remaining messages in the transmit queue
-    while (!queue_empty(transmitQueue)) {
-        Message* msg_ptr = (Message*)queue_pop(transmitQueue);
-        free(msg_ptr);
+    for (size_t i = 0; i < numReceivers; i++) {
+        thread_join(receivers[i]);
+    }
+    if (messageLog) {
+        mpsc_ring_close(messageLog->ring);  // No more appends; the writer drains and syncs
+        thread_join(msgLogThread);
+        alog_info(NULL, "Message log appended: %lu, dropped: %lu, segments rotated: %lu", messageLog->appended,
+                  atomic_load(&messageLog->dropped), messageLog->rotations);
+        if (messageLog->lost) {
+            alog_write(LOG_LEVEL_WARN, NULL, 0, "Message log lost %lu appends for lack of disk space",
+                       messageLog->lost, 0, 0);
+        }
+    }
+    for (size_t i = 0; i < numDownstreams; i++) {
+        thread_join(downstreams[i].thread);
+    }
+    if (controlling) {
+        thread_join(controlThread);
+        control_server_destroy(&controlServer);
+    }
+    if (exporting) {
+        thread_join(metricsThread);
+        metrics_server_update(&metricsServer);  // Final totals
+        metrics_server_destroy(&metricsServer);
+    }
+    if (config.filter_expected_ids > 0) {
+        StoreFilterStats filterStats;
+        store_filter_stats(messageStore, &filterStats);
+        alog_info(NULL, "Store pre-filter: %lu probes skipped, false-positive rate %lu ppm, %lu rebuilds",
+                  filterStats.skips, store_filter_fp_ppm(&filterStats), filterStats.rebuilds);
+        alog_info(NULL, "Store pre-filter memory: %lu bytes", filterStats.bytes, 0, 0);
     }
+    uint64_t seqAccepted = 0;
+    if (seqWindow) {
+        for (size_t i = 0; i < numReceivers; i++) {
+            for (size_t j = 0; j < receiverArgs[i].num_sockets; j++) {
+                seqAccepted += receiverArgs[i].sockets[j].seqAccepted;
+            }
+        }
+        alog_info(NULL, "Sequence window: %lu accepted, %lu IDs in range never arrived on either line in time",
+                  seqAccepted, seq_window_span(seqWindow) - seqAccepted, 0);
+    }
+    alog_stop();  // Write out everything the threads logged
 
     // Print termination message
     print_out("Program finished. Total unique messages: ");
-    print_out_int((int)hash_map_size(messageStore));
+    print_out_int((int)(store_size(messageStore) + seqAccepted));
+    if (windowed) {
+        print_out("Evicted by the dedup window: ");
+        print_out_int((int)store_evictions(messageStore));
+    }
 
     // Clean up resources
-    hash_map_destroy(messageStore);
-    queue_destroy(transmitQueue);
-    pool_destroy(sendPool);
-    mutex_destroy(&mtxStore);
-    mutex_destroy(&mtxQueue);
-    cond_destroy(&cv);
+    store_destroy(messageStore);
+    if (seqWindow) {
+        seq_window_destroy(seqWindow);
+    }
+    if (messageLog) {
+        message_log_close(messageLog);
+    }
+    for (size_t i = 0; i < numDownstreams; i++) {
+        mpsc_ring_destroy(downstreams[i].ring);
+        spill_close(&downstreams[i].spill);
+    }
+    free(downstreams);
+    free(outputs);
+    metrics_destroy();
+    route_table_destroy(atomic_load(&routeTable));
+    rcu_domain_destroy(&routeRcu);
+    free(receiverArgs);
+    free(receivers);
+    close(shutdownFd);
     return 0;
 }
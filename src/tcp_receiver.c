@@ -1,109 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
-#include <sys/select.h>
 #include <errno.h>
 #include "../utils/custom_convectors.h"
 #include "../utils/custom_output.h"
+#include "../utils/event_loop.h"
 #include "../utils/log_error.h"
 #include "../utils/message.h"
+#include "../utils/message_sink.h"
+#include "../utils/reuseport.h"
+#include "../utils/socket_tuning.h"
+#include "../utils/stream_framer.h"
+#include "../utils/thread_utils.h"
+#include "../utils/time_utils.h"
+#include "../utils/wire_codec.h"
 
-int main() {
-    // Create TCP socket
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
+#define RECEIVER_READ_BUFFER (256 * 1024)  // Per-connection receive buffer
+#define RECEIVER_MAX_BATCH (RECEIVER_READ_BUFFER / WIRE_FRAME_SIZE)
+#define RECEIVER_MAX_THREADS 64
+
+/* Receiver settings */
+typedef struct {
+    int port;              // TCP port to listen on
+    const char* sink;      // Sink spec: stdout, count or file:<path>
+    size_t threads;        // Reactor threads, each with its own SO_REUSEPORT listener
+    double report_sec;     // Interval between stats lines on stderr, 0 = none
+} TcpReceiverOptions;
+
+typedef struct ReceiverConnection ReceiverConnection;
+
+/* One reactor thread: a listener of the port's SO_REUSEPORT group and the connections it accepted */
+typedef struct {
+    EventLoop loop;                   // Serves the listener, connections and the shutdown fd
+    EventHandler listener;            // Listening socket
+    ReceiverConnection* connections;  // Open connections of this thread
+    Message* msgs;                    // Decoded frames of one read
+    char* scratch;                    // Sink formatting buffer
+    MessageSink* sink;                // Shared output
+    const SocketTuning* tuning;       // Socket profile for accepted connections
+    _Atomic uint64_t accepted;        // Connections accepted
+    _Atomic uint64_t open;            // Connections currently open
+    _Atomic uint64_t invalid;         // Frames dropped for an unknown version
+} ReceiverThread;
+
+/* One sender connection. Frames split across reads are reassembled in its framer */
+struct ReceiverConnection {
+    EventHandler handler;
+    StreamFramer framer;
+    ReceiverThread* owner;
+    ReceiverConnection* prev;
+    ReceiverConnection* next;
+};
+
+static int shutdownFd = -1;
+static volatile sig_atomic_t interrupted = 0;
+
+/* SIGINT/SIGTERM: stop the reactors (writing to an eventfd is async-signal-safe) */
+static void on_signal(int sig) {
+    (void)sig;
+    interrupted = 1;
+    shutdown_fd_trigger(shutdownFd);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -p port      TCP port to listen on (6000)\n"
+            "  -s sink      stdout, count or file:<path> (stdout)\n"
+            "  -n threads   reactor threads sharing the port via SO_REUSEPORT (1)\n"
+            "  -i seconds   stats line interval on stderr, 0 = none (0)\n",
+            prog);
+}
+
+static void connection_close(ReceiverConnection* conn) {
+    ReceiverThread* rt = conn->owner;
+    event_loop_del(&rt->loop, &conn->handler);
+    close(conn->handler.fd);
+    framer_destroy(&conn->framer);
+    if (conn->prev) conn->prev->next = conn->next;
+    else rt->connections = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    atomic_fetch_sub(&rt->open, 1);
+    free(conn);
+}
+
+/* Connection readable: read into the framer until drained and pass every complete frame to the sink */
+static void on_connection_readable(void* ctx, uint32_t events) {
+    ReceiverConnection* conn = (ReceiverConnection*)ctx;
+    ReceiverThread* rt = conn->owner;
+    (void)events;
+    for (;;) {
+        ssize_t bytes = framer_read(&conn->framer, conn->handler.fd);
+        if (bytes > 0) {
+            size_t frames = framer_frames(&conn->framer);
+            size_t count = wire_decode_batch((const uint8_t*)framer_frame(&conn->framer, 0), WIRE_FRAME_SIZE,
+                                             frames, rt->msgs);
+            framer_consume(&conn->framer, frames);  // A trailing partial frame stays for the next read
+            atomic_fetch_add_explicit(&rt->invalid, frames - count, memory_order_relaxed);
+            message_sink_write(rt->sink, rt->msgs, count, rt->scratch);
+            continue;
+        }
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes < 0) {
+            logError("Recv failed");
+        } else if (conn->framer.len > 0) {
+            print_err("[WARN] Client disconnected mid-frame, partial frame dropped\n");
+        } else {
+            print_err("Client disconnected\n");
+        }
+        connection_close(conn);
+        return;
+    }
+}
+
+/* Listener readable: accept every pending connection */
+static void on_listener_readable(void* ctx, uint32_t events) {
+    ReceiverThread* rt = (ReceiverThread*)ctx;
+    (void)events;
+    for (;;) {
+        int sock = accept4(rt->listener.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                logError("Accept failed");
+            }
+            return;
+        }
+        // Buffer sizes are inherited from the listener; the rest is set per connection
+        SocketTuningResult granted;
+        socket_tuning_apply(sock, rt->tuning, &granted);
+        char tuned[192], line[256];
+        socket_tuning_describe(&granted, tuned, sizeof(tuned));
+        snprintf(line, sizeof(line), "Client connected, socket granted %s\n", tuned);
+        print_err(line);
+
+        ReceiverConnection* conn = (ReceiverConnection*)calloc(1, sizeof(ReceiverConnection));
+        if (!conn || framer_init(&conn->framer, RECEIVER_READ_BUFFER, WIRE_FRAME_SIZE) < 0) {
+            logError("Connection allocation failed");
+            free(conn);
+            close(sock);
+            continue;
+        }
+        conn->owner = rt;
+        conn->handler.fd = sock;
+        conn->handler.callback = on_connection_readable;
+        conn->handler.ctx = conn;
+        conn->next = rt->connections;
+        if (conn->next) conn->next->prev = conn;
+        rt->connections = conn;
+        atomic_fetch_add(&rt->accepted, 1);
+        atomic_fetch_add(&rt->open, 1);
+        event_loop_add(&rt->loop, &conn->handler, EPOLLIN | EPOLLRDHUP);
+        on_connection_readable(conn, EPOLLIN);  // Data may already be waiting
+    }
+}
+
+/* Create a listener in the port's SO_REUSEPORT group. The profile is applied before
+ * listen() so accepted connections inherit the buffer sizes. Returns the socket or -1 */
+static int receiver_listen(int port, const SocketTuning* tuning) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (sock < 0) {
         logError("Socket creation failed");
-        return 1;
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (reuseport_enable(sock) < 0) {
+        close(sock);
+        return -1;
     }
-    fcntl(sock, F_SETFL, O_NONBLOCK);  // Set non-blocking mode
+    socket_tuning_apply(sock, tuning, NULL);
 
-    // Bind to port 6000
     struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
-    addr.sin_port = htons(6000);
+    addr.sin_port = htons((uint16_t)port);
     addr.sin_addr.s_addr = INADDR_ANY;
     if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
         logError("Bind failed");
         close(sock);
-        return 1;
+        return -1;
     }
-    if (listen(sock, 5) < 0) {
+    if (listen(sock, SOMAXCONN) < 0) {
         logError("Listen failed");
         close(sock);
-        return 1;
+        return -1;
     }
+    return sock;
+}
 
-    print_out("TCP receiver listening on port 6000...\n");
-
-    // Accept client connection
-    int clientSock = -1;
-    fd_set read_fds;
-    struct timeval tv;
-    while (clientSock < 0) {
-        FD_ZERO(&read_fds);
-        FD_SET(sock, &read_fds);
-        tv.tv_sec = 0;
-        tv.tv_usec = 10000;  // 10ms timeout
-
-        int ready = select(sock + 1, &read_fds, NULL, NULL, &tv);
-        if (ready < 0) {
-            logError("Accept select failed");
-            close(sock);
-            return 1;
-        }
-        if (ready == 0) {
-            continue;
-        }
-        if (FD_ISSET(sock, &read_fds)) {
-            clientSock = accept(sock, NULL, NULL);
-            if (clientSock < 0 && errno != EAGAIN) {
-                logError("Accept failed");
-                close(sock);
-                return 1;
-            }
+/* Reactor thread: serve the listener and its connections until shutdown */
+static void* receiverThread(void* arg) {
+    ReceiverThread* rt = (ReceiverThread*)arg;
+    event_loop_run(&rt->loop);
+    while (rt->connections) {
+        connection_close(rt->connections);
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    TcpReceiverOptions opts = {6000, "stdout", 1, 0.0};
+    int opt;
+    while ((opt = getopt(argc, argv, "p:s:n:i:h")) != -1) {
+        switch (opt) {
+            case 'p': opts.port = atoi(optarg); break;
+            case 's': opts.sink = optarg; break;
+            case 'n': opts.threads = strtoull(optarg, NULL, 10); break;
+            case 'i': opts.report_sec = atof(optarg); break;
+            default: usage(argv[0]); return 2;
         }
     }
-    fcntl(clientSock, F_SETFL, O_NONBLOCK);
-
-    // Receive messages
-    char buffer[sizeof(Message)];
-    while (1) {
-        FD_ZERO(&read_fds);
-        FD_SET(clientSock, &read_fds);
-        tv.tv_sec = 0;
-        tv.tv_usec = 10000;  // 10ms timeout
-
-        int ready = select(clientSock + 1, &read_fds, NULL, NULL, &tv);
-        if (ready < 0) {
-            logError("Recv select failed");
+    if (opts.threads == 0 || opts.threads > RECEIVER_MAX_THREADS) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    MessageSink sink;
+    if (message_sink_open(&sink, opts.sink) < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    SocketTuning tuning;
+    socket_tuning_load(&tuning);
+    shutdownFd = shutdown_fd_create();
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    // One listener per reactor thread; the kernel spreads new connections across the group
+    ReceiverThread* reactors = (ReceiverThread*)calloc(opts.threads, sizeof(ReceiverThread));
+    Thread threads[RECEIVER_MAX_THREADS];
+    size_t started = 0;
+    for (size_t i = 0; i < opts.threads; i++) {
+        ReceiverThread* rt = &reactors[i];
+        int sock = receiver_listen(opts.port, &tuning);
+        if (sock < 0 || event_loop_init(&rt->loop, shutdownFd) < 0) {
+            if (sock >= 0) close(sock);
             break;
         }
-        if (ready == 0) {
-            continue;
-        }
-        if (FD_ISSET(clientSock, &read_fds)) {
-            int bytes = recv(clientSock, buffer, sizeof(Message), 0);
-            if (bytes == sizeof(Message)) {
-                Message msg;
-                memcpy(&msg, buffer, sizeof(Message));
-                msg.MessageSize = ntohs(msg.MessageSize);
-                msg.MessageId = ntohll(msg.MessageId);
-                msg.MessageData = ntohll(msg.MessageData);
-                char outBuffer[256];
-                snprintf(outBuffer, sizeof(outBuffer), "Received via TCP: ID=%lu, Data=%lu\n", msg.MessageId, msg.MessageData);
-                print_out(outBuffer);
-            } else if (bytes < 0 && errno != EAGAIN) {
-                logError("Recv failed");
-                break;
-            } else if (bytes == 0) {
-                print_out("Client disconnected\n");
-                break;
+        rt->sink = &sink;
+        rt->tuning = &tuning;
+        rt->msgs = (Message*)malloc(sizeof(Message) * RECEIVER_MAX_BATCH);
+        rt->scratch = (char*)malloc(message_sink_scratch_size(RECEIVER_MAX_BATCH));
+        rt->listener.fd = sock;
+        rt->listener.callback = on_listener_readable;
+        rt->listener.ctx = rt;
+        event_loop_add(&rt->loop, &rt->listener, EPOLLIN);
+        started++;
+    }
+    if (started == 0) {
+        message_sink_close(&sink);
+        return 1;
+    }
+    for (size_t i = 0; i < started; i++) {
+        thread_create(&threads[i], receiverThread, &reactors[i]);
+    }
+
+    char line[256];
+    snprintf(line, sizeof(line), "TCP receiver listening on port %d with %zu thread(s), sink %s\n",
+             opts.port, started, opts.sink);
+    print_err(line);
+
+    // Flush the sink regularly and print stats until interrupted
+    int64_t start = monotonic_ns();
+    int64_t report_ns = (int64_t)(opts.report_sec * NSEC_PER_SEC);
+    int64_t next_report = start + report_ns;
+    uint64_t last_messages = 0;
+    while (!interrupted) {
+        usleep(100000);
+        message_sink_flush(&sink);
+        int64_t now = monotonic_ns();
+        if (report_ns > 0 && now >= next_report) {
+            uint64_t open = 0, accepted = 0, invalid = 0;
+            for (size_t i = 0; i < started; i++) {
+                open += atomic_load(&reactors[i].open);
+                accepted += atomic_load(&reactors[i].accepted);
+                invalid += atomic_load(&reactors[i].invalid);
             }
+            uint64_t messages = atomic_load(&sink.messages);
+            snprintf(line, sizeof(line), "[stats] t=%.1fs connections=%lu/%lu messages=%lu rate=%.0f/s invalid=%lu\n",
+                     (double)(now - start) / NSEC_PER_SEC, open, accepted, messages,
+                     (double)(messages - last_messages) * NSEC_PER_SEC / (double)(report_ns + now - next_report),
+                     invalid);
+            print_err(line);
+            last_messages = messages;
+            next_report = now + report_ns;
         }
     }
 
-    close(clientSock);
-    close(sock);
+    for (size_t i = 0; i < started; i++) {
+        thread_join(threads[i]);
+        close(reactors[i].listener.fd);
+        event_loop_destroy(&reactors[i].loop);
+        free(reactors[i].msgs);
+        free(reactors[i].scratch);
+    }
+    snprintf(line, sizeof(line), "TCP receiver stopped. Messages: %lu, batches: %lu\n",
+             atomic_load(&sink.messages), atomic_load(&sink.batches));
+    print_err(line);
+    message_sink_close(&sink);
+    free(reactors);
+    close(shutdownFd);
     return 0;
 }
@@ -6,14 +6,14 @@
 #include "../utils/custom_output.h"
 #include "../utils/log_error.h"
 #include "../utils/message.h"
+#include "../utils/socket_tuning.h"
+#include "../utils/wire_codec.h"
 
 /* Send a message over UDP */
 void sendMessage(int sock, struct sockaddr_in* addr, Message msg) {
-    Message netMsg = msg;
-    netMsg.MessageSize = htons(msg.MessageSize);
-    netMsg.MessageId = htonll(msg.MessageId);
-    netMsg.MessageData = htonll(msg.MessageData);
-    if (sendto(sock, &netMsg, sizeof(Message), 0, (struct sockaddr*)addr, sizeof(*addr)) < 0) {
+    uint8_t frame[WIRE_FRAME_SIZE];
+    wire_encode(frame, &msg);
+    if (sendto(sock, frame, sizeof(frame), 0, (struct sockaddr*)addr, sizeof(*addr)) < 0) {
         char buffer[256];
         snprintf(buffer, sizeof(buffer), "Failed to send message ID=%lu", msg.MessageId);
         logError(buffer);
@@ -28,6 +28,16 @@ int main() {
         return 1;
     }
 
+    // Apply the socket profile (MT_SO_SNDBUF, MT_IP_TOS, MT_SO_PRIORITY, ...) and report what was granted
+    SocketTuning tuning;
+    SocketTuningResult granted;
+    socket_tuning_load(&tuning);
+    socket_tuning_apply(sock, &tuning, &granted);
+    char tuned[192], line[256];
+    socket_tuning_describe(&granted, tuned, sizeof(tuned));
+    snprintf(line, sizeof(line), "Socket granted %s\n", tuned);
+    print_out(line);
+
     // Set up destination addresses
     struct sockaddr_in addr1, addr2;
     addr1.sin_family = AF_INET;
@@ -39,7 +49,7 @@ int main() {
 
     // Send test messages
     for (int i = 0; i < 10; ++i) {
-        Message msg = {sizeof(Message), 1, (uint64_t)(i % 5), (i % 3 == 0) ? 10 : i};
+        Message msg = {WIRE_FRAME_SIZE, 1, (uint64_t)(i % 5), (i % 3 == 0) ? 10 : i};
         sendMessage(sock, &addr1, msg);
         sendMessage(sock, &addr2, msg);
         char buffer[256];
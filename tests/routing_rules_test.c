@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <unistd.h>
+#include "../utils/routing_rules.h"
+
+/* Checks for rule parsing, compilation and evaluation in routing_rules.h. Exits non-zero on failure */
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+/* Write text to a temporary rules file and load it. Returns route_config_load's result */
+static int load_rules(const char* text, RouteConfig* cfg) {
+    char path[] = "/tmp/routing_rules_test.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return -1;
+    ssize_t len = (ssize_t)strlen(text);
+    int written = write(fd, text, (size_t)len) == len;
+    close(fd);
+    char err[256] = "";
+    int result = written ? route_config_load(path, cfg, err, sizeof(err)) : -1;
+    unlink(path);
+    return result;
+}
+
+static uint32_t eval(const RouteTable* table, uint8_t type, uint64_t id, uint64_t data) {
+    Message msg = {18, type, id, data};
+    return route_eval(table, &msg);
+}
+
+/* Overlapping ID and data ranges, type-specific rules on top of wildcard ones */
+static void test_overlapping(void) {
+    RouteConfig cfg;
+    CHECK(load_rules("output a 127.0.0.1:9001\n"
+                     "output b 127.0.0.1:9002,127.0.0.1:9003 balance=round-robin\n"
+                     "output c 127.0.0.1:9004\n"
+                     "rule a id=100-199\n"
+                     "rule b id=150-249 data=10-20   # overlaps rule a on 150-199\n"
+                     "rule c type=2 data=15-*\n"
+                     "rule a type=3 id=0-9\n",
+                     &cfg) == 0);
+    CHECK(cfg.num_outputs == 3 && cfg.num_rules == 4);
+    CHECK(cfg.outputs[1].num_endpoints == 2 && cfg.outputs[1].balance == BALANCE_ROUND_ROBIN);
+
+    RouteTable* table = route_table_compile(&cfg);
+    CHECK(!table->single_value);
+    CHECK(table->num_tables == 3);  // Wildcard, type 2, type 3
+
+    // Wildcard rules only
+    CHECK(eval(table, 0, 99, 15) == 0);
+    CHECK(eval(table, 0, 100, 0) == 1);
+    CHECK(eval(table, 0, 150, 12) == 3);
+    CHECK(eval(table, 0, 199, 20) == 3);
+    CHECK(eval(table, 0, 199, 21) == 1);
+    CHECK(eval(table, 0, 200, 10) == 2);
+    CHECK(eval(table, 0, 249, 9) == 0);
+    CHECK(eval(table, 0, 250, 10) == 0);
+    CHECK(eval(table, 0, UINT64_MAX, UINT64_MAX) == 0);
+    CHECK(eval(table, 7, 160, 15) == 3);
+
+    // Type 2 adds rule c on every ID
+    CHECK(eval(table, 2, 0, 15) == 4);
+    CHECK(eval(table, 2, 0, 14) == 0);
+    CHECK(eval(table, 2, 160, 15) == 7);
+    CHECK(eval(table, 2, 160, 14) == 3);
+    CHECK(eval(table, 2, 230, UINT64_MAX) == 4);
+
+    // Type 3 adds IDs 0-9 to output a, which also gets 100-199 from the wildcard rule
+    CHECK(eval(table, 3, 9, 0) == 1);
+    CHECK(eval(table, 3, 10, 0) == 0);
+    CHECK(eval(table, 3, 120, 0) == 1);
+    CHECK(eval(table, 0, 9, 0) == 0);
+    route_table_destroy(table);
+}
+
+/* The built-in "data=10" configuration takes the single-value fast path */
+static void test_default(void) {
+    RouteConfig cfg;
+    route_config_default(&cfg, "127.0.0.1", 9001);
+    RouteTable* table = route_table_compile(&cfg);
+    CHECK(table->single_value && table->single_data == 10 && table->single_output == 0);
+    CHECK(eval(table, 0, 1, 10) == 1);
+    CHECK(eval(table, 255, UINT64_MAX, 10) == 1);
+    CHECK(eval(table, 0, 1, 9) == 0);
+    CHECK(eval(table, 0, 1, 11) == 0);
+    route_table_destroy(table);
+}
+
+static void test_errors(void) {
+    RouteConfig cfg;
+    CHECK(load_rules("rule a id=1\n", &cfg) < 0);
+    CHECK(load_rules("output a 127.0.0.1:9001\nrule a id=5-4\n", &cfg) < 0);
+    CHECK(load_rules("output a 127.0.0.1:9001\nrule a type=256\n", &cfg) < 0);
+    CHECK(load_rules("output a 127.0.0.1:9001\nrule a type=-1\n", &cfg) < 0);
+    CHECK(load_rules("output a 127.0.0.1:9001\nrule a id=-5\n", &cfg) < 0);
+    CHECK(load_rules("output a 127.0.0.1:9001\nrule a data=1--2\n", &cfg) < 0);
+    CHECK(load_rules("output a 127.0.0.1:9001\nrule a id=0x10-0x1f data=7-*\n", &cfg) == 0);
+    CHECK(cfg.rules[0].id_lo == 16 && cfg.rules[0].id_hi == 31 && cfg.rules[0].data_hi == UINT64_MAX);
+    CHECK(load_rules("output a 127.0.0.1\n", &cfg) < 0);
+    CHECK(load_rules("# nothing\n", &cfg) < 0);
+}
+
+int main(void) {
+    test_overlapping();
+    test_default();
+    test_errors();
+    if (failures) {
+        fprintf(stderr, "routing_rules_test: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("routing_rules_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include <pthread.h>
+#include <stdio.h>
+#include "../utils/seq_window.h"
+
+/* Checks for the lock-free sequence window of seq_window.h. Exits non-zero on failure */
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+#define ID(block, offset) ((uint64_t)(block) * SEQ_WINDOW_BLOCK + (offset))
+
+/* In-order, duplicate, late and evicted IDs in a two-slot window without history, and the missed count */
+static void test_mark(void) {
+    SeqWindow w;
+    CHECK(seq_window_init(&w, 64, 0, 0) == 0);
+    CHECK(seq_window_ids(&w) == 64);
+    CHECK(seq_window_span(&w) == 0);
+
+    // Block 0 in order, leaving a gap at 7
+    for (uint64_t id = 0; id < 32; id++) {
+        if (id != 7) CHECK(seq_window_mark(&w, id) == SEQ_NEW);
+    }
+    CHECK(seq_window_mark(&w, 5) == SEQ_DUPLICATE);
+
+    // Block 1 out of order: 33 arrives after 40 but is still in the window
+    CHECK(seq_window_mark(&w, 40) == SEQ_NEW);
+    CHECK(seq_window_mark(&w, 33) == SEQ_NEW);
+    CHECK(seq_window_mark(&w, 40) == SEQ_DUPLICATE);
+    CHECK(atomic_load(&w.missed) == 0);
+
+    // Block 2 takes over block 0's slot: the gap at 7 is missed and 7 is now too late
+    CHECK(seq_window_mark(&w, ID(2, 0)) == SEQ_NEW);
+    CHECK(atomic_load(&w.missed) == 1);
+    CHECK(seq_window_mark(&w, 7) == SEQ_EXPIRED);
+    CHECK(seq_window_mark(&w, 3) == SEQ_EXPIRED);
+
+    // Block 5 takes over block 1's slot: 30 gaps in block 1, block 3 never arrived
+    CHECK(seq_window_mark(&w, ID(5, 0)) == SEQ_NEW);
+    CHECK(atomic_load(&w.missed) == 1 + 30 + 32);
+    CHECK(seq_window_mark(&w, 33) == SEQ_EXPIRED);
+    CHECK(seq_window_span(&w) == ID(5, 0) + 1);
+    seq_window_destroy(&w);
+}
+
+/* The first block to reach a slot counts the earlier blocks that should have used it */
+static void test_first_use(void) {
+    SeqWindow w;
+    CHECK(seq_window_init(&w, 64, 0, 0) == 0);
+    CHECK(seq_window_mark(&w, ID(0, 4)) == SEQ_NEW);
+    CHECK(seq_window_mark(&w, ID(3, 0)) == SEQ_NEW);
+    CHECK(atomic_load(&w.missed) == 32);  // Block 1
+    seq_window_destroy(&w);
+}
+
+static void test_floor(void) {
+    SeqWindow w;
+    CHECK(seq_window_init(&w, 100, 0, 1000) == 0);
+    CHECK(seq_window_ids(&w) == 128);
+    CHECK(seq_window_mark(&w, 999) == SEQ_OUTSIDE);
+    CHECK(seq_window_mark(&w, 1000) == SEQ_NEW);
+    CHECK(seq_window_mark(&w, 1000) == SEQ_DUPLICATE);
+    CHECK(seq_window_span(&w) == 1);
+    seq_window_destroy(&w);
+}
+
+/* Block numbers are kept modulo 2^32: check the blocks on both sides of the wrap */
+static void test_wraparound(void) {
+    const uint64_t last = UINT32_MAX;  // Last block before the tags wrap
+    SeqWindow w;
+    CHECK(seq_window_init(&w, 64, 0, 0) == 0);
+    CHECK(seq_window_mark(&w, ID(last, 0)) == SEQ_NEW);
+    CHECK(seq_window_mark(&w, ID(last - 2, 0)) == SEQ_EXPIRED);
+    CHECK(seq_window_mark(&w, ID(last, 0)) == SEQ_DUPLICATE);
+    CHECK(seq_window_mark(&w, ID(last + 1, 0)) == SEQ_NEW);
+    CHECK(seq_window_mark(&w, ID(last + 1, 0)) == SEQ_DUPLICATE);
+    CHECK(seq_window_mark(&w, ID(last - 1, 0)) == SEQ_EXPIRED);
+    CHECK(atomic_load(&w.missed) == 0);
+    CHECK(seq_window_mark(&w, ID(last + 2, 0)) == SEQ_NEW);
+    CHECK(atomic_load(&w.missed) == 31);  // Block last, evicted across the wrap
+    CHECK(seq_window_mark(&w, ID(last, 1)) == SEQ_EXPIRED);
+    CHECK(seq_window_mark(&w, ID(last + 2, 0)) == SEQ_DUPLICATE);
+    seq_window_destroy(&w);
+}
+
+/* Blocks that left the window are checked against the history until they leave it too */
+static void test_history(void) {
+    SeqWindow w;
+    CHECK(seq_window_init(&w, 64, 256, 0) == 0);
+    CHECK(seq_window_history_ids(&w) == 256);
+    for (uint64_t id = 0; id < 32; id++) {
+        if (id != 7) CHECK(seq_window_mark(&w, id) == SEQ_NEW);
+    }
+    CHECK(seq_window_mark(&w, ID(1, 5)) == SEQ_NEW);
+    CHECK(seq_window_mark(&w, ID(2, 0)) == SEQ_NEW);  // Block 0 moves to the history
+    CHECK(atomic_load(&w.missed) == 1);
+
+    // The gap at 7 is filled late, exactly once
+    CHECK(seq_window_mark(&w, 7) == SEQ_NEW);
+    CHECK(seq_window_mark(&w, 7) == SEQ_DUPLICATE);
+    CHECK(seq_window_mark(&w, 3) == SEQ_DUPLICATE);
+
+    CHECK(seq_window_mark(&w, ID(3, 0)) == SEQ_NEW);  // Block 1 moves to the history
+    CHECK(seq_window_mark(&w, ID(1, 5)) == SEQ_DUPLICATE);
+    CHECK(seq_window_mark(&w, ID(1, 6)) == SEQ_NEW);
+
+    // Block 4 never reached the window before block 10 took its slot
+    CHECK(seq_window_mark(&w, ID(8, 0)) == SEQ_NEW);
+    CHECK(seq_window_mark(&w, ID(10, 0)) == SEQ_NEW);  // Block 8 replaces block 0 in the history
+    CHECK(seq_window_mark(&w, ID(4, 1)) == SEQ_NEW);
+    CHECK(seq_window_mark(&w, ID(4, 1)) == SEQ_DUPLICATE);
+    CHECK(seq_window_mark(&w, ID(8, 0)) == SEQ_DUPLICATE);
+    CHECK(seq_window_mark(&w, 9) == SEQ_EXPIRED);  // Block 0 has left the history as well
+    seq_window_destroy(&w);
+}
+
+#define RACE_IDS 200000
+
+typedef struct {
+    SeqWindow* window;
+    uint64_t accepted;
+} RaceLine;
+
+static void* race_line(void* arg) {
+    RaceLine* line = (RaceLine*)arg;
+    for (uint64_t id = 0; id < RACE_IDS; id++) {
+        line->accepted += seq_window_mark(line->window, id) == SEQ_NEW;
+    }
+    return NULL;
+}
+
+/* Two lines carrying the same IDs: every ID is accepted exactly once */
+static void test_ab_lines(void) {
+    SeqWindow w;
+    CHECK(seq_window_init(&w, 4096, 0, 0) == 0);
+    RaceLine lines[2] = {{&w, 0}, {&w, 0}};
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&threads[i], NULL, race_line, &lines[i]);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    CHECK(lines[0].accepted + lines[1].accepted == RACE_IDS);
+    CHECK(atomic_load(&w.missed) == 0);
+    CHECK(seq_window_span(&w) == RACE_IDS);
+    seq_window_destroy(&w);
+}
+
+/* The same with a window far smaller than the lag between the lines: the history keeps it exact */
+static void test_ab_lines_history(void) {
+    SeqWindow w;
+    CHECK(seq_window_init(&w, 64, 2 * RACE_IDS, 0) == 0);
+    RaceLine lines[2] = {{&w, 0}, {&w, 0}};
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&threads[i], NULL, race_line, &lines[i]);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    CHECK(lines[0].accepted + lines[1].accepted == RACE_IDS);
+    seq_window_destroy(&w);
+}
+
+int main(void) {
+    test_mark();
+    test_first_use();
+    test_floor();
+    test_wraparound();
+    test_history();
+    test_ab_lines();
+    test_ab_lines_history();
+    if (failures) {
+        fprintf(stderr, "seq_window_test: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("seq_window_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,175 @@
+#ifndef APP_CONFIG_H
+#define APP_CONFIG_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include "async_log.h"
+#include "backpressure.h"
+#include "batch_filter.h"
+#include "bloom_filter.h"
+#include "load_balancer.h"
+#include "message_log.h"
+#include "seq_window.h"
+#include "metrics_server.h"
+#include "socket_tuning.h"
+#include "tcp_sender.h"
+#include "uring.h"
+
+#define MAX_UDP_PORTS 16
+
+/* Default values used when the matching MT_* environment variable is not set */
+#define DEFAULT_UDP_PORTS "5000,5001"
+#define DEFAULT_RUN_SEC 10
+#define DEFAULT_RECV_BATCH_SIZE 32
+#define DEFAULT_STORE_SHARDS 16
+#define DEFAULT_LOG_DUP_RATE 1000
+#define DEFAULT_QUEUE_CAPACITY 65536
+#define DEFAULT_TCP_HOST "127.0.0.1"
+#define DEFAULT_TCP_PORT 6000
+#define DEFAULT_FLUSH_BYTES 65536
+#define DEFAULT_TX_BUFFER_BYTES (1 << 20)
+#define DEFAULT_SPILL_MAX_MB 1024
+#define DEFAULT_BACKOFF_MIN_MS 10
+#define DEFAULT_BACKOFF_MAX_MS 1000
+#define DEFAULT_METRICS_INTERVAL_MS 1000
+#define DEFAULT_MSGLOG_SEGMENT_MB 64
+#define DEFAULT_MSGLOG_SYNC_MS 1000
+
+/* Runtime configuration for the main application */
+typedef struct {
+    int udp_ports[MAX_UDP_PORTS];  // UDP ports to receive on (MT_UDP_PORTS, comma separated)
+    size_t num_udp_ports;          // Number of entries in udp_ports
+    size_t receivers_per_port;     // SO_REUSEPORT receiver threads per port (MT_RECEIVERS_PER_PORT)
+    int reuseport_cpu_steering;    // Steer datagrams by CPU and pin receivers (MT_REUSEPORT_CPU_STEERING)
+    size_t recv_batch_size;  // Max datagrams pulled per recvmmsg call (MT_RECV_BATCH)
+    IoBackend io_backend;    // Socket I/O: epoll, uring or auto; resolved to epoll or uring at startup (MT_IO_BACKEND)
+    BatchSimdLevel simd_level; // Widest batch kernels allowed (MT_SIMD: auto, avx2, sse4.2, scalar)
+    size_t store_shards;     // Number of independently locked store shards (MT_STORE_SHARDS)
+    DedupMode dedup_mode;      // Hash store only, or a sequence window in front of it (MT_DEDUP_MODE)
+    size_t seq_window_ids;     // IDs covered by the sequence window (MT_SEQ_WINDOW)
+    size_t seq_history_ids;    // IDs of blocks kept after they left the window, 0 = none (MT_SEQ_HISTORY)
+    size_t dedup_window_count; // Keep about the last N IDs for dedup, 0 = unbounded (MT_DEDUP_WINDOW_COUNT)
+    int64_t dedup_window_ns;   // Keep IDs for this long, 0 = forever (MT_DEDUP_WINDOW_SEC)
+    size_t filter_expected_ids;  // Size a Bloom pre-filter per shard for this many IDs, 0 = none (MT_STORE_FILTER_IDS)
+    size_t filter_bits_per_key;  // Pre-filter bits per ID (MT_STORE_FILTER_BITS)
+    size_t queue_capacity;   // Slots in the receiver-to-transmitter ring (MT_QUEUE_CAPACITY)
+    BackpressureOptions backpressure;  // Overflow handling of the rings (MT_OVERFLOW_POLICY, MT_QUEUE_HIGH,
+                                       // MT_QUEUE_LOW, MT_TX_BUFFER_BYTES, MT_SPILL_DIR, MT_SPILL_MAX_MB)
+    LogLevel log_level;            // Minimum level written by the async logger (MT_LOG_LEVEL)
+    uint32_t log_dup_rate;         // Max "skipped duplicate" lines per second per socket, 0 = unlimited (MT_LOG_DUP_RATE)
+    size_t run_sec;          // Seconds to run before shutting down (MT_RUN_SEC)
+    const char* rules_file;  // Routing rules file, NULL = forward MessageData == 10 to MT_TCP_HOST (MT_RULES_FILE)
+    MessageLogOptions msglog;     // Durable log of accepted messages (MT_MSGLOG_DIR, MT_MSGLOG_SEGMENT_MB,
+                                  // MT_MSGLOG_MAX_SEGMENTS, MT_MSGLOG_SYNC, MT_MSGLOG_SYNC_MS, MT_MSGLOG_QUEUE,
+                                  // MT_MSGLOG_RECOVERY_THREADS)
+    const char* control_socket;   // Unix socket path for store queries, NULL = no query endpoint (MT_CONTROL_SOCKET)
+    MetricsServerOptions metrics; // Stats export (MT_METRICS_PORT, MT_METRICS_FILE, MT_METRICS_INTERVAL_MS)
+    SocketTuning sockets;    // Options applied to every socket (MT_SO_RCVBUF, MT_SO_SNDBUF, MT_BUSY_POLL_US,
+                             // MT_RXQ_OVFL, MT_IP_TOS, MT_SO_PRIORITY, MT_TCP_NODELAY, MT_TCP_CORK)
+    const char* tcp_endpoints; // "host:port,..." of the built-in output, NULL = MT_TCP_HOST:MT_TCP_PORT (MT_TCP_ENDPOINTS)
+    BalanceMode balance;       // How the built-in output spreads messages over its endpoints (MT_BALANCE)
+    TcpSenderOptions tcp;    // Downstream connection (MT_TCP_HOST, MT_TCP_PORT, MT_FLUSH_US,
+                             // MT_FLUSH_BYTES, MT_BACKOFF_MIN_MS, MT_BACKOFF_MAX_MS); tuning = sockets
+} AppConfig;
+
+/* Read an unsigned value from the environment, falling back to a default */
+size_t config_env_size(const char* name, size_t def) {
+    const char* value = getenv(name);
+    if (!value || !*value) {
+        return def;
+    }
+    char* end = NULL;
+    unsigned long long parsed = strtoull(value, &end, 10);
+    if (*end != '\0') {
+        return def;  // Ignore malformed values
+    }
+    return (size_t)parsed;
+}
+
+/* Read a string from the environment, falling back to a default */
+const char* config_env_string(const char* name, const char* def) {
+    const char* value = getenv(name);
+    return (value && *value) ? value : def;
+}
+
+/* Parse a comma separated port list from the environment into ports.
+ * Returns the number of ports parsed. */
+size_t config_env_ports(const char* name, const char* def, int* ports, size_t max) {
+    const char* value = config_env_string(name, def);
+    size_t count = 0;
+    while (*value && count < max) {
+        char* end = NULL;
+        long port = strtol(value, &end, 10);
+        if (end == value) break;
+        if (port > 0 && port < 65536) {
+            ports[count++] = (int)port;
+        }
+        value = (*end == ',') ? end + 1 : end;
+    }
+    return count;
+}
+
+/* Fill the configuration from defaults and environment overrides */
+void config_load(AppConfig* cfg) {
+    cfg->num_udp_ports = config_env_ports("MT_UDP_PORTS", DEFAULT_UDP_PORTS, cfg->udp_ports, MAX_UDP_PORTS);
+    cfg->receivers_per_port = config_env_size("MT_RECEIVERS_PER_PORT", 1);
+    if (cfg->receivers_per_port == 0) {
+        cfg->receivers_per_port = 1;
+    }
+    cfg->reuseport_cpu_steering = (int)config_env_size("MT_REUSEPORT_CPU_STEERING", 0);
+    cfg->recv_batch_size = config_env_size("MT_RECV_BATCH", DEFAULT_RECV_BATCH_SIZE);
+    if (cfg->recv_batch_size == 0) {
+        cfg->recv_batch_size = 1;
+    }
+    cfg->io_backend = io_backend_parse(getenv("MT_IO_BACKEND"), IO_BACKEND_EPOLL);
+    cfg->simd_level = batch_simd_parse(getenv("MT_SIMD"), BATCH_SIMD_AVX2);
+    cfg->store_shards = config_env_size("MT_STORE_SHARDS", DEFAULT_STORE_SHARDS);
+    if (cfg->store_shards == 0) {
+        cfg->store_shards = 1;
+    }
+    cfg->dedup_mode = dedup_mode_parse(getenv("MT_DEDUP_MODE"), DEDUP_MODE_STORE);
+    cfg->seq_window_ids = config_env_size("MT_SEQ_WINDOW", SEQ_WINDOW_DEFAULT_IDS);
+    cfg->seq_history_ids = config_env_size("MT_SEQ_HISTORY", SEQ_WINDOW_DEFAULT_HISTORY);
+    cfg->dedup_window_count = config_env_size("MT_DEDUP_WINDOW_COUNT", 0);
+    cfg->dedup_window_ns = (int64_t)config_env_size("MT_DEDUP_WINDOW_SEC", 0) * NSEC_PER_SEC;
+    cfg->filter_expected_ids = config_env_size("MT_STORE_FILTER_IDS", 0);
+    cfg->filter_bits_per_key = config_env_size("MT_STORE_FILTER_BITS", BLOOM_DEFAULT_BITS_PER_KEY);
+    cfg->queue_capacity = config_env_size("MT_QUEUE_CAPACITY", DEFAULT_QUEUE_CAPACITY);
+    cfg->backpressure.policy = overflow_policy_parse(getenv("MT_OVERFLOW_POLICY"), OVERFLOW_BLOCK);
+    cfg->backpressure.high_watermark = config_env_size("MT_QUEUE_HIGH", 0);
+    cfg->backpressure.low_watermark = config_env_size("MT_QUEUE_LOW", 0);
+    cfg->backpressure.tx_buffer_bytes = config_env_size("MT_TX_BUFFER_BYTES", DEFAULT_TX_BUFFER_BYTES);
+    cfg->backpressure.spill_dir = config_env_string("MT_SPILL_DIR", NULL);
+    cfg->backpressure.spill_max_bytes = config_env_size("MT_SPILL_MAX_MB", DEFAULT_SPILL_MAX_MB) << 20;
+    cfg->log_level = log_level_parse(getenv("MT_LOG_LEVEL"), LOG_LEVEL_INFO);
+    cfg->log_dup_rate = (uint32_t)config_env_size("MT_LOG_DUP_RATE", DEFAULT_LOG_DUP_RATE);
+    cfg->run_sec = config_env_size("MT_RUN_SEC", DEFAULT_RUN_SEC);
+    cfg->rules_file = config_env_string("MT_RULES_FILE", NULL);
+    cfg->msglog.dir = config_env_string("MT_MSGLOG_DIR", NULL);
+    cfg->msglog.segment_bytes = config_env_size("MT_MSGLOG_SEGMENT_MB", DEFAULT_MSGLOG_SEGMENT_MB) << 20;
+    cfg->msglog.max_segments = config_env_size("MT_MSGLOG_MAX_SEGMENTS", 0);
+    cfg->msglog.sync = message_log_sync_parse(getenv("MT_MSGLOG_SYNC"), MSGLOG_SYNC_INTERVAL);
+    cfg->msglog.sync_interval_ns = (int64_t)config_env_size("MT_MSGLOG_SYNC_MS", DEFAULT_MSGLOG_SYNC_MS) * NSEC_PER_MSEC;
+    cfg->msglog.queue_capacity = config_env_size("MT_MSGLOG_QUEUE", DEFAULT_QUEUE_CAPACITY);
+    cfg->msglog.recovery_threads = config_env_size("MT_MSGLOG_RECOVERY_THREADS", 0);
+    cfg->control_socket = config_env_string("MT_CONTROL_SOCKET", NULL);
+    cfg->metrics.port = (int)config_env_size("MT_METRICS_PORT", 0);
+    cfg->metrics.path = config_env_string("MT_METRICS_FILE", NULL);
+    cfg->metrics.interval_ms = (int64_t)config_env_size("MT_METRICS_INTERVAL_MS", DEFAULT_METRICS_INTERVAL_MS);
+
+    cfg->tcp_endpoints = config_env_string("MT_TCP_ENDPOINTS", NULL);
+    cfg->balance = balance_mode_parse(getenv("MT_BALANCE"), BALANCE_HASH);
+    cfg->tcp.host = config_env_string("MT_TCP_HOST", DEFAULT_TCP_HOST);
+    cfg->tcp.port = (uint16_t)config_env_size("MT_TCP_PORT", DEFAULT_TCP_PORT);
+    socket_tuning_load(&cfg->sockets);
+    cfg->tcp.tuning = cfg->sockets;
+    cfg->tcp.flush_deadline_ns = (int64_t)config_env_size("MT_FLUSH_US", 0) * NSEC_PER_USEC;
+    cfg->tcp.flush_bytes = config_env_size("MT_FLUSH_BYTES", DEFAULT_FLUSH_BYTES);
+    cfg->tcp.backoff_min_ns = (int64_t)config_env_size("MT_BACKOFF_MIN_MS", DEFAULT_BACKOFF_MIN_MS) * NSEC_PER_MSEC;
+    cfg->tcp.backoff_max_ns = (int64_t)config_env_size("MT_BACKOFF_MAX_MS", DEFAULT_BACKOFF_MAX_MS) * NSEC_PER_MSEC;
+    if (cfg->tcp.backoff_max_ns < cfg->tcp.backoff_min_ns) {
+        cfg->tcp.backoff_max_ns = cfg->tcp.backoff_min_ns;
+    }
+}
+
+#endif // APP_CONFIG_H
@@ -0,0 +1,285 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "time_utils.h"
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#define ASYNC_LOG_TAG_SIZE 16        // Bytes of the per-record tag (e.g. receiver name)
+#define ASYNC_LOG_RING_SIZE 8192     // Records buffered per thread (power of two)
+#define ASYNC_LOG_MAX_THREADS 128    // Threads that can own a log buffer
+#define ASYNC_LOG_FLUSH_US 2000      // Flusher sleep between drains
+
+/* Log severity, in increasing order */
+typedef enum {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF
+} LogLevel;
+
+/* Binary log record. The format string must have static storage duration;
+ * it is only expanded by the flusher thread. */
+typedef struct {
+    int64_t ts_ns;                  // Monotonic time of the log call, used to merge threads
+    const char* fmt;                // printf-style format taking up to 3 unsigned long arguments
+    uint64_t args[3];               // Raw arguments
+    int err;                        // errno to append as ": <strerror>", 0 for none
+    uint8_t level;                  // LogLevel
+    char tag[ASYNC_LOG_TAG_SIZE];   // Prefix copied from the caller
+} LogRecord;
+
+/* Single-producer/single-consumer ring owned by one logging thread */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t tail;  // Written by the owning thread
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t head;  // Written by the flusher
+    _Atomic uint64_t dropped;                       // Records lost because the ring was full
+    LogRecord records[ASYNC_LOG_RING_SIZE];
+} LogBuffer;
+
+/* Process-wide logger state */
+typedef struct {
+    _Atomic(LogBuffer*) buffers[ASYNC_LOG_MAX_THREADS];  // Registered per-thread buffers
+    _Atomic size_t num_buffers;                 // Number of registered buffers
+    _Atomic uint64_t unregistered_drops;        // Records from threads beyond ASYNC_LOG_MAX_THREADS
+    _Atomic int level;                          // Minimum level that is recorded
+    _Atomic int running;                        // Flusher keeps draining while set
+    pthread_t flusher;                          // Background formatting/writing thread
+} AsyncLogger;
+
+AsyncLogger asyncLogger = { .level = LOG_LEVEL_INFO };
+static __thread LogBuffer* tlsLogBuffer = NULL;
+
+/* Per-call-site limiter: at most max_per_sec records per one-second window */
+typedef struct {
+    int64_t window_start_ns;  // Start of the current window
+    uint32_t count;           // Records allowed in the current window
+    uint64_t suppressed;      // Records rejected since the last report
+} LogRateLimit;
+
+/* Parse a level name (debug, info, warn, error, off); unknown names give def */
+LogLevel log_level_parse(const char* name, LogLevel def) {
+    if (!name) return def;
+    if (strcasecmp(name, "debug") == 0) return LOG_LEVEL_DEBUG;
+    if (strcasecmp(name, "info") == 0) return LOG_LEVEL_INFO;
+    if (strcasecmp(name, "warn") == 0) return LOG_LEVEL_WARN;
+    if (strcasecmp(name, "error") == 0) return LOG_LEVEL_ERROR;
+    if (strcasecmp(name, "off") == 0) return LOG_LEVEL_OFF;
+    return def;
+}
+
+/* Check whether a level is currently recorded */
+static inline int alog_enabled(LogLevel level) {
+    return (int)level >= atomic_load_explicit(&asyncLogger.level, memory_order_relaxed);
+}
+
+/* Get (or lazily register) the calling thread's buffer */
+static LogBuffer* alog_thread_buffer(void) {
+    if (tlsLogBuffer) return tlsLogBuffer;
+    size_t slot = atomic_fetch_add(&asyncLogger.num_buffers, 1);
+    if (slot >= ASYNC_LOG_MAX_THREADS) {
+        atomic_fetch_sub(&asyncLogger.num_buffers, 1);
+        return NULL;
+    }
+    LogBuffer* buffer = (LogBuffer*)aligned_alloc(CACHE_LINE_SIZE, sizeof(LogBuffer));
+    atomic_init(&buffer->tail, 0);
+    atomic_init(&buffer->head, 0);
+    atomic_init(&buffer->dropped, 0);
+    atomic_store_explicit(&asyncLogger.buffers[slot], buffer, memory_order_release);
+    tlsLogBuffer = buffer;
+    return buffer;
+}
+
+/* Record a log entry without formatting or I/O. Never blocks: drops if the buffer is full */
+void alog_write(LogLevel level, const char* tag, int err, const char* fmt, uint64_t a0, uint64_t a1, uint64_t a2) {
+    if (!alog_enabled(level)) return;
+    LogBuffer* buffer = alog_thread_buffer();
+    if (!buffer) {
+        atomic_fetch_add_explicit(&asyncLogger.unregistered_drops, 1, memory_order_relaxed);
+        return;
+    }
+    size_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&buffer->head, memory_order_acquire) >= ASYNC_LOG_RING_SIZE) {
+        atomic_fetch_add_explicit(&buffer->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    LogRecord* rec = &buffer->records[tail & (ASYNC_LOG_RING_SIZE - 1)];
+    rec->ts_ns = monotonic_ns();
+    rec->fmt = fmt;
+    rec->args[0] = a0;
+    rec->args[1] = a1;
+    rec->args[2] = a2;
+    rec->err = err;
+    rec->level = (uint8_t)level;
+    if (tag) {
+        strncpy(rec->tag, tag, ASYNC_LOG_TAG_SIZE - 1);
+        rec->tag[ASYNC_LOG_TAG_SIZE - 1] = '\0';
+    } else {
+        rec->tag[0] = '\0';
+    }
+    atomic_store_explicit(&buffer->tail, tail + 1, memory_order_release);
+}
+
+/* Convenience wrappers */
+void alog_info(const char* tag, const char* fmt, uint64_t a0, uint64_t a1, uint64_t a2) {
+    alog_write(LOG_LEVEL_INFO, tag, 0, fmt, a0, a1, a2);
+}
+
+void alog_errno(const char* tag, const char* fmt, uint64_t a0) {
+    alog_write(LOG_LEVEL_ERROR, tag, errno, fmt, a0, 0, 0);
+}
+
+/* Returns 1 if another record may be logged in the current one-second window.
+ * When a new window opens after suppression, a summary line is logged once. */
+int alog_rate_allow(LogRateLimit* limit, uint32_t max_per_sec, const char* tag) {
+    if (max_per_sec == 0) return 1;  // Unlimited
+    int64_t now = monotonic_ns();
+    if (now - limit->window_start_ns >= NSEC_PER_SEC) {
+        if (limit->suppressed > 0) {
+            alog_write(LOG_LEVEL_INFO, tag, 0, "suppressed %lu similar lines", limit->suppressed, 0, 0);
+            limit->suppressed = 0;
+        }
+        limit->window_start_ns = now;
+        limit->count = 0;
+    }
+    if (limit->count < max_per_sec) {
+        limit->count++;
+        return 1;
+    }
+    limit->suppressed++;
+    return 0;
+}
+
+/* Append formatted text to line, keeping room for the trailing newline */
+static void alog_append(char* line, size_t size, size_t* len, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int written = vsnprintf(line + *len, size - 1 - *len, fmt, ap);
+    va_end(ap);
+    if (written > 0) {
+        *len += (size_t)written;
+        if (*len > size - 2) *len = size - 2;
+    }
+}
+
+/* Format one record into line; returns its length */
+static size_t alog_format(const LogRecord* rec, char* line, size_t size) {
+    size_t len = 0;
+    line[0] = '\0';
+    if (rec->tag[0]) {
+        alog_append(line, size, &len, "%s ", rec->tag);
+    }
+    if (rec->level == LOG_LEVEL_ERROR) {
+        alog_append(line, size, &len, "[ERROR] ");
+    }
+    alog_append(line, size, &len, rec->fmt,
+                (unsigned long)rec->args[0], (unsigned long)rec->args[1], (unsigned long)rec->args[2]);
+    if (rec->err) {
+        char errbuf[128];
+        const char* msg = strerror_r(rec->err, errbuf, sizeof(errbuf));
+        alog_append(line, size, &len, ": %s", msg);
+    }
+    line[len++] = '\n';
+    line[len] = '\0';
+    return len;
+}
+
+/* Compare records by timestamp for merging */
+static int alog_record_cmp(const void* a, const void* b) {
+    int64_t ta = ((const LogRecord*)a)->ts_ns;
+    int64_t tb = ((const LogRecord*)b)->ts_ns;
+    return (ta > tb) - (ta < tb);
+}
+
+/* Drain every buffer, merge by time and write the formatted lines. Flusher thread only */
+void alog_drain(LogRecord* scratch, size_t scratch_size) {
+    size_t count = 0;
+    size_t buffers = atomic_load(&asyncLogger.num_buffers);
+    for (size_t i = 0; i < buffers && count < scratch_size; i++) {
+        LogBuffer* buffer = atomic_load_explicit(&asyncLogger.buffers[i], memory_order_acquire);
+        if (!buffer) continue;  // Slot claimed but not yet published
+        size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+        while (head != tail && count < scratch_size) {
+            scratch[count++] = buffer->records[head & (ASYNC_LOG_RING_SIZE - 1)];
+            head++;
+        }
+        atomic_store_explicit(&buffer->head, head, memory_order_release);
+    }
+    if (count == 0) return;
+    qsort(scratch, count, sizeof(LogRecord), alog_record_cmp);
+
+    char line[512];
+    for (size_t i = 0; i < count; i++) {
+        size_t len = alog_format(&scratch[i], line, sizeof(line));
+        fwrite(line, 1, len, scratch[i].level == LOG_LEVEL_ERROR ? stderr : stdout);
+    }
+    fflush(stdout);
+    fflush(stderr);
+}
+
+/* Background thread: formats and writes records off the hot path */
+void* alog_flusher(void* arg) {
+    (void)arg;
+    size_t scratch_size = ASYNC_LOG_RING_SIZE * 4;
+    LogRecord* scratch = (LogRecord*)malloc(scratch_size * sizeof(LogRecord));
+    while (atomic_load(&asyncLogger.running)) {
+        alog_drain(scratch, scratch_size);
+        usleep(ASYNC_LOG_FLUSH_US);
+    }
+    // Final drain until every buffer is empty
+    size_t buffers = atomic_load(&asyncLogger.num_buffers);
+    for (int pending = 1; pending;) {
+        alog_drain(scratch, scratch_size);
+        pending = 0;
+        for (size_t i = 0; i < buffers; i++) {
+            LogBuffer* buffer = atomic_load(&asyncLogger.buffers[i]);
+            if (buffer && atomic_load(&buffer->head) != atomic_load(&buffer->tail)) pending = 1;
+        }
+    }
+    free(scratch);
+    return NULL;
+}
+
+/* Start the flusher thread with a minimum level */
+void alog_start(LogLevel level) {
+    atomic_store(&asyncLogger.level, (int)level);
+    atomic_store(&asyncLogger.running, 1);
+    pthread_create(&asyncLogger.flusher, NULL, alog_flusher, NULL);
+}
+
+/* Stop the flusher after writing everything recorded so far, then report drops.
+ * Call once all logging threads have finished. */
+void alog_stop(void) {
+    atomic_store(&asyncLogger.running, 0);
+    pthread_join(asyncLogger.flusher, NULL);
+
+    uint64_t dropped = atomic_load(&asyncLogger.unregistered_drops);
+    size_t buffers = atomic_load(&asyncLogger.num_buffers);
+    for (size_t i = 0; i < buffers; i++) {
+        LogBuffer* buffer = atomic_exchange(&asyncLogger.buffers[i], NULL);
+        if (!buffer) continue;
+        dropped += atomic_load(&buffer->dropped);
+        free(buffer);
+    }
+    atomic_store(&asyncLogger.num_buffers, 0);
+    tlsLogBuffer = NULL;
+    if (dropped > 0) {
+        fprintf(stderr, "[WARN] async log dropped %lu records\n", (unsigned long)dropped);
+    }
+}
+
+#endif // ASYNC_LOG_H
@@ -0,0 +1,212 @@
+#ifndef BACKPRESSURE_H
+#define BACKPRESSURE_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "async_log.h"
+#include "message.h"
+
+/* Overflow handling for the bounded queues in front of a slow or absent downstream.
+ *
+ * A queue is "throttled" from the moment its depth reaches the high watermark until
+ * it has drained to the low watermark. While throttled, the policy decides what
+ * happens to the backlog:
+ *   block        producers park on the throttled flag (the receivers stop reading, so
+ *                the kernel drops) until the consumer clears it and wakes them
+ *   drop-newest  producers discard the messages they are trying to add
+ *   drop-oldest  the consumer discards queued messages down to the low watermark
+ *   spill        the consumer moves queued messages down to the low watermark into
+ *                a local file and replays it, oldest first, once it can send again
+ * A queue that is completely full makes producers wait under block, and drops the
+ * newest message under drop-newest. Under drop-oldest and spill a producer gives the
+ * consumer up to BACKPRESSURE_SHED_WAIT_NS per batch to shed the backlog; what still
+ * finds the queue full after that is the newest message and is dropped as such, so
+ * memory stays bounded and producers are held up at most once per batch even when the
+ * consumer is stuck. */
+
+#define SPILL_RECORD_SIZE sizeof(SpillRecord)
+#define BACKPRESSURE_SHED_WAIT_NS 20000000LL  // Many times the longest sleep of a shedding consumer (1ms)
+#define BACKPRESSURE_PARK_NS 100000000LL      // Longest single park of a blocked producer
+
+typedef enum {
+    OVERFLOW_BLOCK,
+    OVERFLOW_DROP_NEWEST,
+    OVERFLOW_DROP_OLDEST,
+    OVERFLOW_SPILL
+} OverflowPolicy;
+
+OverflowPolicy overflow_policy_parse(const char* name, OverflowPolicy def) {
+    if (!name) return def;
+    if (strcasecmp(name, "block") == 0) return OVERFLOW_BLOCK;
+    if (strcasecmp(name, "drop-newest") == 0 || strcasecmp(name, "drop_newest") == 0) return OVERFLOW_DROP_NEWEST;
+    if (strcasecmp(name, "drop-oldest") == 0 || strcasecmp(name, "drop_oldest") == 0) return OVERFLOW_DROP_OLDEST;
+    if (strcasecmp(name, "spill") == 0) return OVERFLOW_SPILL;
+    return def;
+}
+
+const char* overflow_policy_name(OverflowPolicy policy) {
+    switch (policy) {
+        case OVERFLOW_DROP_NEWEST: return "drop-newest";
+        case OVERFLOW_DROP_OLDEST: return "drop-oldest";
+        case OVERFLOW_SPILL: return "spill";
+        default: return "block";
+    }
+}
+
+typedef struct {
+    OverflowPolicy policy;    // What to do with the backlog while throttled (MT_OVERFLOW_POLICY)
+    size_t high_watermark;    // Queue depth that starts throttling, 0 = 90% of capacity (MT_QUEUE_HIGH)
+    size_t low_watermark;     // Depth that ends it, 0 = 50% of capacity (MT_QUEUE_LOW)
+    size_t tx_buffer_bytes;   // Max bytes a transmitter buffers beyond its queue (MT_TX_BUFFER_BYTES)
+    const char* spill_dir;    // Directory of the spill files (MT_SPILL_DIR)
+    size_t spill_max_bytes;   // Size limit of one spill file (MT_SPILL_MAX_MB)
+} BackpressureOptions;
+
+/* Resolve 0 = default watermarks for a queue of capacity slots and keep low < high <= capacity */
+void backpressure_watermarks(const BackpressureOptions* opts, size_t capacity, size_t* high, size_t* low) {
+    *high = opts->high_watermark ? opts->high_watermark : capacity - capacity / 10;
+    if (*high > capacity) *high = capacity;
+    if (*high == 0) *high = 1;
+    *low = opts->low_watermark ? opts->low_watermark : capacity / 2;
+    if (*low >= *high) *low = *high - 1;
+}
+
+/* Hysteresis between the watermarks. Returns the new throttled state */
+static inline int backpressure_throttled(int throttled, size_t depth, size_t high, size_t low) {
+    if (depth >= high) return 1;
+    if (depth <= low) return 0;
+    return throttled;
+}
+
+/* Park the calling producer while *throttled is set, for at most BACKPRESSURE_PARK_NS so it
+ * can recheck its own shutdown flag. The consumer wakes it with backpressure_release */
+static inline void backpressure_park(_Atomic int* throttled) {
+    struct timespec ts = {0, BACKPRESSURE_PARK_NS};
+    syscall(SYS_futex, throttled, FUTEX_WAIT_PRIVATE, 1, &ts, NULL, 0);
+}
+
+/* Clear the throttled flag and wake every producer parked on it */
+static inline void backpressure_release(_Atomic int* throttled) {
+    atomic_store(throttled, 0);
+    syscall(SYS_futex, throttled, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* One spilled message */
+typedef struct {
+    Message msg;
+    int64_t stamp;  // Original enqueue time, kept for the queue-to-send histogram
+} SpillRecord;
+
+/* Append-only file of spilled messages, read back from the front. Once it has been
+ * replayed completely it is truncated, so the disk space is given back */
+typedef struct {
+    int fd;               // Open spill file, -1 if spilling is unavailable
+    char path[512];
+    uint64_t read_off;    // Offset of the oldest record not yet replayed
+    uint64_t write_off;   // End of the file
+    uint64_t max_bytes;   // Records beyond this are refused
+    const char* name;     // Log tag: the output the file belongs to
+    LogRateLimit error_log;  // Rate limit of the I/O failure lines
+} SpillFile;
+
+/* Log a failure with the current errno through the async logger, at most once per
+ * second: a failing disk would otherwise log on every pass of the transmitter */
+static void spill_log_error(SpillFile* spill, const char* what) {
+    int err = errno;
+    if (alog_rate_allow(&spill->error_log, 1, spill->name)) {
+        alog_write(LOG_LEVEL_ERROR, spill->name, err, what, 0, 0, 0);
+    }
+}
+
+/* Create (or truncate) dir/spill-<name>.bin. Returns 0 on success */
+int spill_open(SpillFile* spill, const char* dir, const char* name, size_t max_bytes) {
+    memset(spill, 0, sizeof(*spill));
+    spill->fd = -1;
+    spill->max_bytes = max_bytes;
+    spill->name = name;
+    if (!dir) return -1;
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        spill_log_error(spill, "Spill directory create failed");
+        return -1;
+    }
+    snprintf(spill->path, sizeof(spill->path), "%s/spill-%s.bin", dir, name);
+    spill->fd = open(spill->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (spill->fd < 0) {
+        spill_log_error(spill, "Spill file open failed");
+        return -1;
+    }
+    return 0;
+}
+
+/* Close and remove the spill file */
+void spill_close(SpillFile* spill) {
+    if (spill->fd < 0) return;
+    close(spill->fd);
+    unlink(spill->path);
+    spill->fd = -1;
+}
+
+/* Records waiting to be replayed */
+size_t spill_pending(const SpillFile* spill) {
+    return (size_t)((spill->write_off - spill->read_off) / SPILL_RECORD_SIZE);
+}
+
+/* Append up to count records. Returns the number written; fewer once the file is full */
+size_t spill_write(SpillFile* spill, const SpillRecord* records, size_t count) {
+    if (spill->fd < 0) return 0;
+    uint64_t room = spill->max_bytes > spill->write_off ? (spill->max_bytes - spill->write_off) / SPILL_RECORD_SIZE : 0;
+    if (count > room) count = (size_t)room;
+    size_t bytes = count * SPILL_RECORD_SIZE;
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t n = pwrite(spill->fd, (const char*)records + done, bytes - done, (off_t)(spill->write_off + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            spill_log_error(spill, "Spill write failed");
+            break;
+        }
+        done += (size_t)n;
+    }
+    count = done / SPILL_RECORD_SIZE;  // A torn tail record is overwritten by the next append
+    spill->write_off += count * SPILL_RECORD_SIZE;
+    return count;
+}
+
+/* Read back up to max of the oldest records. Returns the number read */
+size_t spill_read(SpillFile* spill, SpillRecord* records, size_t max) {
+    size_t count = spill_pending(spill);
+    if (count > max) count = max;
+    if (count == 0) return 0;
+    ssize_t n;
+    do {
+        n = pread(spill->fd, records, count * SPILL_RECORD_SIZE, (off_t)spill->read_off);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        spill_log_error(spill, "Spill read failed");
+        return 0;
+    }
+    count = (size_t)n / SPILL_RECORD_SIZE;
+    spill->read_off += count * SPILL_RECORD_SIZE;
+    if (spill->read_off == spill->write_off) {
+        spill->read_off = 0;
+        spill->write_off = 0;
+        if (ftruncate(spill->fd, 0) < 0) {
+            spill_log_error(spill, "Spill truncate failed");
+        }
+    }
+    return count;
+}
+
+#endif // BACKPRESSURE_H
@@ -0,0 +1,212 @@
+#ifndef BATCH_FILTER_H
+#define BATCH_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <strings.h>
+#include "custom_hash_map.h"
+#include "message.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_FILTER_X86 1
+#endif
+
+/* Batch kernels for the receive path: a predicate filter that turns a decoded
+ * batch into a compacted list of indices whose MessageData equals a value, and
+ * a hasher that computes hash_function() of every MessageId ahead of the
+ * dedup probes. Each kernel has AVX2, SSE4.2 and scalar versions; the widest
+ * one the CPU supports is selected once at startup by batch_filter_init(). */
+
+typedef enum {
+    BATCH_SIMD_SCALAR = 0,
+    BATCH_SIMD_SSE42 = 1,
+    BATCH_SIMD_AVX2 = 2,
+} BatchSimdLevel;
+
+typedef size_t (*BatchFilterFn)(const Message* msgs, size_t count, uint64_t value, uint32_t* out);
+typedef void (*BatchHashFn)(const Message* msgs, size_t count, uint64_t* out);
+
+/* Selected kernels. Written once by batch_filter_init before receivers start */
+typedef struct {
+    BatchSimdLevel level;
+    BatchFilterFn filter;
+    BatchHashFn hash;
+} BatchKernels;
+
+_Static_assert(sizeof(Message) == 24, "batch kernels assume a 24-byte Message");
+
+/* Parse "auto", "avx2", "sse4.2" or "scalar" into the highest level allowed */
+BatchSimdLevel batch_simd_parse(const char* name, BatchSimdLevel def) {
+    if (!name) return def;
+    if (strcasecmp(name, "auto") == 0 || strcasecmp(name, "avx2") == 0) return BATCH_SIMD_AVX2;
+    if (strcasecmp(name, "sse4.2") == 0 || strcasecmp(name, "sse42") == 0) return BATCH_SIMD_SSE42;
+    if (strcasecmp(name, "scalar") == 0) return BATCH_SIMD_SCALAR;
+    return def;
+}
+
+const char* batch_simd_name(BatchSimdLevel level) {
+    switch (level) {
+        case BATCH_SIMD_AVX2: return "avx2";
+        case BATCH_SIMD_SSE42: return "sse4.2";
+        default: return "scalar";
+    }
+}
+
+/* Scalar kernels: branch-free compaction, the index is always written and kept only on a match */
+static size_t batch_filter_eq_scalar(const Message* msgs, size_t count, uint64_t value, uint32_t* out) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        out[n] = (uint32_t)i;
+        n += msgs[i].MessageData == value;
+    }
+    return n;
+}
+
+static void batch_hash_ids_scalar(const Message* msgs, size_t count, uint64_t* out) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = hash_function(msgs[i].MessageId);
+    }
+}
+
+#ifdef BATCH_FILTER_X86
+
+/* Positions of the set bits of a 4-bit match mask, used to compact indices without branches */
+_Alignas(16) static const uint32_t batch_filter_lut[16][4] = {
+    {0, 0, 0, 0}, {0, 0, 0, 0}, {1, 0, 0, 0}, {0, 1, 0, 0},
+    {2, 0, 0, 0}, {0, 2, 0, 0}, {1, 2, 0, 0}, {0, 1, 2, 0},
+    {3, 0, 0, 0}, {0, 3, 0, 0}, {1, 3, 0, 0}, {0, 1, 3, 0},
+    {2, 3, 0, 0}, {0, 2, 3, 0}, {1, 2, 3, 0}, {0, 1, 2, 3},
+};
+
+/* 64x64->64 multiply per lane from 32-bit multiplies (no native 64-bit mullo below AVX-512) */
+__attribute__((target("sse4.2")))
+static inline __m128i batch_mullo64_sse(__m128i a, __m128i b) {
+    __m128i lo = _mm_mul_epu32(a, b);
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b), _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+    return _mm_add_epi64(lo, _mm_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i batch_mullo64_avx2(__m256i a, __m256i b) {
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+/* Two messages per step */
+__attribute__((target("sse4.2")))
+static size_t batch_filter_eq_sse42(const Message* msgs, size_t count, uint64_t value, uint32_t* out) {
+    const __m128i target = _mm_set1_epi64x((long long)value);
+    size_t n = 0, i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128i data = _mm_set_epi64x((long long)msgs[i + 1].MessageData, (long long)msgs[i].MessageData);
+        unsigned mask = (unsigned)_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(data, target)));
+        __m128i idx = _mm_add_epi32(_mm_loadl_epi64((const __m128i*)batch_filter_lut[mask]),
+                                    _mm_set1_epi32((int)i));
+        _mm_storel_epi64((__m128i*)(out + n), idx);  // n <= i, so both lanes stay inside out
+        n += (size_t)__builtin_popcount(mask);
+    }
+    if (i < count) {
+        out[n] = (uint32_t)i;
+        n += msgs[i].MessageData == value;
+    }
+    return n;
+}
+
+__attribute__((target("sse4.2")))
+static void batch_hash_ids_sse42(const Message* msgs, size_t count, uint64_t* out) {
+    const __m128i c1 = _mm_set1_epi64x((long long)0xff51afd7ed558ccdULL);
+    const __m128i c2 = _mm_set1_epi64x((long long)0xc4ceb9fe1a85ec53ULL);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128i k = _mm_set_epi64x((long long)msgs[i + 1].MessageId, (long long)msgs[i].MessageId);
+        k = _mm_xor_si128(k, _mm_srli_epi64(k, 33));
+        k = batch_mullo64_sse(k, c1);
+        k = _mm_xor_si128(k, _mm_srli_epi64(k, 33));
+        k = batch_mullo64_sse(k, c2);
+        k = _mm_xor_si128(k, _mm_srli_epi64(k, 33));
+        _mm_storeu_si128((__m128i*)(out + i), k);
+    }
+    batch_hash_ids_scalar(msgs + i, count - i, out + i);
+}
+
+/* Four messages per step; the 24-byte stride is gathered as 64-bit lanes 0, 3, 6, 9 */
+__attribute__((target("avx2")))
+static size_t batch_filter_eq_avx2(const Message* msgs, size_t count, uint64_t value, uint32_t* out) {
+    const __m256i lanes = _mm256_setr_epi64x(0, 3, 6, 9);
+    const __m256i target = _mm256_set1_epi64x((long long)value);
+    size_t n = 0, i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i data = _mm256_i64gather_epi64((const long long*)&msgs[i].MessageData, lanes, 8);
+        unsigned mask = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(data, target)));
+        __m128i idx = _mm_add_epi32(_mm_load_si128((const __m128i*)batch_filter_lut[mask]),
+                                    _mm_set1_epi32((int)i));
+        _mm_storeu_si128((__m128i*)(out + n), idx);  // n <= i, so all four lanes stay inside out
+        n += (size_t)__builtin_popcount(mask);
+    }
+    for (; i < count; i++) {
+        out[n] = (uint32_t)i;
+        n += msgs[i].MessageData == value;
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+static void batch_hash_ids_avx2(const Message* msgs, size_t count, uint64_t* out) {
+    const __m256i lanes = _mm256_setr_epi64x(0, 3, 6, 9);
+    const __m256i c1 = _mm256_set1_epi64x((long long)0xff51afd7ed558ccdULL);
+    const __m256i c2 = _mm256_set1_epi64x((long long)0xc4ceb9fe1a85ec53ULL);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i k = _mm256_i64gather_epi64((const long long*)&msgs[i].MessageId, lanes, 8);
+        k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+        k = batch_mullo64_avx2(k, c1);
+        k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+        k = batch_mullo64_avx2(k, c2);
+        k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+        _mm256_storeu_si256((__m256i*)(out + i), k);
+    }
+    batch_hash_ids_scalar(msgs + i, count - i, out + i);
+}
+
+#endif // BATCH_FILTER_X86
+
+static BatchKernels batchKernels = {BATCH_SIMD_SCALAR, batch_filter_eq_scalar, batch_hash_ids_scalar};
+
+/* Select the widest kernels supported by the CPU, capped at max_level.
+ * Call once before any thread uses the kernels. Returns the selected level */
+BatchSimdLevel batch_filter_init(BatchSimdLevel max_level) {
+    batchKernels.level = BATCH_SIMD_SCALAR;
+    batchKernels.filter = batch_filter_eq_scalar;
+    batchKernels.hash = batch_hash_ids_scalar;
+#ifdef BATCH_FILTER_X86
+    __builtin_cpu_init();
+    if (max_level >= BATCH_SIMD_AVX2 && __builtin_cpu_supports("avx2")) {
+        batchKernels.level = BATCH_SIMD_AVX2;
+        batchKernels.filter = batch_filter_eq_avx2;
+        batchKernels.hash = batch_hash_ids_avx2;
+    } else if (max_level >= BATCH_SIMD_SSE42 && __builtin_cpu_supports("sse4.2")) {
+        batchKernels.level = BATCH_SIMD_SSE42;
+        batchKernels.filter = batch_filter_eq_sse42;
+        batchKernels.hash = batch_hash_ids_sse42;
+    }
+#else
+    (void)max_level;
+#endif
+    return batchKernels.level;
+}
+
+/* Write the indices of messages whose MessageData equals value to out (capacity count).
+ * Returns the number of indices written, in ascending order */
+static inline size_t batch_filter_eq(const Message* msgs, size_t count, uint64_t value, uint32_t* out) {
+    return batchKernels.filter(msgs, count, value, out);
+}
+
+/* Compute hash_function(MessageId) of every message into out */
+static inline void batch_hash_ids(const Message* msgs, size_t count, uint64_t* out) {
+    batchKernels.hash(msgs, count, out);
+}
+
+#endif // BATCH_FILTER_H
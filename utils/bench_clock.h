@@ -0,0 +1,84 @@
+#ifndef BENCH_CLOCK_H
+#define BENCH_CLOCK_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "log_error.h"
+
+/* Shared-memory send-time table used by the benchmark tools.
+ * bench_sender stores the (intended) send time of every new MessageId in
+ * slot (id & mask), and bench_sink looks it up when the forwarded message
+ * arrives, so end-to-end latency is measured without changing the wire
+ * format. Both tools must run on the same host (CLOCK_MONOTONIC is shared). */
+
+#define BENCH_CLOCK_PATH "/dev/shm/mt_bench_clock"
+#define BENCH_CLOCK_SLOTS (1u << 22)   // In-flight IDs that can be timed
+#define BENCH_CLOCK_MAGIC 0x4d54424e43484b31ULL
+
+typedef struct {
+    uint64_t magic;                        // BENCH_CLOCK_MAGIC once initialized
+    uint64_t slots;                        // Number of timestamp slots
+    _Atomic uint64_t sent_unique;          // New IDs sent in the current run
+    _Atomic uint64_t expected_forwarded;   // New IDs that match the forwarding rule
+    _Atomic int sender_done;               // Set when the sender finished
+    char pad[64 - 4 * sizeof(uint64_t) - sizeof(int)];  // Keep the table cache-line aligned
+} BenchClockHeader;
+
+typedef struct {
+    BenchClockHeader* header;       // Shared counters
+    _Atomic int64_t* send_ns;       // Send time per slot
+    size_t mask;                    // slots - 1
+    size_t map_size;                // Bytes mapped
+} BenchClock;
+
+/* Map the shared table, creating it if needed. reset clears the run counters.
+ * Returns 0 on success */
+int bench_clock_open(BenchClock* clock, const char* path, int reset) {
+    size_t size = sizeof(BenchClockHeader) + BENCH_CLOCK_SLOTS * sizeof(int64_t);
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        logError("bench clock open failed");
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)size) < 0) {
+        logError("bench clock resize failed");
+        close(fd);
+        return -1;
+    }
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        logError("bench clock mmap failed");
+        return -1;
+    }
+    clock->header = (BenchClockHeader*)base;
+    clock->send_ns = (_Atomic int64_t*)((char*)base + sizeof(BenchClockHeader));
+    clock->mask = BENCH_CLOCK_SLOTS - 1;
+    clock->map_size = size;
+    if (reset || clock->header->magic != BENCH_CLOCK_MAGIC) {
+        clock->header->slots = BENCH_CLOCK_SLOTS;
+        atomic_store(&clock->header->sent_unique, 0);
+        atomic_store(&clock->header->expected_forwarded, 0);
+        atomic_store(&clock->header->sender_done, 0);
+        clock->header->magic = BENCH_CLOCK_MAGIC;
+    }
+    return 0;
+}
+
+void bench_clock_close(BenchClock* clock) {
+    munmap(clock->header, clock->map_size);
+}
+
+static inline void bench_clock_stamp(BenchClock* clock, uint64_t id, int64_t ns) {
+    atomic_store_explicit(&clock->send_ns[id & clock->mask], ns, memory_order_relaxed);
+}
+
+static inline int64_t bench_clock_lookup(BenchClock* clock, uint64_t id) {
+    return atomic_load_explicit(&clock->send_ns[id & clock->mask], memory_order_relaxed);
+}
+
+#endif // BENCH_CLOCK_H
@@ -0,0 +1,88 @@
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Split-block Bloom filter over 64-bit hashes.
+ *
+ * The filter is an array of 32-byte blocks of eight 32-bit words. A key selects
+ * one block and sets one bit in each of its words, so a lookup touches a single
+ * half cache line whatever the number of hash functions. It answers "definitely
+ * absent" or "maybe present"; keys cannot be removed. At 12 bits per key the
+ * false-positive rate is below 0.5%. */
+
+#define BLOOM_BLOCK_WORDS 8                  // 32-bit words per block, one bit set in each
+#define BLOOM_BLOCK_BYTES (BLOOM_BLOCK_WORDS * 4)
+#define BLOOM_DEFAULT_BITS_PER_KEY 12
+
+typedef struct {
+    uint32_t* words;      // num_blocks * BLOOM_BLOCK_WORDS words, NULL while disabled
+    size_t num_blocks;    // Number of blocks, 0 = disabled
+} BloomFilter;
+
+/* Odd multipliers that derive the bit of each word from one 32-bit hash */
+static const uint32_t bloom_salts[BLOOM_BLOCK_WORDS] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+};
+
+/* Size the filter for expected_keys at bits_per_key. Returns 0 on success */
+int bloom_init(BloomFilter* filter, size_t expected_keys, size_t bits_per_key) {
+    if (bits_per_key == 0) bits_per_key = BLOOM_DEFAULT_BITS_PER_KEY;
+    size_t bits = expected_keys * bits_per_key;
+    size_t blocks = (bits + BLOOM_BLOCK_BYTES * 8 - 1) / (BLOOM_BLOCK_BYTES * 8);
+    if (blocks == 0) blocks = 1;
+    filter->words = (uint32_t*)aligned_alloc(BLOOM_BLOCK_BYTES, blocks * BLOOM_BLOCK_BYTES);
+    if (!filter->words) {
+        filter->num_blocks = 0;
+        return -1;
+    }
+    memset(filter->words, 0, blocks * BLOOM_BLOCK_BYTES);
+    filter->num_blocks = blocks;
+    return 0;
+}
+
+void bloom_destroy(BloomFilter* filter) {
+    free(filter->words);
+    filter->words = NULL;
+    filter->num_blocks = 0;
+}
+
+/* Memory used by the filter */
+size_t bloom_bytes(const BloomFilter* filter) {
+    return filter->num_blocks * BLOOM_BLOCK_BYTES;
+}
+
+/* Block of a hash. The hash is remixed first because callers already use its top
+ * bits to pick a shard and its low bits to pick a hash map slot */
+static inline uint32_t* bloom_block(const BloomFilter* filter, uint64_t hash, uint32_t* key) {
+    uint64_t mixed = hash * 0x9E3779B97F4A7C15ULL;
+    *key = (uint32_t)mixed;
+    size_t block = (size_t)(((mixed >> 32) * (uint64_t)filter->num_blocks) >> 32);  // Range reduction without a division
+    return filter->words + block * BLOOM_BLOCK_WORDS;
+}
+
+/* Record a key by its 64-bit hash */
+static inline void bloom_add(BloomFilter* filter, uint64_t hash) {
+    uint32_t key;
+    uint32_t* block = bloom_block(filter, hash, &key);
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++) {
+        block[i] |= 1u << ((key * bloom_salts[i]) >> 27);
+    }
+}
+
+/* 0 if the key was definitely never added, 1 if it may have been */
+static inline int bloom_maybe_contains(const BloomFilter* filter, uint64_t hash) {
+    uint32_t key;
+    const uint32_t* block = bloom_block(filter, hash, &key);
+    uint32_t missing = 0;
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++) {
+        missing |= ~block[i] & (1u << ((key * bloom_salts[i]) >> 27));
+    }
+    return missing == 0;
+}
+
+#endif // BLOOM_FILTER_H
@@ -0,0 +1,280 @@
+#ifndef CONTROL_SERVER_H
+#define CONTROL_SERVER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "event_loop.h"
+#include "log_error.h"
+#include "metrics.h"
+#include "sharded_store.h"
+
+/* Query thread on a local Unix stream socket. Clients send one command per line
+ * and may keep the connection open for many commands:
+ *   GET <id>                  FOUND id=.. type=.. size=.. data=..  or  NOTFOUND id=..
+ *   RANGE <lo> <hi> [limit]   RANGE matched=.. returned=.., one line per message
+ *                             (smallest IDs first, at most limit), then END
+ *   COUNTS                    COUNTS total=.., one "type=.. count=.." line per
+ *                             MessageType present, then END
+ * Anything else is answered with a line starting with ERR. Queries use the
+ * store's lock-free read functions, so they never hold up the receivers. */
+
+#define CONTROL_LINE_MAX 256              // Longest accepted command line
+#define CONTROL_RANGE_DEFAULT_LIMIT 1000  // Messages returned by RANGE without a limit
+#define CONTROL_RANGE_MAX_LIMIT 100000    // Upper bound on the RANGE limit
+#define CONTROL_SEND_TIMEOUT_MS 1000      // A client that stops reading this long is dropped
+
+typedef struct ControlServer ControlServer;
+
+/* One connected client and its partial command line */
+typedef struct ControlClient {
+    EventHandler handler;
+    ControlServer* server;
+    char line[CONTROL_LINE_MAX];
+    size_t len;
+    struct ControlClient* next;
+} ControlClient;
+
+struct ControlServer {
+    const char* path;          // Socket path (MT_CONTROL_SOCKET)
+    ShardedStore* store;       // Store being queried
+    RcuReader* reader;         // Read-side state of the server thread in store->rcu
+    EventLoop loop;            // Serves the listener, the clients and the shutdown fd
+    EventHandler listener;     // Listening socket
+    int shutdown_fd;
+    ControlClient* clients;    // Connected clients
+    MetricsBuffer reply;       // Response being built
+    uint64_t queries;          // Commands answered
+};
+
+/* Write all of buf to a non-blocking socket. Returns 0, or -1 if the client is gone or stuck */
+static int control_send_all(ControlServer* server, int sock, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(sock, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (event_wait_fd(sock, POLLOUT, server->shutdown_fd, CONTROL_SEND_TIMEOUT_MS) & POLLOUT) continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Parse a decimal or 0x-prefixed ID. Returns 0 on success */
+static int control_parse_u64(const char* text, uint64_t* out) {
+    if (!text) return -1;
+    char* end = NULL;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 0);
+    if (end == text || *end != '\0' || errno == ERANGE || *text == '-') return -1;
+    *out = (uint64_t)value;
+    return 0;
+}
+
+static void control_print_message(MetricsBuffer* out, const char* prefix, const Message* msg) {
+    metrics_printf(out, "%sid=%" PRIu64 " type=%u size=%u data=%" PRIu64 "\n", prefix, msg->MessageId,
+                   (unsigned)msg->MessageType, (unsigned)msg->MessageSize, msg->MessageData);
+}
+
+/* Answer one command line into server->reply */
+static void control_execute(ControlServer* server, char* line) {
+    MetricsBuffer* out = &server->reply;
+    char* save = NULL;
+    char* cmd = strtok_r(line, " \t", &save);
+    char* arg1 = strtok_r(NULL, " \t", &save);
+    char* arg2 = strtok_r(NULL, " \t", &save);
+    char* arg3 = strtok_r(NULL, " \t", &save);
+    if (!cmd) return;  // Blank line
+    server->queries++;
+
+    if (strcasecmp(cmd, "GET") == 0) {
+        uint64_t id;
+        Message msg;
+        if (control_parse_u64(arg1, &id) < 0 || arg2) {
+            metrics_printf(out, "ERR usage: GET <id>\n");
+        } else if (store_get(server->store, server->reader, id, &msg)) {
+            control_print_message(out, "FOUND ", &msg);
+        } else {
+            metrics_printf(out, "NOTFOUND id=%" PRIu64 "\n", id);
+        }
+    } else if (strcasecmp(cmd, "RANGE") == 0) {
+        uint64_t lo, hi;
+        uint64_t limit = CONTROL_RANGE_DEFAULT_LIMIT;
+        if (control_parse_u64(arg1, &lo) < 0 || control_parse_u64(arg2, &hi) < 0 ||
+            (arg3 && control_parse_u64(arg3, &limit) < 0) || strtok_r(NULL, " \t", &save)) {
+            metrics_printf(out, "ERR usage: RANGE <lo> <hi> [limit]\n");
+            return;
+        }
+        if (limit > CONTROL_RANGE_MAX_LIMIT) limit = CONTROL_RANGE_MAX_LIMIT;
+        Message* found = (Message*)malloc((limit ? limit : 1) * sizeof(Message));
+        size_t matched = 0;
+        size_t returned = found ? store_scan_range(server->store, server->reader, lo, hi, found, limit, &matched) : 0;
+        metrics_printf(out, "RANGE matched=%zu returned=%zu\n", matched, returned);
+        for (size_t i = 0; i < returned; i++) {
+            control_print_message(out, "", &found[i]);
+        }
+        metrics_printf(out, "END\n");
+        free(found);
+    } else if (strcasecmp(cmd, "COUNTS") == 0) {
+        uint64_t counts[STORE_NUM_TYPES];
+        uint64_t total = 0;
+        store_type_counts(server->store, counts);
+        for (size_t t = 0; t < STORE_NUM_TYPES; t++) {
+            total += counts[t];
+        }
+        metrics_printf(out, "COUNTS total=%" PRIu64 "\n", total);
+        for (size_t t = 0; t < STORE_NUM_TYPES; t++) {
+            if (counts[t]) metrics_printf(out, "type=%zu count=%" PRIu64 "\n", t, counts[t]);
+        }
+        metrics_printf(out, "END\n");
+    } else {
+        metrics_printf(out, "ERR unknown command, try GET, RANGE or COUNTS\n");
+    }
+}
+
+static void control_close_client(ControlServer* server, ControlClient* client) {
+    event_loop_del(&server->loop, &client->handler);
+    close(client->handler.fd);
+    for (ControlClient** link = &server->clients; *link; link = &(*link)->next) {
+        if (*link == client) {
+            *link = client->next;
+            break;
+        }
+    }
+    free(client);
+}
+
+/* Client readable: read until EAGAIN and answer every complete line */
+static void control_on_client(void* ctx, uint32_t events) {
+    ControlClient* client = (ControlClient*)ctx;
+    ControlServer* server = client->server;
+    (void)events;
+    for (;;) {
+        ssize_t n = recv(client->handler.fd, client->line + client->len, sizeof(client->line) - client->len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            control_close_client(server, client);
+            return;
+        }
+        client->len += (size_t)n;
+
+        server->reply.len = 0;
+        size_t start = 0;
+        char* newline;
+        while ((newline = memchr(client->line + start, '\n', client->len - start)) != NULL) {
+            *newline = '\0';
+            if (newline > client->line + start && newline[-1] == '\r') newline[-1] = '\0';
+            control_execute(server, client->line + start);
+            start = (size_t)(newline - client->line) + 1;
+        }
+        memmove(client->line, client->line + start, client->len - start);
+        client->len -= start;
+        if (client->len == sizeof(client->line)) {
+            metrics_printf(&server->reply, "ERR line too long\n");
+            client->len = 0;
+        }
+        if (server->reply.len > 0 && control_send_all(server, client->handler.fd, server->reply.data, server->reply.len) < 0) {
+            control_close_client(server, client);
+            return;
+        }
+    }
+}
+
+/* Listener readable: accept every pending connection */
+static void control_on_listener(void* ctx, uint32_t events) {
+    ControlServer* server = (ControlServer*)ctx;
+    (void)events;
+    for (;;) {
+        int sock = accept4(server->listener.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                logError("Control accept failed");
+            }
+            return;
+        }
+        ControlClient* client = (ControlClient*)calloc(1, sizeof(ControlClient));
+        if (!client) {
+            close(sock);
+            continue;
+        }
+        client->server = server;
+        client->handler.fd = sock;
+        client->handler.callback = control_on_client;
+        client->handler.ctx = client;
+        client->next = server->clients;
+        server->clients = client;
+        event_loop_add(&server->loop, &client->handler, EPOLLIN);
+    }
+}
+
+/* Bind the socket at path, replacing a stale one. Returns 0 on success */
+int control_server_init(ControlServer* server, const char* path, ShardedStore* store, int shutdown_fd) {
+    memset(server, 0, sizeof(*server));
+    server->path = path;
+    server->store = store;
+    server->shutdown_fd = shutdown_fd;
+    server->listener.fd = -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        print_err("Control socket path too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    if (event_loop_init(&server->loop, shutdown_fd) < 0) {
+        return -1;
+    }
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 16) < 0) {
+        logError("Control socket bind failed");
+        if (sock >= 0) close(sock);
+        event_loop_destroy(&server->loop);
+        return -1;
+    }
+    server->listener.fd = sock;
+    server->listener.callback = control_on_listener;
+    server->listener.ctx = server;
+    event_loop_add(&server->loop, &server->listener, EPOLLIN);
+    metrics_buffer_init(&server->reply);
+    return 0;
+}
+
+/* Close every client and the listener and remove the socket file */
+void control_server_destroy(ControlServer* server) {
+    while (server->clients) {
+        control_close_client(server, server->clients);
+    }
+    close(server->listener.fd);
+    unlink(server->path);
+    event_loop_destroy(&server->loop);
+    metrics_buffer_destroy(&server->reply);
+}
+
+/* Thread function: answer queries until the shutdown fd fires */
+void* controlServerThread(void* arg) {
+    ControlServer* server = (ControlServer*)arg;
+    server->reader = store_register_reader(server->store);
+    if (!server->reader) {
+        print_err("Control server: no free store reader slot\n");
+        return NULL;
+    }
+    event_loop_run(&server->loop);
+    return NULL;
+}
+
+#endif // CONTROL_SERVER_H
@@ -2,149 +2,281 @@
 #define CUSTOM_HASH_MAP_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "message.h"
 
-/* Smart pointer-like structure to manage memory manually */
-typedef struct UniquePtr {
-    void* ptr;  // Pointer to the managed memory
-} UniquePtr;
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-/* CustomHashMapNode structure for the hash map's linked list (collision handling) */
-typedef struct CustomHashMapNode {
-    uint64_t key;        // Key (MessageId) for lookup
-    Message value;       // Stored message value
-    UniquePtr next;      // Pointer to the next node in the bucket
-} CustomHashMapNode;
+/* Open-addressing hash map keyed by MessageId.
+ *
+ * Slots are stored as parallel arrays: one control byte, one key and one value
+ * per slot. A control byte is either HASH_MAP_CTRL_EMPTY or the low 7 bits of
+ * the key's hash (h2), so a whole group of HASH_MAP_GROUP_WIDTH slots can be
+ * filtered with one SIMD compare before any key is touched. Collisions are
+ * resolved by linear probing, and deletion shifts later entries back instead
+ * of leaving tombstones, so probe sequences never grow with churn. */
 
-/* Array of buckets containing linked lists of nodes */
-typedef struct BucketArray {
-    UniquePtr* buckets;  // Array of pointers to nodes
-    size_t size;         // Number of buckets
-} BucketArray;
+#define HASH_MAP_GROUP_WIDTH 16          // Control bytes examined per probe step
+#define HASH_MAP_CTRL_EMPTY ((int8_t)-128) // Control byte of an unused slot
+#define HASH_MAP_NOT_FOUND ((size_t)-1)  // Slot index returned for missing keys
 
 /* Main hash map structure */
 typedef struct {
-    UniquePtr buckets;   // Pointer to the bucket array
-    size_t num_elements; // Total number of stored elements
+    int8_t* ctrl;          // capacity + GROUP_WIDTH control bytes, the tail mirrors the head
+    uint64_t* keys;        // Keys (MessageId) per slot
+    Message* values;       // Stored message values per slot
+    size_t capacity;       // Number of slots (power of two)
+    size_t mask;           // capacity - 1
+    size_t num_elements;   // Total number of stored elements
+    size_t growth_limit;   // Element count that triggers a resize (75% load)
+    void (*retire)(void* ctx, void* ptr); // Receives the slot arrays replaced by a resize, NULL = free them
+    void* retire_ctx;      // Passed to retire
 } CustomHashMap;
 
-/* Simple hash function using the key itself */
-size_t hash_function(uint64_t key) {
-    return key;  // Basic hash
+/* 64-bit finalizer from MurmurHash3, spreads sequential IDs over all bits */
+uint64_t hash_function(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
 }
 
-/* Allocate and initialize a UniquePtr */
-UniquePtr* make_unique_ptr(void* p) {
-    UniquePtr* uptr = (UniquePtr*)malloc(sizeof(UniquePtr));
-    uptr->ptr = p;
-    return uptr;
+/* Home slot of a hash (high bits) and its control tag (low 7 bits) */
+static inline size_t hash_map_h1(const CustomHashMap* map, uint64_t hash) {
+    return (size_t)(hash >> 7) & map->mask;
 }
 
-/* Free a UniquePtr and its managed memory */
-void free_unique_ptr(UniquePtr* uptr) {
-    free(uptr->ptr);
-    free(uptr);
+static inline int8_t hash_map_h2(uint64_t hash) {
+    return (int8_t)(hash & 0x7F);
 }
 
-/* Create a new hash map with an initial bucket size */
+/* Set a control byte, keeping the mirrored tail in sync for wrap-around loads */
+static inline void hash_map_set_ctrl(CustomHashMap* map, size_t index, int8_t value) {
+    map->ctrl[index] = value;
+    if (index < HASH_MAP_GROUP_WIDTH) {
+        map->ctrl[map->capacity + index] = value;
+    }
+}
+
+/* Bitmask of the slots in the group at pos whose control byte equals tag */
+static inline uint32_t hash_map_group_match(const CustomHashMap* map, size_t pos, int8_t tag) {
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i*)(map->ctrl + pos));
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < HASH_MAP_GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(map->ctrl[pos + i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+/* Allocate empty slot arrays for a power-of-two capacity */
+static void hash_map_alloc_slots(CustomHashMap* map, size_t capacity) {
+    map->capacity = capacity;
+    map->mask = capacity - 1;
+    map->growth_limit = capacity - capacity / 4;
+    map->ctrl = (int8_t*)malloc(capacity + HASH_MAP_GROUP_WIDTH);
+    memset(map->ctrl, HASH_MAP_CTRL_EMPTY, capacity + HASH_MAP_GROUP_WIDTH);
+    map->keys = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+    map->values = (Message*)malloc(capacity * sizeof(Message));
+}
+
+/* Create a new hash map able to hold about initial_size elements before resizing */
 CustomHashMap* hash_map_create(size_t initial_size) {
     CustomHashMap* map = (CustomHashMap*)malloc(sizeof(CustomHashMap));
+    size_t capacity = HASH_MAP_GROUP_WIDTH;
+    while (capacity - capacity / 4 < initial_size) {
+        capacity <<= 1;
+    }
+    hash_map_alloc_slots(map, capacity);
     map->num_elements = 0;
-    BucketArray* ba = (BucketArray*)malloc(sizeof(BucketArray));
-    ba->size = initial_size;
-    ba->buckets = (UniquePtr*)calloc(initial_size, sizeof(UniquePtr)); // Zero-initialized
-    map->buckets.ptr = ba;
+    map->retire = NULL;
+    map->retire_ctx = NULL;
     return map;
 }
 
 /* Destroy the hash map and free all allocated memory */
 void hash_map_destroy(CustomHashMap* map) {
-    BucketArray* ba = (BucketArray*)map->buckets.ptr;
-    for (size_t i = 0; i < ba->size; i++) {
-        CustomHashMapNode* current = (CustomHashMapNode*)ba->buckets[i].ptr;
-        while (current) {
-            CustomHashMapNode* next = (CustomHashMapNode*)current->next.ptr;
-            free(current);  // Free each node in the bucket
-            current = next;
+    free(map->ctrl);
+    free(map->keys);
+    free(map->values);
+    free(map);
+}
+
+/* Slot holding key, or HASH_MAP_NOT_FOUND */
+size_t hash_map_find(const CustomHashMap* map, uint64_t key, uint64_t hash) {
+    size_t pos = hash_map_h1(map, hash);
+    int8_t tag = hash_map_h2(hash);
+    for (;;) {
+        uint32_t match = hash_map_group_match(map, pos, tag);
+        uint32_t empty = hash_map_group_match(map, pos, HASH_MAP_CTRL_EMPTY);
+        if (empty) {
+            match &= (empty & (0u - empty)) - 1;  // Keys never sit past the first empty slot
+        }
+        while (match) {
+            size_t index = (pos + (size_t)__builtin_ctz(match)) & map->mask;
+            if (map->keys[index] == key) return index;
+            match &= match - 1;
         }
+        if (empty) return HASH_MAP_NOT_FOUND;
+        pos = (pos + HASH_MAP_GROUP_WIDTH) & map->mask;
     }
-    free(ba->buckets);  // Free the bucket array
-    free(ba);           // Free the bucket array struct
-    free(map);          // Free the hash map struct
 }
 
-/* Calculate the bucket index for a given key */
-size_t get_bucket_index(CustomHashMap* map, uint64_t key) {
-    BucketArray* ba = (BucketArray*)map->buckets.ptr;
-    return hash_function(key) % ba->size;  // Modulo to fit within bucket count
+/* First empty slot at or after the home slot of hash */
+static size_t hash_map_find_empty(const CustomHashMap* map, uint64_t hash) {
+    size_t pos = hash_map_h1(map, hash);
+    for (;;) {
+        uint32_t empty = hash_map_group_match(map, pos, HASH_MAP_CTRL_EMPTY);
+        if (empty) return (pos + (size_t)__builtin_ctz(empty)) & map->mask;
+        pos = (pos + HASH_MAP_GROUP_WIDTH) & map->mask;
+    }
 }
 
-/* Resize the hash map when load factor exceeds threshold */
-void hash_map_resize(CustomHashMap* map) {
-    BucketArray* old_ba = (BucketArray*)map->buckets.ptr;
-    BucketArray* new_ba = (BucketArray*)malloc(sizeof(BucketArray));
-    new_ba->size = old_ba->size * 2;  // Double the bucket count
-    new_ba->buckets = (UniquePtr*)calloc(new_ba->size, sizeof(UniquePtr));
-    UniquePtr new_buckets = {new_ba};
-
-    // Rehash all existing elements into the new bucket array
-    for (size_t i = 0; i < old_ba->size; i++) {
-        CustomHashMapNode* current = (CustomHashMapNode*)old_ba->buckets[i].ptr;
-        while (current) {
-            CustomHashMapNode* next = (CustomHashMapNode*)current->next.ptr;
-            size_t new_index = hash_function(current->key) % new_ba->size;
-            current->next = new_ba->buckets[new_index];
-            new_ba->buckets[new_index].ptr = current;
-            current = next;
+/* Store a key known to be absent without checking for duplicates */
+static void hash_map_place(CustomHashMap* map, uint64_t key, uint64_t hash, const Message* value) {
+    size_t index = hash_map_find_empty(map, hash);
+    hash_map_set_ctrl(map, index, hash_map_h2(hash));
+    map->keys[index] = key;
+    map->values[index] = *value;
+    map->num_elements++;
+}
+
+/* Move every element into a table of capacity slots */
+static void hash_map_rehash(CustomHashMap* map, size_t capacity) {
+    int8_t* old_ctrl = map->ctrl;
+    uint64_t* old_keys = map->keys;
+    Message* old_values = map->values;
+    size_t old_capacity = map->capacity;
+
+    hash_map_alloc_slots(map, capacity);
+    map->num_elements = 0;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_ctrl[i] != HASH_MAP_CTRL_EMPTY) {
+            hash_map_place(map, old_keys[i], hash_function(old_keys[i]), &old_values[i]);
         }
     }
-    free(old_ba->buckets);
-    free(old_ba);
-    map->buckets = new_buckets;
+    if (map->retire) {
+        // Lock-free readers may still be probing the old arrays
+        map->retire(map->retire_ctx, old_ctrl);
+        map->retire(map->retire_ctx, old_keys);
+        map->retire(map->retire_ctx, old_values);
+    } else {
+        free(old_ctrl);
+        free(old_keys);
+        free(old_values);
+    }
+}
+
+/* Double the capacity and re-place every element */
+void hash_map_resize(CustomHashMap* map) {
+    hash_map_rehash(map, map->capacity * 2);
+}
+
+/* Grow once so that count elements fit without further resizes */
+void hash_map_reserve(CustomHashMap* map, size_t count) {
+    size_t capacity = map->capacity;
+    while (capacity - capacity / 4 < count) {
+        capacity <<= 1;
+    }
+    if (capacity != map->capacity) {
+        hash_map_rehash(map, capacity);
+    }
 }
 
-/* Insert a key-value pair into the hash map */
+/* Insert a key-value pair into the hash map (update if the key exists) */
 void hash_map_insert(CustomHashMap* map, uint64_t key, Message value) {
-    size_t index = get_bucket_index(map, key);
-    BucketArray* ba = (BucketArray*)map->buckets.ptr;
-    CustomHashMapNode* current = (CustomHashMapNode*)ba->buckets[index].ptr;
-
-    // Check for existing key (update if found)
-    while (current) {
-        if (current->key == key) {
-            current->value = value;
-            return;
-        }
-        current = (CustomHashMapNode*)current->next.ptr;
+    uint64_t hash = hash_function(key);
+    size_t index = hash_map_find(map, key, hash);
+    if (index != HASH_MAP_NOT_FOUND) {
+        map->values[index] = value;
+        return;
+    }
+    if (map->num_elements + 1 > map->growth_limit) {
+        hash_map_resize(map);
     }
+    hash_map_place(map, key, hash, &value);
+}
 
-    // Resize if load factor exceeds 0.75
-    if ((map->num_elements + 1.0) / ba->size > 0.75) {
+/* Insert a key-value pair only if the key is absent, with hash = hash_function(key)
+ * already computed (e.g. by a batch kernel).
+ * Returns 1 if the pair was inserted, 0 if the key already existed. */
+int hash_map_insert_if_absent_hashed(CustomHashMap* map, uint64_t key, uint64_t hash, const Message* value) {
+    if (hash_map_find(map, key, hash) != HASH_MAP_NOT_FOUND) {
+        return 0;  // Duplicate, keep the stored value
+    }
+    if (map->num_elements + 1 > map->growth_limit) {
         hash_map_resize(map);
-        ba = (BucketArray*)map->buckets.ptr;
-        index = get_bucket_index(map, key);
     }
+    hash_map_place(map, key, hash, value);
+    return 1;
+}
 
-    // Create and insert new node
-    CustomHashMapNode* new_node = (CustomHashMapNode*)malloc(sizeof(CustomHashMapNode));
-    new_node->key = key;
-    new_node->value = value;
-    new_node->next = ba->buckets[index];
-    ba->buckets[index].ptr = new_node;
-    map->num_elements++;
+/* Insert a key that the caller knows is absent (e.g. ruled out by a filter),
+ * skipping the duplicate probe. Inserting a present key would store it twice */
+void hash_map_insert_absent_hashed(CustomHashMap* map, uint64_t key, uint64_t hash, const Message* value) {
+    if (map->num_elements + 1 > map->growth_limit) {
+        hash_map_resize(map);
+    }
+    hash_map_place(map, key, hash, value);
+}
+
+/* Insert a key-value pair only if the key is absent.
+ * The duplicate check and the insert share one probe sequence.
+ * Returns 1 if the pair was inserted, 0 if the key already existed. */
+int hash_map_insert_if_absent(CustomHashMap* map, uint64_t key, Message value) {
+    return hash_map_insert_if_absent_hashed(map, key, hash_function(key), &value);
 }
 
 /* Check if a key exists in the hash map */
 int hash_map_contains(CustomHashMap* map, uint64_t key) {
-    size_t index = get_bucket_index(map, key);
-    BucketArray* ba = (BucketArray*)map->buckets.ptr;
-    CustomHashMapNode* current = (CustomHashMapNode*)ba->buckets[index].ptr;
-    while (current) {
-        if (current->key == key) return 1;  // Found
-        current = (CustomHashMapNode*)current->next.ptr;
+    return hash_map_find(map, key, hash_function(key)) != HASH_MAP_NOT_FOUND;
+}
+
+/* Copy the value stored for key into out. Returns 1 if found, 0 otherwise */
+int hash_map_get(CustomHashMap* map, uint64_t key, Message* out) {
+    size_t index = hash_map_find(map, key, hash_function(key));
+    if (index == HASH_MAP_NOT_FOUND) return 0;
+    *out = map->values[index];
+    return 1;
+}
+
+/* Remove a key, shifting later entries of its probe run back into the hole, and copy
+ * its value to out unless out is NULL. Returns 1 if the key was removed, 0 if it was not present. */
+int hash_map_take(CustomHashMap* map, uint64_t key, Message* out) {
+    size_t hole = hash_map_find(map, key, hash_function(key));
+    if (hole == HASH_MAP_NOT_FOUND) return 0;
+    if (out) *out = map->values[hole];
+
+    size_t next = hole;
+    for (;;) {
+        next = (next + 1) & map->mask;
+        if (map->ctrl[next] == HASH_MAP_CTRL_EMPTY) break;
+        size_t home = hash_map_h1(map, hash_function(map->keys[next]));
+        // Move the entry only if the hole lies between its home slot and its current slot
+        if (((next - home) & map->mask) >= ((next - hole) & map->mask)) {
+            hash_map_set_ctrl(map, hole, map->ctrl[next]);
+            map->keys[hole] = map->keys[next];
+            map->values[hole] = map->values[next];
+            hole = next;
+        }
     }
-    return 0;  // Not found
+    hash_map_set_ctrl(map, hole, HASH_MAP_CTRL_EMPTY);
+    map->num_elements--;
+    return 1;
+}
+
+/* Remove a key. Returns 1 if the key was removed, 0 if it was not present. */
+int hash_map_remove(CustomHashMap* map, uint64_t key) {
+    return hash_map_take(map, key, NULL);
 }
 
 /* Get the number of elements in the hash map */
@@ -0,0 +1,97 @@
+#ifndef DEDUP_WINDOW_H
+#define DEDUP_WINDOW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Insertion-ordered FIFO of stored IDs used to expire dedup entries.
+ * With max_count set the ring has a fixed size and the oldest ID is evicted
+ * when a new one arrives; with max_age_ns set, IDs older than the age are
+ * expired a few at a time, so there is never a full purge. */
+typedef struct {
+    uint64_t* ids;       // Stored IDs in insertion order
+    int64_t* times;      // Insertion time of each ID
+    size_t capacity;     // Allocated slots (power of two)
+    size_t head;         // Index of the oldest entry
+    size_t count;        // Entries in the ring
+    size_t max_count;    // Retain at most this many IDs, 0 = no count limit
+    int64_t max_age_ns;  // Retain IDs for at most this long, 0 = no age limit
+} DedupWindow;
+
+/* Initialize a window; both limits 0 disables eviction */
+void dedup_window_init(DedupWindow* w, size_t max_count, int64_t max_age_ns) {
+    w->max_count = max_count;
+    w->max_age_ns = max_age_ns;
+    w->capacity = 16;
+    while (max_count && w->capacity < max_count) {
+        w->capacity <<= 1;
+    }
+    w->head = 0;
+    w->count = 0;
+    w->ids = (uint64_t*)malloc(w->capacity * sizeof(uint64_t));
+    w->times = (int64_t*)malloc(w->capacity * sizeof(int64_t));
+}
+
+void dedup_window_destroy(DedupWindow* w) {
+    free(w->ids);
+    free(w->times);
+}
+
+/* Check whether the window evicts anything */
+static inline int dedup_window_enabled(const DedupWindow* w) {
+    return w->max_count > 0 || w->max_age_ns > 0;
+}
+
+/* Double the ring, used when only an age limit bounds it */
+static void dedup_window_grow(DedupWindow* w) {
+    size_t cap = w->capacity * 2;
+    uint64_t* ids = (uint64_t*)malloc(cap * sizeof(uint64_t));
+    int64_t* times = (int64_t*)malloc(cap * sizeof(int64_t));
+    for (size_t i = 0; i < w->count; i++) {
+        size_t from = (w->head + i) & (w->capacity - 1);
+        ids[i] = w->ids[from];
+        times[i] = w->times[from];
+    }
+    free(w->ids);
+    free(w->times);
+    w->ids = ids;
+    w->times = times;
+    w->capacity = cap;
+    w->head = 0;
+}
+
+/* Remove and return the oldest ID */
+static inline uint64_t dedup_window_pop(DedupWindow* w) {
+    uint64_t id = w->ids[w->head];
+    w->head = (w->head + 1) & (w->capacity - 1);
+    w->count--;
+    return id;
+}
+
+/* Append a newly stored ID. If the count limit is reached, the oldest ID is
+ * returned through evicted and 1 is returned; otherwise 0 */
+int dedup_window_push(DedupWindow* w, uint64_t id, int64_t now_ns, uint64_t* evicted) {
+    int full = 0;
+    if (w->max_count && w->count >= w->max_count) {
+        *evicted = dedup_window_pop(w);
+        full = 1;
+    } else if (w->count == w->capacity) {
+        dedup_window_grow(w);
+    }
+    size_t tail = (w->head + w->count) & (w->capacity - 1);
+    w->ids[tail] = id;
+    w->times[tail] = now_ns;
+    w->count++;
+    return full;
+}
+
+/* Pop the oldest ID if it is older than the age limit. Returns 1 and sets id if one expired */
+int dedup_window_expire_one(DedupWindow* w, int64_t now_ns, uint64_t* id) {
+    if (!w->max_age_ns || w->count == 0) return 0;
+    if (now_ns - w->times[w->head] < w->max_age_ns) return 0;
+    *id = dedup_window_pop(w);
+    return 1;
+}
+
+#endif // DEDUP_WINDOW_H
@@ -0,0 +1,166 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "log_error.h"
+
+#define EVENT_LOOP_MAX_EVENTS 64  // Events fetched per epoll_wait call
+
+/* Callback invoked with the ready epoll events of a registered fd */
+typedef void (*EventCallback)(void* ctx, uint32_t events);
+
+/* A file descriptor registered with an event loop */
+typedef struct {
+    int fd;                 // Watched file descriptor
+    EventCallback callback; // Called when fd is ready
+    void* ctx;              // User data passed to callback
+} EventHandler;
+
+/* epoll-based reactor. Sockets are registered edge-triggered, so handlers must
+ * drain them until EAGAIN. An eventfd wakes the loop from other threads, and an
+ * optional shared shutdown eventfd stops every loop that watches it. */
+typedef struct {
+    int epfd;                     // epoll instance
+    int wake_fd;                  // eventfd for cross-thread wakeups
+    EventHandler wake_handler;    // Sentinel handler for wake_fd
+    EventHandler shutdown_handler;// Sentinel handler for the shutdown fd
+    int stopped;                  // Set once the shutdown fd fired or event_loop_stop was called
+} EventLoop;
+
+/* Create the eventfd used to signal shutdown to every loop */
+int shutdown_fd_create(void) {
+    return eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+/* Signal shutdown. The counter is never read, so the fd stays readable for every watcher */
+void shutdown_fd_trigger(int shutdown_fd) {
+    uint64_t one = 1;
+    ssize_t ignored = write(shutdown_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+/* Initialize a loop. shutdown_fd may be -1 if the loop is stopped some other way.
+ * Returns 0 on success, -1 on error. */
+int event_loop_init(EventLoop* loop, int shutdown_fd) {
+    memset(loop, 0, sizeof(*loop));
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        logError("epoll_create1 failed");
+        return -1;
+    }
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wake_fd < 0) {
+        logError("eventfd failed");
+        close(loop->epfd);
+        return -1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    loop->wake_handler.fd = loop->wake_fd;
+    ev.data.ptr = &loop->wake_handler;
+    epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wake_fd, &ev);
+    if (shutdown_fd >= 0) {
+        // Level-triggered so the shutdown stays visible after the first wakeup
+        ev.events = EPOLLIN;
+        loop->shutdown_handler.fd = shutdown_fd;
+        ev.data.ptr = &loop->shutdown_handler;
+        epoll_ctl(loop->epfd, EPOLL_CTL_ADD, shutdown_fd, &ev);
+    }
+    return 0;
+}
+
+/* Close the loop's own descriptors (registered fds are left open) */
+void event_loop_destroy(EventLoop* loop) {
+    close(loop->wake_fd);
+    close(loop->epfd);
+}
+
+/* Register a handler for events (EPOLLIN/EPOLLOUT); edge-triggered. Returns 0 on success */
+int event_loop_add(EventLoop* loop, EventHandler* handler, uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events | EPOLLET;
+    ev.data.ptr = handler;
+    return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, handler->fd, &ev);
+}
+
+/* Change the events watched for a registered handler. Returns 0 on success */
+int event_loop_mod(EventLoop* loop, EventHandler* handler, uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events | EPOLLET;
+    ev.data.ptr = handler;
+    return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, handler->fd, &ev);
+}
+
+/* Unregister a handler. Returns 0 on success */
+int event_loop_del(EventLoop* loop, EventHandler* handler) {
+    return epoll_ctl(loop->epfd, EPOLL_CTL_DEL, handler->fd, NULL);
+}
+
+/* Wake the loop from another thread */
+void event_loop_wakeup(EventLoop* loop) {
+    uint64_t one = 1;
+    ssize_t ignored = write(loop->wake_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+/* Stop the loop after the current iteration (call from a handler or use wakeup from other threads) */
+void event_loop_stop(EventLoop* loop) {
+    loop->stopped = 1;
+}
+
+/* Wait up to timeout_ms (-1 = forever) and dispatch ready handlers.
+ * Returns the number of events handled, or -1 on error. */
+int event_loop_run_once(EventLoop* loop, int timeout_ms) {
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    int n = epoll_wait(loop->epfd, events, EVENT_LOOP_MAX_EVENTS, timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR) return 0;
+        logError("epoll_wait failed");
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        EventHandler* handler = (EventHandler*)events[i].data.ptr;
+        if (handler == &loop->shutdown_handler) {
+            loop->stopped = 1;
+        } else if (handler == &loop->wake_handler) {
+            uint64_t value;
+            ssize_t ignored = read(loop->wake_fd, &value, sizeof(value));
+            (void)ignored;
+        } else if (!loop->stopped) {
+            handler->callback(handler->ctx, events[i].events);
+        }
+    }
+    return n;
+}
+
+/* Dispatch events until the loop is stopped. Returns 0 on clean stop, -1 on error */
+int event_loop_run(EventLoop* loop) {
+    while (!loop->stopped) {
+        if (event_loop_run_once(loop, -1) < 0) return -1;
+    }
+    return 0;
+}
+
+/* One-shot wait for a single fd, for threads that block on one socket at a time.
+ * Also returns early if shutdown_fd (may be -1) fires.
+ * Returns the ready events of fd, 0 on timeout or shutdown. */
+uint32_t event_wait_fd(int fd, short events, int shutdown_fd, int timeout_ms) {
+    struct pollfd fds[2];
+    fds[0].fd = fd;
+    fds[0].events = events;
+    fds[0].revents = 0;
+    fds[1].fd = shutdown_fd;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    int n = poll(fds, shutdown_fd >= 0 ? 2 : 1, timeout_ms);
+    if (n <= 0) return 0;
+    return (uint32_t)fds[0].revents;
+}
+
+#endif // EVENT_LOOP_H
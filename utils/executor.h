@@ -0,0 +1,397 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "mpsc_ring.h"
+
+/* Work-stealing executor for short, type-erased tasks.
+ *
+ * Every worker owns a Chase-Lev deque. The owner pushes and pops at the bottom
+ * without a locked instruction unless a single task is left, and idle workers
+ * steal from the top of a random victim with one CAS. Threads outside the pool
+ * submit through a bounded lock-free MPMC injection queue that every worker polls.
+ * A task is a function pointer plus up to EXECUTOR_PAYLOAD_SIZE bytes copied inline,
+ * so submitting never allocates. Tasks submitted from inside a task go to the
+ * current worker's deque and stay on that core unless someone steals them.
+ * A worker that finds nothing spins for a while and then parks on a futex; a
+ * submitter only makes the wake syscall when a worker is parked.
+ *
+ * There is no shared counter on the task path: completion is tracked by per-worker
+ * counters that only their owner writes, summed when someone asks. */
+
+#define EXECUTOR_PAYLOAD_SIZE 56       // Inline argument bytes; a Task fills one cache line
+#define EXECUTOR_DEQUE_CAPACITY 4096   // Tasks per worker deque; beyond that they go to the injector
+#define EXECUTOR_DEFAULT_QUEUE 65536   // Injection queue slots when the caller passes 0
+#define EXECUTOR_SPIN 128              // Empty search rounds before a worker parks
+
+typedef void (*TaskFn)(void* payload);
+
+/* A function and its copied argument */
+typedef struct {
+    TaskFn fn;
+    _Alignas(8) unsigned char payload[EXECUTOR_PAYLOAD_SIZE];
+} Task;
+
+/* Chase-Lev deque of fixed capacity. Thieves copy the top slot before their CAS on
+ * top; a copy whose CAS fails may be torn and is thrown away, as in a seqlock */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic int64_t top;     // Oldest task, taken by thieves
+    _Alignas(CACHE_LINE_SIZE) _Atomic int64_t bottom;  // Next free slot, written by the owner only
+    Task* tasks;
+    int64_t mask;                                      // Capacity - 1
+} WorkDeque;
+
+/* Bounded MPMC queue (one sequence number per slot) for tasks from outside the pool */
+typedef struct {
+    _Atomic size_t seq;
+    Task task;
+} TaskSlot;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t tail;  // Next slot to fill; also the number of tasks ever injected
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t head;  // Next slot to take
+    TaskSlot* slots;
+    size_t mask;
+} TaskQueue;
+
+typedef struct Executor Executor;
+
+typedef struct {
+    WorkDeque deque;
+    Executor* executor;
+    pthread_t thread;
+    size_t index;
+    uint64_t rng;                                          // Victim choice (xorshift)
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t spawned;    // Tasks this worker pushed to its deque
+    _Atomic uint64_t executed;                             // Tasks this worker ran
+    _Atomic uint64_t stolen;                               // Of those, taken from another deque
+} ExecutorWorker;
+
+struct Executor {
+    ExecutorWorker* workers;
+    size_t num_workers;
+    TaskQueue injector;
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t taken;  // Injected tasks run outside the workers (executor_wait_idle)
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t epoch;  // Futex word, bumped to wake parked workers
+    _Atomic uint32_t sleepers;                         // Workers parked or about to park
+    _Atomic int shutdown;
+};
+
+static _Thread_local ExecutorWorker* executor_self;  // Worker running on this thread, NULL elsewhere
+static _Thread_local Executor* executor_helping;     // Executor whose tasks executor_wait_idle runs here
+
+/* Owner-only counter update: a load and a release store, no locked instruction */
+static inline void executor_count(_Atomic uint64_t* counter, int64_t delta) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + (uint64_t)delta,
+                          memory_order_release);
+}
+
+/* Owner: push a task at the bottom. Returns 0 if the deque is full */
+static inline int work_deque_push(WorkDeque* dq, const Task* task) {
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    if (b - t > dq->mask) return 0;
+    dq->tasks[b & dq->mask] = *task;
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    return 1;
+}
+
+/* Owner: pop the newest task. Returns 0 if the deque is empty */
+static inline int work_deque_pop(WorkDeque* dq, Task* out) {
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+    if (t > b) {
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        return 0;
+    }
+    *out = dq->tasks[b & dq->mask];
+    if (t == b) {
+        // Last task: race the thieves for it
+        int won = atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1, memory_order_seq_cst,
+                                                          memory_order_relaxed);
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        return won;
+    }
+    return 1;
+}
+
+/* Any thread: take the oldest task. Returns 1 on success, 0 if empty, -1 if another thread won the race */
+static inline int work_deque_steal(WorkDeque* dq, Task* out) {
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+    if (t >= b) return 0;
+    Task copy = dq->tasks[t & dq->mask];
+    if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return -1;
+    }
+    *out = copy;
+    return 1;
+}
+
+static inline int work_deque_empty(WorkDeque* dq) {
+    return atomic_load_explicit(&dq->top, memory_order_relaxed) >= atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+}
+
+static inline int task_queue_push(TaskQueue* q, const Task* task) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    TaskSlot* slot;
+    for (;;) {
+        slot = &q->slots[pos & q->mask];
+        intptr_t diff = (intptr_t)atomic_load_explicit(&slot->seq, memory_order_acquire) - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;  // Full
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+    slot->task = *task;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return 1;
+}
+
+static inline int task_queue_pop(TaskQueue* q, Task* out) {
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    TaskSlot* slot;
+    for (;;) {
+        slot = &q->slots[pos & q->mask];
+        intptr_t diff = (intptr_t)atomic_load_explicit(&slot->seq, memory_order_acquire) - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;  // Empty
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+    *out = slot->task;
+    atomic_store_explicit(&slot->seq, pos + q->mask + 1, memory_order_release);
+    return 1;
+}
+
+static inline int task_queue_empty(TaskQueue* q) {
+    return atomic_load_explicit(&q->head, memory_order_relaxed) >= atomic_load_explicit(&q->tail, memory_order_relaxed);
+}
+
+/* Wake one parked worker, if any. The fence orders the task publish before reading sleepers */
+static inline void executor_notify(Executor* exec) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&exec->sleepers, memory_order_relaxed) > 0) {
+        atomic_fetch_add(&exec->epoch, 1);
+        syscall(SYS_futex, &exec->epoch, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/* Check every queue for work, before parking */
+static int executor_has_work(Executor* exec) {
+    if (!task_queue_empty(&exec->injector)) return 1;
+    for (size_t i = 0; i < exec->num_workers; i++) {
+        if (!work_deque_empty(&exec->workers[i].deque)) return 1;
+    }
+    return 0;
+}
+
+/* Injected task or one stolen from a random victim */
+static int executor_find(Executor* exec, ExecutorWorker* self, Task* out) {
+    if (task_queue_pop(&exec->injector, out)) return 1;
+    self->rng ^= self->rng << 13;
+    self->rng ^= self->rng >> 7;
+    self->rng ^= self->rng << 17;
+    size_t n = exec->num_workers;
+    size_t start = (size_t)(self->rng % n);
+    for (size_t k = 0; k < n; k++) {
+        ExecutorWorker* victim = &exec->workers[(start + k) % n];
+        if (victim == self) continue;
+        int result;
+        while ((result = work_deque_steal(&victim->deque, out)) < 0) {
+            cpu_relax();
+        }
+        if (result > 0) {
+            executor_count(&self->stolen, 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void* executorWorkerThread(void* arg) {
+    ExecutorWorker* self = (ExecutorWorker*)arg;
+    Executor* exec = self->executor;
+    executor_self = self;
+    Task task;
+    for (;;) {
+        int found = work_deque_pop(&self->deque, &task) || executor_find(exec, self, &task);
+        for (int spin = 0; !found && spin < EXECUTOR_SPIN; spin++) {
+            cpu_relax();
+            found = executor_find(exec, self, &task);
+        }
+        if (found) {
+            task.fn(task.payload);
+            executor_count(&self->executed, 1);
+            continue;
+        }
+        if (atomic_load(&exec->shutdown)) break;
+
+        // Park. A submitter either sees sleepers and bumps epoch, or we see its task here
+        uint32_t seen = atomic_load(&exec->epoch);
+        atomic_fetch_add(&exec->sleepers, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!executor_has_work(exec) && !atomic_load(&exec->shutdown)) {
+            syscall(SYS_futex, &exec->epoch, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+        }
+        atomic_fetch_sub(&exec->sleepers, 1);
+    }
+    executor_self = NULL;
+    return NULL;
+}
+
+/* Start num_workers workers (0 = online CPUs) with an injection queue of at least
+ * queue_capacity tasks (0 = EXECUTOR_DEFAULT_QUEUE). Returns NULL on failure */
+Executor* executor_create(size_t num_workers, size_t queue_capacity) {
+    if (num_workers == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = cpus > 0 ? (size_t)cpus : 1;
+    }
+    size_t slots = 1;
+    while (slots < (queue_capacity ? queue_capacity : EXECUTOR_DEFAULT_QUEUE)) {
+        slots <<= 1;
+    }
+    Executor* exec = (Executor*)aligned_alloc(CACHE_LINE_SIZE, (sizeof(Executor) + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1));
+    if (!exec) return NULL;
+    memset(exec, 0, sizeof(*exec));
+    exec->injector.slots = (TaskSlot*)malloc(slots * sizeof(TaskSlot));
+    exec->workers = (ExecutorWorker*)aligned_alloc(CACHE_LINE_SIZE, num_workers * sizeof(ExecutorWorker));
+    if (!exec->injector.slots || !exec->workers) {
+        free(exec->injector.slots);
+        free(exec->workers);
+        free(exec);
+        return NULL;
+    }
+    exec->injector.mask = slots - 1;
+    for (size_t i = 0; i < slots; i++) {
+        atomic_init(&exec->injector.slots[i].seq, i);
+    }
+    exec->num_workers = num_workers;
+    for (size_t i = 0; i < num_workers; i++) {
+        ExecutorWorker* w = &exec->workers[i];
+        memset(w, 0, sizeof(*w));
+        w->executor = exec;
+        w->index = i;
+        w->rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+        w->deque.tasks = (Task*)aligned_alloc(CACHE_LINE_SIZE, EXECUTOR_DEQUE_CAPACITY * sizeof(Task));
+        w->deque.mask = EXECUTOR_DEQUE_CAPACITY - 1;
+    }
+    for (size_t i = 0; i < num_workers; i++) {
+        pthread_create(&exec->workers[i].thread, NULL, executorWorkerThread, &exec->workers[i]);
+    }
+    return exec;
+}
+
+/* Run fn with a copy of size bytes of payload on some worker. From inside a task the
+ * task goes to the current worker's deque, and if every queue is full it runs inline,
+ * so a task never loses the work it spawns.
+ * Returns 1 if it was queued (or run), 0 if the injection queue is full or size is too big */
+int executor_submit(Executor* exec, TaskFn fn, const void* payload, size_t size) {
+    if (size > EXECUTOR_PAYLOAD_SIZE) return 0;
+    Task task;
+    task.fn = fn;
+    if (size) memcpy(task.payload, payload, size);
+    ExecutorWorker* self = executor_self;
+    if (self && self->executor == exec) {
+        // Counted before the push, so no thief can finish the task before it is counted
+        executor_count(&self->spawned, 1);
+        if (work_deque_push(&self->deque, &task)) {
+            executor_notify(exec);
+            return 1;
+        }
+        executor_count(&self->spawned, -1);
+    }
+    if (!task_queue_push(&exec->injector, &task)) {
+        if ((self && self->executor == exec) || executor_helping == exec) {
+            fn(task.payload);  // Every queue is full: the producer does the work itself
+            return 1;
+        }
+        return 0;
+    }
+    executor_notify(exec);
+    return 1;
+}
+
+/* Tasks queued or running. Completions are summed before submissions, so 0 means that
+ * at some point during the call every task submitted until then had finished */
+size_t executor_pending(Executor* exec) {
+    uint64_t done = atomic_load_explicit(&exec->taken, memory_order_acquire);
+    for (size_t i = 0; i < exec->num_workers; i++) {
+        done += atomic_load_explicit(&exec->workers[i].executed, memory_order_acquire);
+    }
+    uint64_t submitted = atomic_load_explicit(&exec->injector.tail, memory_order_acquire);
+    for (size_t i = 0; i < exec->num_workers; i++) {
+        submitted += atomic_load_explicit(&exec->workers[i].spawned, memory_order_acquire);
+    }
+    return submitted > done ? (size_t)(submitted - done) : 0;
+}
+
+/* Wait until every submitted task has run, running injected tasks on the calling thread meanwhile */
+void executor_wait_idle(Executor* exec) {
+    Task task;
+    Executor* outer = executor_helping;
+    executor_helping = exec;
+    while (executor_pending(exec) > 0) {
+        if (task_queue_pop(&exec->injector, &task)) {
+            task.fn(task.payload);
+            atomic_fetch_add(&exec->taken, 1);
+        } else {
+            sched_yield();
+        }
+    }
+    executor_helping = outer;
+}
+
+/* Tasks run and tasks stolen so far, summed over the workers */
+void executor_stats(Executor* exec, uint64_t* executed, uint64_t* stolen) {
+    *executed = 0;
+    *stolen = 0;
+    for (size_t i = 0; i < exec->num_workers; i++) {
+        *executed += atomic_load(&exec->workers[i].executed);
+        *stolen += atomic_load(&exec->workers[i].stolen);
+    }
+}
+
+/* Run everything still queued, stop the workers and free the executor */
+void executor_destroy(Executor* exec) {
+    atomic_store(&exec->shutdown, 1);
+    atomic_fetch_add(&exec->epoch, 1);
+    syscall(SYS_futex, &exec->epoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    for (size_t i = 0; i < exec->num_workers; i++) {
+        pthread_join(exec->workers[i].thread, NULL);
+    }
+    for (size_t i = 0; i < exec->num_workers; i++) {
+        free(exec->workers[i].deque.tasks);
+    }
+    free(exec->workers);
+    free(exec->injector.slots);
+    free(exec);
+}
+
+#endif // EXECUTOR_H
@@ -0,0 +1,85 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* Log-linear (HDR-style) histogram of non-negative integer values such as
+ * latencies in nanoseconds. Values below HISTOGRAM_SUB_BUCKETS are exact;
+ * above that every power-of-two range is split into HISTOGRAM_SUB_BUCKETS / 2
+ * linear buckets, which bounds the relative error to under 1.6%. */
+
+#define HISTOGRAM_SUB_BITS 7
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)   // 128
+#define HISTOGRAM_HALF (HISTOGRAM_SUB_BUCKETS / 2)        // 64
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS + (64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_HALF)
+
+typedef struct {
+    uint64_t counts[HISTOGRAM_BUCKETS];  // Samples per bucket
+    uint64_t total;                      // Number of samples
+    uint64_t min;                        // Smallest sample
+    uint64_t max;                        // Largest sample
+    double sum;                          // Sum of samples, for the mean
+} Histogram;
+
+void histogram_reset(Histogram* h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+/* Bucket index of a value */
+static inline size_t histogram_index(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) return (size_t)value;
+    unsigned shift = (unsigned)(63 - __builtin_clzll(value)) - (HISTOGRAM_SUB_BITS - 1);
+    return HISTOGRAM_SUB_BUCKETS + (shift - 1) * HISTOGRAM_HALF + (size_t)((value >> shift) - HISTOGRAM_HALF);
+}
+
+/* Representative (midpoint) value of a bucket */
+static inline uint64_t histogram_bucket_value(size_t index) {
+    if (index < HISTOGRAM_SUB_BUCKETS) return index;
+    size_t rel = index - HISTOGRAM_SUB_BUCKETS;
+    unsigned shift = (unsigned)(rel / HISTOGRAM_HALF) + 1;
+    uint64_t low = (uint64_t)(rel % HISTOGRAM_HALF + HISTOGRAM_HALF) << shift;
+    return low + ((1ULL << shift) >> 1);
+}
+
+void histogram_record(Histogram* h, uint64_t value) {
+    h->counts[histogram_index(value)]++;
+    h->total++;
+    h->sum += (double)value;
+    if (value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+}
+
+/* Add every sample of src to dst */
+void histogram_merge(Histogram* dst, const Histogram* src) {
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+/* Value at quantile q (0..1), or 0 if empty */
+uint64_t histogram_percentile(const Histogram* h, double q) {
+    if (h->total == 0) return 0;
+    uint64_t target = (uint64_t)(q * (double)h->total + 0.5);
+    if (target == 0) target = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            uint64_t value = histogram_bucket_value(i);
+            return value > h->max ? h->max : value;
+        }
+    }
+    return h->max;
+}
+
+double histogram_mean(const Histogram* h) {
+    return h->total ? h->sum / (double)h->total : 0.0;
+}
+
+#endif // HISTOGRAM_H
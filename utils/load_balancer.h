@@ -0,0 +1,116 @@
+#ifndef LOAD_BALANCER_H
+#define LOAD_BALANCER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <strings.h>
+
+/* Choice of one downstream endpoint among those of an output.
+ *
+ * hash          rendezvous (highest random weight) hashing of the MessageId: every
+ *               endpoint scores the ID and the best healthy one wins. An ID always
+ *               goes to the same endpoint while it is up, and when one goes down only
+ *               its share moves, each ID to its second choice.
+ * round-robin   the next healthy endpoint in turn, for when ordering does not matter
+ * least-loaded  the healthy endpoint with the fewest queued messages
+ *
+ * Health is one bit per endpoint. When no endpoint is healthy they all count as
+ * healthy, so messages queue up where they would go anyway. */
+
+#define BALANCE_MAX_ENDPOINTS 16  // Endpoints per output; health is a uint32_t mask
+
+typedef enum {
+    BALANCE_HASH,
+    BALANCE_ROUND_ROBIN,
+    BALANCE_LEAST_LOADED
+} BalanceMode;
+
+BalanceMode balance_mode_parse(const char* name, BalanceMode def) {
+    if (!name) return def;
+    if (strcasecmp(name, "hash") == 0) return BALANCE_HASH;
+    if (strcasecmp(name, "round-robin") == 0 || strcasecmp(name, "rr") == 0) return BALANCE_ROUND_ROBIN;
+    if (strcasecmp(name, "least-loaded") == 0) return BALANCE_LEAST_LOADED;
+    return def;
+}
+
+const char* balance_mode_name(BalanceMode mode) {
+    switch (mode) {
+        case BALANCE_ROUND_ROBIN: return "round-robin";
+        case BALANCE_LEAST_LOADED: return "least-loaded";
+        default: return "hash";
+    }
+}
+
+/* Stable seed of an endpoint from its address, so an ID keeps its endpoint when
+ * others are added, removed or listed in another order */
+uint64_t balance_seed(const char* host, uint16_t port) {
+    uint64_t seed = 0xcbf29ce484222325ULL;  // FNV-1a
+    for (const char* c = host; *c; c++) {
+        seed = (seed ^ (uint8_t)*c) * 0x100000001b3ULL;
+    }
+    seed = (seed ^ port) * 0x100000001b3ULL;
+    return seed;
+}
+
+/* Rendezvous score of id at the endpoint with seed (splitmix64 finalizer) */
+static inline uint64_t balance_score(uint64_t id, uint64_t seed) {
+    uint64_t x = id ^ seed;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static inline uint32_t balance_candidates(size_t count, uint32_t healthy) {
+    uint32_t all = count >= 32 ? UINT32_MAX : (1u << count) - 1;
+    return (healthy & all) ? healthy & all : all;
+}
+
+/* Highest scoring healthy endpoint for id. *moved is set when the overall
+ * highest scoring endpoint is down, i.e. the ID was rebalanced */
+static inline size_t balance_pick_hash(const uint64_t* seeds, size_t count, uint32_t healthy, uint64_t id,
+                                       int* moved) {
+    uint32_t candidates = balance_candidates(count, healthy);
+    size_t best = 0, top = 0;
+    uint64_t best_score = 0, top_score = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t score = balance_score(id, seeds[i]);
+        if (score >= top_score) {
+            top_score = score;
+            top = i;
+        }
+        if (((candidates >> i) & 1) && score >= best_score) {
+            best_score = score;
+            best = i;
+        }
+    }
+    *moved = best != top;
+    return best;
+}
+
+/* Next healthy endpoint after *cursor */
+static inline size_t balance_pick_next(size_t count, uint32_t healthy, uint32_t* cursor) {
+    uint32_t candidates = balance_candidates(count, healthy);
+    for (size_t step = 0; step < count; step++) {
+        size_t i = (*cursor)++ % count;
+        if ((candidates >> i) & 1) return i;
+    }
+    return 0;
+}
+
+/* Healthy endpoint with the smallest load; ties go round-robin from *cursor */
+static inline size_t balance_pick_least(const size_t* loads, size_t count, uint32_t healthy, uint32_t* cursor) {
+    uint32_t candidates = balance_candidates(count, healthy);
+    size_t start = (*cursor)++ % count;
+    size_t best = start;
+    size_t best_load = SIZE_MAX;
+    for (size_t step = 0; step < count; step++) {
+        size_t i = (start + step) % count;
+        if (((candidates >> i) & 1) && loads[i] < best_load) {
+            best_load = loads[i];
+            best = i;
+        }
+    }
+    return best;
+}
+
+#endif // LOAD_BALANCER_H
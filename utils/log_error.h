@@ -7,7 +7,7 @@
 /* Log an error message with errno details */
 void logError(const char* message) {
     char buffer[256];
-    snprintf(buffer, sizeof(buffer), "[ERROR] %s: %s\n", message, strerror(errno));
+    snprintf(buffer, sizeof(buffer), "[ERROR] %.160s: %s\n", message, strerror(errno));
     print_err(buffer);
 }
 
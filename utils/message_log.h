@@ -0,0 +1,489 @@
+#ifndef MESSAGE_LOG_H
+#define MESSAGE_LOG_H
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "async_log.h"
+#include "custom_hash_map.h"
+#include "executor.h"
+#include "log_error.h"
+#include "message.h"
+#include "metrics.h"
+#include "mpsc_ring.h"
+#include "sharded_store.h"
+#include "thread_utils.h"
+#include "time_utils.h"
+
+/* Durable append-only log of accepted messages, so a restart keeps deduplicating.
+ *
+ * The log is a directory of fixed-size segment files named by a 16-digit hex
+ * sequence number. Each starts with a MessageLogHeader followed by fixed-size
+ * records, and has its blocks reserved with posix_fallocate before it is written
+ * through a shared mapping, so a full disk fails the rotation instead of raising
+ * SIGBUS on a store into the mapping. The writer then drops appends (counted) and
+ * retries the rotation once a second.
+ * Receivers never touch the files: message_log_append only pushes onto a ring,
+ * and a full ring drops the append (counted) rather than blocking. The writer
+ * thread copies records into the mapping, msyncs by policy and rotates to a new
+ * segment when one is full, deleting the oldest beyond max_segments.
+ *
+ * Unwritten space reads as zeros and a record's check word is never zero, so
+ * recovery needs no separate index: every valid record in every segment is
+ * inserted into the store, by several threads, one segment at a time each. */
+
+#define MSGLOG_MAGIC 0x31474f4c4753544dULL  // "MTSGLOG1"
+#define MSGLOG_VERSION 1
+#define MSGLOG_HEADER_SIZE 64
+#define MSGLOG_MAX_RECOVERY_THREADS 32
+#define MSGLOG_WRITE_BATCH 256
+
+typedef enum {
+    MSGLOG_SYNC_NONE,      // Leave write-back to the kernel; survives a process crash, not a power loss
+    MSGLOG_SYNC_INTERVAL,  // msync what was written every sync_interval_ns
+    MSGLOG_SYNC_BATCH,     // msync after every batch the writer takes from the ring
+} MessageLogSync;
+
+/* Settings of the message log (MT_MSGLOG_* variables) */
+typedef struct {
+    const char* dir;           // Segment directory, NULL = no log (MT_MSGLOG_DIR)
+    size_t segment_bytes;      // Size of one segment file (MT_MSGLOG_SEGMENT_MB)
+    size_t max_segments;       // Delete the oldest segments beyond this many, 0 = keep all (MT_MSGLOG_MAX_SEGMENTS)
+    MessageLogSync sync;       // Durability policy (MT_MSGLOG_SYNC: none, interval, batch)
+    int64_t sync_interval_ns;  // Period of the interval policy (MT_MSGLOG_SYNC_MS)
+    size_t queue_capacity;     // Appends buffered for the writer (MT_MSGLOG_QUEUE)
+    size_t recovery_threads;   // Segments scanned in parallel on startup, 0 = online CPUs (MT_MSGLOG_RECOVERY_THREADS)
+} MessageLogOptions;
+
+/* First MSGLOG_HEADER_SIZE bytes of a segment */
+typedef struct {
+    uint64_t magic;          // MSGLOG_MAGIC
+    uint32_t version;        // MSGLOG_VERSION
+    uint32_t record_size;    // sizeof(MessageLogRecord)
+    uint64_t sequence;       // Segment number, also in the file name
+    uint64_t capacity;       // Records that fit in the segment
+    uint64_t sealed;         // Records written once the segment was filled, 0 while it is open
+    uint8_t reserved[24];
+} MessageLogHeader;
+
+/* One accepted message */
+typedef struct {
+    uint64_t id;
+    uint64_t data;
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t check;          // message_log_check() of the fields above, never 0
+} MessageLogRecord;
+
+_Static_assert(sizeof(MessageLogHeader) == MSGLOG_HEADER_SIZE, "segment header size");
+_Static_assert(sizeof(MessageLogRecord) == 24, "record size");
+
+typedef struct {
+    MessageLogOptions opts;
+    MpscRing* ring;             // Accepted messages waiting for the writer
+    _Atomic uint64_t dropped;   // Appends refused because the ring was full
+    // Writer state, owned by messageLogThread after message_log_open
+    int fd;                     // Open segment, -1 if none
+    char* map;                  // Shared mapping of the open segment
+    uint64_t sequence;          // Sequence number of the open segment
+    uint64_t oldest;            // Oldest segment still on disk
+    size_t capacity;            // Records that fit in a segment
+    size_t count;               // Records written to the open segment
+    size_t synced;              // Records of the open segment already msynced
+    int64_t last_sync_ns;       // Time of the last msync
+    uint64_t appended;          // Records written since startup
+    uint64_t syncs;             // msync calls
+    uint64_t rotations;         // Segments filled and replaced
+    uint64_t lost;              // Records dropped because no new segment could be allocated
+    int64_t retry_ns;           // Earliest next rotation attempt after a failed one
+    int failing;                // The last batch lost records
+    MetricsThread* metrics;     // Writer counters, or NULL
+    // Recovery results
+    uint64_t recovered;         // Valid records found on startup
+    uint64_t recovered_segments;// Segments scanned on startup
+    uint64_t recovered_max_id;  // Largest MessageId found on startup, 0 if none
+    int64_t recovery_ns;        // Time the startup scan took
+} MessageLog;
+
+MessageLogSync message_log_sync_parse(const char* name, MessageLogSync def) {
+    if (!name) return def;
+    if (strcasecmp(name, "none") == 0) return MSGLOG_SYNC_NONE;
+    if (strcasecmp(name, "interval") == 0) return MSGLOG_SYNC_INTERVAL;
+    if (strcasecmp(name, "batch") == 0) return MSGLOG_SYNC_BATCH;
+    return def;
+}
+
+/* Check word of a record; unwritten (zero) space never matches */
+static inline uint32_t message_log_check(const MessageLogRecord* rec) {
+    uint64_t h = hash_function(rec->id ^ hash_function(rec->data ^ ((uint64_t)rec->type << 56)));
+    return (uint32_t)(h >> 32) | 1u;
+}
+
+static void message_log_path(char* buf, size_t size, const char* dir, uint64_t sequence) {
+    snprintf(buf, size, "%s/%016lx.seg", dir, (unsigned long)sequence);
+}
+
+static int message_log_compare_seq(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* Sorted sequence numbers of the segments in dir. Returns the count, *out must be freed */
+static size_t message_log_list(const char* dir, uint64_t** out) {
+    size_t count = 0, cap = 16;
+    uint64_t* seqs = (uint64_t*)malloc(cap * sizeof(uint64_t));
+    DIR* d = opendir(dir);
+    struct dirent* entry;
+    while (d && (entry = readdir(d)) != NULL) {
+        char* end = NULL;
+        unsigned long long seq = strtoull(entry->d_name, &end, 16);
+        if (end != entry->d_name + 16 || strcmp(end, ".seg") != 0) continue;
+        if (count == cap) {
+            cap *= 2;
+            seqs = (uint64_t*)realloc(seqs, cap * sizeof(uint64_t));
+        }
+        seqs[count++] = (uint64_t)seq;
+    }
+    if (d) closedir(d);
+    qsort(seqs, count, sizeof(uint64_t), message_log_compare_seq);
+    *out = seqs;
+    return count;
+}
+
+/* Shared recovery state; every segment is scanned by one executor task */
+typedef struct {
+    MessageLog* log;
+    ShardedStore* store;
+    const uint64_t* seqs;       // Segments to scan
+    size_t* tails;              // Per segment: index after the last valid record
+    size_t count;               // Number of segments
+    _Atomic uint64_t records;   // Valid records found
+    _Atomic uint64_t max_id;    // Largest MessageId found
+    int64_t now_ns;             // Insert time for the retention window
+} MessageLogRecovery;
+
+/* Insert every valid record of one segment. Returns the number of valid records */
+static uint64_t message_log_scan(MessageLogRecovery* rec, size_t index) {
+    char path[512];
+    message_log_path(path, sizeof(path), rec->log->opts.dir, rec->seqs[index]);
+    rec->tails[index] = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < MSGLOG_HEADER_SIZE) {
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    char* map = (char*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    const MessageLogHeader* header = (const MessageLogHeader*)map;
+    uint64_t valid = 0;
+    uint64_t max_id = 0;
+    if (header->magic == MSGLOG_MAGIC && header->version == MSGLOG_VERSION &&
+        header->record_size == sizeof(MessageLogRecord)) {
+        size_t limit = ((size_t)st.st_size - MSGLOG_HEADER_SIZE) / sizeof(MessageLogRecord);
+        if (header->capacity < limit) limit = (size_t)header->capacity;
+        if (header->sealed > 0 && header->sealed < limit) limit = (size_t)header->sealed;
+        const MessageLogRecord* records = (const MessageLogRecord*)(map + MSGLOG_HEADER_SIZE);
+        Message msg;
+        memset(&msg, 0, sizeof(msg));
+        for (size_t i = 0; i < limit; i++) {
+            // A torn or never-written record fails its check and is skipped
+            const MessageLogRecord* r = &records[i];
+            if (r->check != message_log_check(r)) continue;
+            msg.MessageId = r->id;
+            msg.MessageData = r->data;
+            msg.MessageType = r->type;
+            store_insert_if_absent_hashed(rec->store, &msg, hash_function(r->id), rec->now_ns);
+            rec->tails[index] = i + 1;
+            if (r->id > max_id) max_id = r->id;
+            valid++;
+        }
+    }
+    uint64_t seen = atomic_load(&rec->max_id);
+    while (max_id > seen && !atomic_compare_exchange_weak(&rec->max_id, &seen, max_id)) {
+    }
+    munmap(map, (size_t)st.st_size);
+    return valid;
+}
+
+/* Executor payload: one segment to scan */
+typedef struct {
+    MessageLogRecovery* rec;
+    size_t index;
+} MessageLogScanTask;
+
+static void message_log_recovery_task(void* payload) {
+    MessageLogScanTask* task = (MessageLogScanTask*)payload;
+    atomic_fetch_add(&task->rec->records, message_log_scan(task->rec, task->index));
+}
+
+/* Map segment sequence for writing, creating and preallocating it if needed.
+ * Returns 0 on success */
+static int message_log_map(MessageLog* log, uint64_t sequence, int create) {
+    char path[512];
+    message_log_path(path, sizeof(path), log->opts.dir, sequence);
+    size_t size = MSGLOG_HEADER_SIZE + log->capacity * sizeof(MessageLogRecord);
+    int fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+    if (fd < 0) {
+        logError("Message log segment open failed");
+        return -1;
+    }
+    // Reserve every block now: a store into a hole of a shared mapping on a full disk raises SIGBUS
+    int err = posix_fallocate(fd, 0, (off_t)size);
+    if (err != 0) {
+        errno = err;
+        logError("Message log segment allocation failed");
+        close(fd);
+        if (create) unlink(path);
+        return -1;
+    }
+    char* map = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        logError("Message log segment mmap failed");
+        close(fd);
+        if (create) unlink(path);  // Otherwise O_EXCL fails on every retry of this sequence number
+        return -1;
+    }
+    if (create) {
+        MessageLogHeader* header = (MessageLogHeader*)map;
+        memset(header, 0, sizeof(*header));
+        header->magic = MSGLOG_MAGIC;
+        header->version = MSGLOG_VERSION;
+        header->record_size = sizeof(MessageLogRecord);
+        header->sequence = sequence;
+        header->capacity = log->capacity;
+    }
+    log->fd = fd;
+    log->map = map;
+    log->sequence = sequence;
+    return 0;
+}
+
+/* msync the records written since the last sync */
+static void message_log_sync(MessageLog* log) {
+    if (log->fd < 0 || log->synced == log->count) return;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t from = MSGLOG_HEADER_SIZE + log->synced * sizeof(MessageLogRecord);
+    size_t to = MSGLOG_HEADER_SIZE + log->count * sizeof(MessageLogRecord);
+    from -= from % page;  // msync needs a page-aligned start
+    if (msync(log->map + from, to - from, MS_SYNC) < 0) {
+        logError("Message log msync failed");
+    }
+    log->synced = log->count;
+    log->syncs++;
+    log->last_sync_ns = monotonic_ns();
+}
+
+/* Unmap the open segment */
+static void message_log_unmap(MessageLog* log) {
+    if (log->fd < 0) return;
+    munmap(log->map, MSGLOG_HEADER_SIZE + log->capacity * sizeof(MessageLogRecord));
+    close(log->fd);
+    log->fd = -1;
+    log->map = NULL;
+}
+
+/* Seal the full segment and continue in a new one, dropping the oldest beyond max_segments.
+ * If the new segment cannot be created, count stays at capacity and the next call retries */
+static int message_log_rotate(MessageLog* log) {
+    if (log->map) {
+        if (log->opts.sync != MSGLOG_SYNC_NONE) {
+            message_log_sync(log);  // Every record is durable before the seal claims so
+        }
+        ((MessageLogHeader*)log->map)->sealed = log->count;
+        message_log_unmap(log);
+        log->rotations++;
+    }
+    if (message_log_map(log, log->sequence + 1, 1) < 0) {
+        return -1;
+    }
+    log->count = 0;
+    log->synced = 0;
+    while (log->opts.max_segments > 0 && log->sequence - log->oldest + 1 > log->opts.max_segments) {
+        char path[512];
+        message_log_path(path, sizeof(path), log->opts.dir, log->oldest++);
+        unlink(path);
+    }
+    return 0;
+}
+
+/* Open the log directory, rebuild the store from every segment in parallel and
+ * open a segment for appending: the last one if it has room, else a new one.
+ * Returns 0 on success, -1 if the log cannot be used */
+int message_log_open(MessageLog* log, const MessageLogOptions* opts, ShardedStore* store, size_t reserve_cap) {
+    memset(log, 0, sizeof(*log));
+    log->opts = *opts;
+    log->fd = -1;
+    log->capacity = (opts->segment_bytes > MSGLOG_HEADER_SIZE ? opts->segment_bytes - MSGLOG_HEADER_SIZE : 0) /
+                    sizeof(MessageLogRecord);
+    if (log->capacity == 0) log->capacity = 1;
+    if (mkdir(opts->dir, 0755) < 0 && errno != EEXIST) {
+        logError("Message log directory creation failed");
+        return -1;
+    }
+
+    uint64_t* seqs = NULL;
+    size_t count = message_log_list(opts->dir, &seqs);
+    int64_t start = monotonic_ns();
+    if (count > 0) {
+        // Size the store once for what the segments can hold, instead of growing it step by step
+        size_t estimate = 0;
+        for (size_t i = 0; i < count; i++) {
+            estimate += log->capacity;
+        }
+        store_reserve(store, reserve_cap > 0 && estimate > reserve_cap ? reserve_cap : estimate);
+
+        MessageLogRecovery rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.log = log;
+        rec.store = store;
+        rec.seqs = seqs;
+        rec.count = count;
+        rec.tails = (size_t*)calloc(count, sizeof(size_t));
+        rec.now_ns = start;
+        atomic_init(&rec.records, 0);
+        atomic_init(&rec.max_id, 0);
+        size_t threads = opts->recovery_threads;
+        if (threads == 0) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            threads = cpus > 0 ? (size_t)cpus : 1;
+        }
+        if (threads > count) threads = count;
+        if (threads > MSGLOG_MAX_RECOVERY_THREADS) threads = MSGLOG_MAX_RECOVERY_THREADS;
+        // The calling thread scans too, so the executor gets one worker less
+        Executor* exec = threads > 1 ? executor_create(threads - 1, count) : NULL;
+        for (size_t i = 0; i < count; i++) {
+            MessageLogScanTask task = {&rec, i};
+            if (!exec || !executor_submit(exec, message_log_recovery_task, &task, sizeof(task))) {
+                message_log_recovery_task(&task);
+            }
+        }
+        if (exec) {
+            executor_wait_idle(exec);
+            executor_destroy(exec);
+        }
+        log->recovered = atomic_load(&rec.records);
+        log->recovered_max_id = atomic_load(&rec.max_id);
+        log->recovered_segments = count;
+        log->oldest = seqs[0];
+        log->sequence = seqs[count - 1];
+        log->count = rec.tails[count - 1];
+        free(rec.tails);
+    }
+    log->recovery_ns = monotonic_ns() - start;
+
+    // Keep appending to the last segment unless it is full or unreadable
+    int reopened = count > 0 && log->count < log->capacity && message_log_map(log, log->sequence, 0) == 0 &&
+                   ((MessageLogHeader*)log->map)->magic == MSGLOG_MAGIC &&
+                   ((MessageLogHeader*)log->map)->capacity == log->capacity;
+    if (!reopened) {
+        message_log_unmap(log);
+        log->count = 0;
+        if (count == 0) log->oldest = 1;
+        if (message_log_map(log, count > 0 ? log->sequence + 1 : 1, 1) < 0) {
+            free(seqs);
+            return -1;
+        }
+    }
+    free(seqs);
+    log->synced = log->count;
+    log->last_sync_ns = monotonic_ns();
+    log->ring = mpsc_ring_create(opts->queue_capacity);
+    return 0;
+}
+
+/* Queue an accepted message for the writer. Never blocks: returns 0 and drops
+ * the append if the writer is too far behind */
+static inline int message_log_append(MessageLog* log, const Message* msg, int64_t now_ns) {
+    if (mpsc_ring_push(log->ring, msg, now_ns)) return 1;
+    atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+    return 0;
+}
+
+/* Copy a batch into the open segment, rotating as segments fill.
+ * Returns the number of records dropped because no new segment could be allocated */
+static size_t message_log_write(MessageLog* log, const Message* msgs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (log->count == log->capacity) {
+            if (monotonic_ns() < log->retry_ns) return count - i;
+            if (message_log_rotate(log) < 0) {
+                log->retry_ns = monotonic_ns() + NSEC_PER_SEC;  // Retry once a second until space is freed
+                return count - i;
+            }
+            log->retry_ns = 0;
+        }
+        MessageLogRecord* rec = (MessageLogRecord*)(log->map + MSGLOG_HEADER_SIZE) + log->count;
+        MessageLogRecord tmp;
+        memset(&tmp, 0, sizeof(tmp));
+        tmp.id = msgs[i].MessageId;
+        tmp.data = msgs[i].MessageData;
+        tmp.type = msgs[i].MessageType;
+        tmp.check = message_log_check(&tmp);
+        *rec = tmp;
+        log->count++;
+        log->appended++;
+    }
+    return 0;
+}
+
+/* Writer thread function: drain the ring into the segments until it is closed and empty */
+void* messageLogThread(void* arg) {
+    MessageLog* log = (MessageLog*)arg;
+    Message batch[MSGLOG_WRITE_BATCH];
+    for (;;) {
+        int64_t timeout = -1;
+        if (log->opts.sync == MSGLOG_SYNC_INTERVAL && log->synced != log->count) {
+            timeout = log->last_sync_ns + log->opts.sync_interval_ns - monotonic_ns();
+            if (timeout < 0) timeout = 0;
+        }
+        size_t count = mpsc_ring_pop_wait(log->ring, batch, NULL, MSGLOG_WRITE_BATCH, timeout);
+        if (count > 0) {
+            size_t lost = message_log_write(log, batch, count);
+            if (lost > 0 && !log->failing) {
+                alog_write(LOG_LEVEL_ERROR, "Message log", 0,
+                           "no new segment could be allocated, dropping appends until one can", 0, 0, 0);
+            } else if (lost == 0 && log->failing) {
+                alog_info("Message log", "new segment allocated, %lu appends were dropped meanwhile", log->lost, 0, 0);
+            }
+            log->failing = lost > 0;
+            log->lost += lost;
+            if (log->metrics) {
+                metrics_add(log->metrics, METRIC_LOG_APPENDED, count - lost);
+                metrics_add(log->metrics, METRIC_LOG_LOST, lost);
+            }
+        }
+        if (log->opts.sync == MSGLOG_SYNC_BATCH ||
+            (log->opts.sync == MSGLOG_SYNC_INTERVAL &&
+             monotonic_ns() - log->last_sync_ns >= log->opts.sync_interval_ns)) {
+            message_log_sync(log);
+        }
+        if (count == 0 && mpsc_ring_finished(log->ring)) break;
+    }
+    if (log->opts.sync != MSGLOG_SYNC_NONE) {
+        message_log_sync(log);
+    }
+    return NULL;
+}
+
+/* Unmap the open segment and free the ring. Call after the writer thread has exited */
+void message_log_close(MessageLog* log) {
+    message_log_unmap(log);
+    if (log->ring) {
+        mpsc_ring_destroy(log->ring);
+        log->ring = NULL;
+    }
+}
+
+#endif // MESSAGE_LOG_H
@@ -0,0 +1,115 @@
+#ifndef MESSAGE_SINK_H
+#define MESSAGE_SINK_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log_error.h"
+#include "message.h"
+#include "wire_codec.h"
+
+/* Destination of decoded messages in tcp_receiver. Writers hand over whole
+ * batches; each batch is formatted or encoded into the caller's scratch buffer
+ * without holding any lock and then written with one fwrite, so concurrent
+ * connections only serialize on that single call.
+ *
+ *   stdout       one "Received via TCP: ID=..., Data=..." line per message
+ *   count        count messages only
+ *   file:<path>  append messages as wire frames (WIRE_FRAME_SIZE bytes each) */
+
+#define SINK_LINE_MAX 80  // Upper bound of one formatted stdout line
+
+typedef enum {
+    SINK_STDOUT,
+    SINK_COUNT,
+    SINK_FILE,
+} MessageSinkKind;
+
+typedef struct {
+    MessageSinkKind kind;
+    FILE* out;                  // stdout or the opened file, NULL for count
+    pthread_mutex_t lock;       // Keeps batches from different threads whole
+    _Atomic uint64_t messages;  // Messages written
+    _Atomic uint64_t batches;   // Batches written
+} MessageSink;
+
+/* Open a sink from its spec ("stdout", "count" or "file:<path>"). Returns 0 on success */
+int message_sink_open(MessageSink* sink, const char* spec) {
+    memset(sink, 0, sizeof(*sink));
+    pthread_mutex_init(&sink->lock, NULL);
+    atomic_init(&sink->messages, 0);
+    atomic_init(&sink->batches, 0);
+    if (strcmp(spec, "stdout") == 0) {
+        sink->kind = SINK_STDOUT;
+        sink->out = stdout;
+        setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+    } else if (strcmp(spec, "count") == 0) {
+        sink->kind = SINK_COUNT;
+    } else if (strncmp(spec, "file:", 5) == 0) {
+        sink->kind = SINK_FILE;
+        sink->out = fopen(spec + 5, "ab");
+        if (!sink->out) {
+            logError("Sink file open failed");
+            return -1;
+        }
+        setvbuf(sink->out, NULL, _IOFBF, 1 << 20);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* Scratch bytes a writer needs for batches of up to max_batch messages */
+size_t message_sink_scratch_size(size_t max_batch) {
+    return max_batch * SINK_LINE_MAX;
+}
+
+/* Write a batch. scratch must hold message_sink_scratch_size(count) bytes */
+void message_sink_write(MessageSink* sink, const Message* msgs, size_t count, char* scratch) {
+    if (count == 0) return;
+    atomic_fetch_add_explicit(&sink->messages, count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sink->batches, 1, memory_order_relaxed);
+    size_t len = 0;
+    switch (sink->kind) {
+        case SINK_COUNT:
+            return;
+        case SINK_STDOUT:
+            for (size_t i = 0; i < count; i++) {
+                len += (size_t)snprintf(scratch + len, SINK_LINE_MAX, "Received via TCP: ID=%lu, Data=%lu\n",
+                                        msgs[i].MessageId, msgs[i].MessageData);
+            }
+            break;
+        case SINK_FILE:
+            for (size_t i = 0; i < count; i++) {
+                wire_encode((uint8_t*)scratch + len, &msgs[i]);
+                len += WIRE_FRAME_SIZE;
+            }
+            break;
+    }
+    pthread_mutex_lock(&sink->lock);
+    fwrite(scratch, 1, len, sink->out);
+    pthread_mutex_unlock(&sink->lock);
+}
+
+/* Flush buffered output */
+void message_sink_flush(MessageSink* sink) {
+    if (!sink->out) return;
+    pthread_mutex_lock(&sink->lock);
+    fflush(sink->out);
+    pthread_mutex_unlock(&sink->lock);
+}
+
+/* Flush and close the sink */
+void message_sink_close(MessageSink* sink) {
+    message_sink_flush(sink);
+    if (sink->kind == SINK_FILE) {
+        fclose(sink->out);
+    }
+    sink->out = NULL;
+    pthread_mutex_destroy(&sink->lock);
+}
+
+#endif // MESSAGE_SINK_H
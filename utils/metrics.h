@@ -0,0 +1,328 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "histogram.h"
+#include "time_utils.h"
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+/* Per-stage counters and latency histograms.
+ *
+ * Every thread that does work registers a MetricsThread and is its only writer:
+ * updates are a relaxed load and store of its own cache lines, with no atomic
+ * read-modify-write and no sharing. An aggregator periodically sums all threads
+ * into a MetricsSnapshot; it may read a value one update old, never a torn one.
+ * Gauges such as queue depth are sampled by callbacks during aggregation. */
+
+#define METRICS_NAME_LEN 64  // Room for a prefix such as "queue_depth_" plus a ROUTE_NAME_LEN endpoint name
+#define METRICS_MAX_GAUGES 32
+
+typedef enum {
+    METRIC_RX_DATAGRAMS,    // Datagrams returned by recvmmsg
+    METRIC_RX_BYTES,        // Payload bytes of those datagrams
+    METRIC_RX_BATCHES,      // recvmmsg calls that returned data
+    METRIC_RX_INVALID,      // Datagrams dropped as short, truncated or of unknown version
+    METRIC_KERNEL_DROPS,    // Datagrams the kernel dropped before we read them (SO_RXQ_OVFL)
+    METRIC_DUPLICATES,      // Messages skipped as already seen
+    METRIC_STORE_INSERTS,   // New messages inserted into the store
+    METRIC_ENQUEUED,        // Messages pushed onto an output ring
+    METRIC_QUEUE_FULL,      // Push attempts that found an output ring full
+    METRIC_TX_MESSAGES,     // Messages fully written to a downstream connection
+    METRIC_TX_BYTES,        // Bytes written downstream
+    METRIC_SEND_CALLS,      // send() syscalls
+    METRIC_SEND_EAGAIN,     // send() calls that found the socket buffer full
+    METRIC_RECONNECTS,      // Downstream reconnects
+    METRIC_LOG_APPENDED,    // Records written to the durable message log
+    METRIC_LOG_DROPPED,     // Appends dropped because the message log writer was behind
+    METRIC_LOG_LOST,        // Appends dropped because no new log segment could be allocated (disk full)
+    METRIC_SEQ_GAPS,        // IDs skipped on a receiver's line (sequence dedup mode)
+    METRIC_SEQ_LATE,        // IDs that arrived below the highest ID already seen on their line
+    METRIC_SEQ_OUTSIDE,     // IDs below the sequence window's recovery floor, checked in the hash store
+    METRIC_SEQ_EXPIRED,     // IDs whose block had left the sequence window, dropped as late duplicates
+    METRIC_QUEUE_BLOCKED,   // Messages a receiver held back while their output was throttled (block policy)
+    METRIC_QUEUE_DROP_NEWEST,  // Messages discarded instead of queued (drop-newest policy or a full ring)
+    METRIC_QUEUE_DROP_OLDEST,  // Queued messages discarded to make room (drop-oldest, or spill file full)
+    METRIC_QUEUE_SPILLED,   // Queued messages moved to the spill file
+    METRIC_QUEUE_REPLAYED,  // Spilled messages read back and queued for sending
+    METRIC_REBALANCED,      // Messages sent to another endpoint of their output because theirs was down
+    METRIC_COUNTERS
+} MetricCounter;
+
+typedef enum {
+    METRIC_HIST_BATCH_NS,        // Receive-to-queued time of one recvmmsg batch
+    METRIC_HIST_QUEUE_TO_SEND,   // Batch pickup (the ring enqueue stamp) to the send() that wrote the message
+    METRIC_HISTOGRAMS
+} MetricHistogram;
+
+static const char* const metric_counter_names[METRIC_COUNTERS] = {
+    "rx_datagrams", "rx_bytes", "rx_batches", "rx_invalid", "kernel_drops", "duplicates", "store_inserts",
+    "enqueued", "queue_full", "tx_messages", "tx_bytes", "send_calls", "send_eagain", "reconnects",
+    "msglog_appended", "msglog_dropped", "msglog_lost", "seq_line_gaps", "seq_line_late", "seq_outside_window", "seq_expired",
+    "queue_blocked", "queue_drop_newest", "queue_drop_oldest", "queue_spilled", "queue_replayed", "rebalanced",
+};
+
+static const char* const metric_histogram_names[METRIC_HISTOGRAMS] = {
+    "batch_ns", "queue_to_send_ns",
+};
+
+/* Histogram written by one thread and read by the aggregator */
+typedef struct {
+    _Atomic uint64_t counts[HISTOGRAM_BUCKETS];
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+} MetricsHistogram;
+
+/* Metrics of one thread */
+typedef struct MetricsThread {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t counters[METRIC_COUNTERS];
+    MetricsHistogram hists[METRIC_HISTOGRAMS];
+    char name[METRICS_NAME_LEN];   // Thread name in the per-thread breakdown
+    struct MetricsThread* next;    // Next registered thread
+} MetricsThread;
+
+/* Sampled value such as a queue depth or the store size */
+typedef uint64_t (*MetricsGaugeFn)(void* ctx);
+
+typedef struct {
+    char name[METRICS_NAME_LEN];
+    MetricsGaugeFn fn;
+    void* ctx;
+} MetricsGauge;
+
+/* Registry of every thread and gauge */
+typedef struct {
+    pthread_mutex_t lock;                    // Protects the lists below
+    MetricsThread* threads;                  // Registered threads, newest first
+    size_t num_threads;
+    MetricsGauge gauges[METRICS_MAX_GAUGES];
+    size_t num_gauges;
+} MetricsRegistry;
+
+MetricsRegistry metricsRegistry = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* Aggregated view of all threads at one point in time */
+typedef struct {
+    int64_t time_ns;                         // Monotonic time of the snapshot
+    uint64_t counters[METRIC_COUNTERS];      // Sums over all threads
+    Histogram hists[METRIC_HISTOGRAMS];      // Merged histograms since start
+    uint64_t gauges[METRICS_MAX_GAUGES];     // Sampled gauge values
+    size_t num_gauges;
+} MetricsSnapshot;
+
+/* Register the calling thread's metrics. The block stays alive until metrics_destroy,
+ * so totals of finished threads keep counting. Returns NULL if out of memory. */
+MetricsThread* metrics_thread_register(const char* name) {
+    MetricsThread* t = (MetricsThread*)aligned_alloc(CACHE_LINE_SIZE, sizeof(MetricsThread));
+    if (!t) return NULL;
+    memset(t, 0, sizeof(*t));
+    snprintf(t->name, sizeof(t->name), "%s", name ? name : "thread");
+    pthread_mutex_lock(&metricsRegistry.lock);
+    t->next = metricsRegistry.threads;
+    metricsRegistry.threads = t;
+    metricsRegistry.num_threads++;
+    pthread_mutex_unlock(&metricsRegistry.lock);
+    return t;
+}
+
+/* Register a gauge sampled on every aggregation. Returns 0 on success */
+int metrics_gauge_register(const char* name, MetricsGaugeFn fn, void* ctx) {
+    pthread_mutex_lock(&metricsRegistry.lock);
+    if (metricsRegistry.num_gauges >= METRICS_MAX_GAUGES) {
+        pthread_mutex_unlock(&metricsRegistry.lock);
+        return -1;
+    }
+    MetricsGauge* g = &metricsRegistry.gauges[metricsRegistry.num_gauges++];
+    snprintf(g->name, sizeof(g->name), "%s", name);
+    g->fn = fn;
+    g->ctx = ctx;
+    pthread_mutex_unlock(&metricsRegistry.lock);
+    return 0;
+}
+
+/* Free every thread block and forget the gauges. No thread may update metrics afterwards */
+void metrics_destroy(void) {
+    pthread_mutex_lock(&metricsRegistry.lock);
+    MetricsThread* t = metricsRegistry.threads;
+    while (t) {
+        MetricsThread* next = t->next;
+        free(t);
+        t = next;
+    }
+    metricsRegistry.threads = NULL;
+    metricsRegistry.num_threads = 0;
+    metricsRegistry.num_gauges = 0;
+    pthread_mutex_unlock(&metricsRegistry.lock);
+}
+
+/* Single-writer increment: no locked instruction, just a relaxed load and store */
+static inline void metrics_add(MetricsThread* t, MetricCounter c, uint64_t n) {
+    atomic_store_explicit(&t->counters[c], atomic_load_explicit(&t->counters[c], memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static inline void metrics_bump(_Atomic uint64_t* v, uint64_t n) {
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/* Record one sample in a histogram of the calling thread */
+static inline void metrics_record(MetricsThread* t, MetricHistogram h, uint64_t value) {
+    MetricsHistogram* mh = &t->hists[h];
+    metrics_bump(&mh->counts[histogram_index(value)], 1);
+    metrics_bump(&mh->sum, value);
+    if (value > atomic_load_explicit(&mh->max, memory_order_relaxed)) {
+        atomic_store_explicit(&mh->max, value, memory_order_relaxed);
+    }
+}
+
+static void metrics_histogram_merge(Histogram* dst, const MetricsHistogram* src) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        uint64_t n = atomic_load_explicit(&src->counts[i], memory_order_relaxed);
+        if (n == 0) continue;
+        dst->counts[i] += n;
+        total += n;
+        uint64_t value = histogram_bucket_value(i);
+        if (value < dst->min) dst->min = value;
+    }
+    // Total is counted from the buckets so percentile targets always match them
+    dst->total += total;
+    dst->sum += (double)atomic_load_explicit(&src->sum, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&src->max, memory_order_relaxed);
+    if (max > dst->max) dst->max = max;
+}
+
+/* Sum every registered thread and sample every gauge into snap */
+void metrics_collect(MetricsSnapshot* snap) {
+    memset(snap->counters, 0, sizeof(snap->counters));
+    for (size_t h = 0; h < METRIC_HISTOGRAMS; h++) {
+        histogram_reset(&snap->hists[h]);
+    }
+    pthread_mutex_lock(&metricsRegistry.lock);
+    for (MetricsThread* t = metricsRegistry.threads; t; t = t->next) {
+        for (size_t c = 0; c < METRIC_COUNTERS; c++) {
+            snap->counters[c] += atomic_load_explicit(&t->counters[c], memory_order_relaxed);
+        }
+        for (size_t h = 0; h < METRIC_HISTOGRAMS; h++) {
+            metrics_histogram_merge(&snap->hists[h], &t->hists[h]);
+        }
+    }
+    snap->num_gauges = metricsRegistry.num_gauges;
+    for (size_t g = 0; g < snap->num_gauges; g++) {
+        snap->gauges[g] = metricsRegistry.gauges[g].fn(metricsRegistry.gauges[g].ctx);
+    }
+    pthread_mutex_unlock(&metricsRegistry.lock);
+    snap->time_ns = monotonic_ns();
+}
+
+/* Growable text buffer for the renderers */
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} MetricsBuffer;
+
+static void metrics_printf(MetricsBuffer* out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void metrics_printf(MetricsBuffer* out, const char* fmt, ...) {
+    for (;;) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(out->data + out->len, out->cap - out->len, fmt, args);
+        va_end(args);
+        if (n < 0) return;
+        if (out->len + (size_t)n < out->cap) {
+            out->len += (size_t)n;
+            return;
+        }
+        out->cap = (out->cap + (size_t)n + 1) * 2;
+        out->data = (char*)realloc(out->data, out->cap);
+    }
+}
+
+void metrics_buffer_init(MetricsBuffer* out) {
+    out->cap = 4096;
+    out->len = 0;
+    out->data = (char*)malloc(out->cap);
+    out->data[0] = '\0';
+}
+
+void metrics_buffer_destroy(MetricsBuffer* out) {
+    free(out->data);
+    out->data = NULL;
+}
+
+/* Render snap as one JSON line. Rates are per second over the interval since prev (may be NULL) */
+void metrics_render_json(MetricsBuffer* out, const MetricsSnapshot* snap, const MetricsSnapshot* prev) {
+    double seconds = prev ? (double)(snap->time_ns - prev->time_ns) / NSEC_PER_SEC : 0.0;
+    metrics_printf(out, "{\"time_ns\":%ld,\"counters\":{", (long)snap->time_ns);
+    for (size_t c = 0; c < METRIC_COUNTERS; c++) {
+        metrics_printf(out, "%s\"%s\":%lu", c ? "," : "", metric_counter_names[c], snap->counters[c]);
+    }
+    metrics_printf(out, "},\"rates\":{");
+    for (size_t c = 0; c < METRIC_COUNTERS; c++) {
+        double rate = seconds > 0 ? (double)(snap->counters[c] - prev->counters[c]) / seconds : 0.0;
+        metrics_printf(out, "%s\"%s\":%.0f", c ? "," : "", metric_counter_names[c], rate);
+    }
+    metrics_printf(out, "},\"gauges\":{");
+    for (size_t g = 0; g < snap->num_gauges; g++) {
+        metrics_printf(out, "%s\"%s\":%lu", g ? "," : "", metricsRegistry.gauges[g].name, snap->gauges[g]);
+    }
+    metrics_printf(out, "},\"histograms\":{");
+    for (size_t h = 0; h < METRIC_HISTOGRAMS; h++) {
+        const Histogram* hist = &snap->hists[h];
+        metrics_printf(out, "%s\"%s\":{\"count\":%lu,\"mean\":%.0f,\"p50\":%lu,\"p99\":%lu,\"p999\":%lu,\"max\":%lu}",
+                       h ? "," : "", metric_histogram_names[h], hist->total, histogram_mean(hist),
+                       histogram_percentile(hist, 0.5), histogram_percentile(hist, 0.99),
+                       histogram_percentile(hist, 0.999), hist->total ? hist->max : 0);
+    }
+    // Per-thread counters show which receiver or transmitter is saturating
+    metrics_printf(out, "},\"threads\":[");
+    pthread_mutex_lock(&metricsRegistry.lock);
+    for (MetricsThread* t = metricsRegistry.threads; t; t = t->next) {
+        metrics_printf(out, "%s{\"name\":\"%s\"", t == metricsRegistry.threads ? "" : ",", t->name);
+        for (size_t c = 0; c < METRIC_COUNTERS; c++) {
+            uint64_t v = atomic_load_explicit(&t->counters[c], memory_order_relaxed);
+            if (v) metrics_printf(out, ",\"%s\":%lu", metric_counter_names[c], v);
+        }
+        metrics_printf(out, "}");
+    }
+    pthread_mutex_unlock(&metricsRegistry.lock);
+    metrics_printf(out, "]}\n");
+}
+
+/* Render snap as "name value" lines, one metric per line */
+void metrics_render_text(MetricsBuffer* out, const MetricsSnapshot* snap) {
+    for (size_t c = 0; c < METRIC_COUNTERS; c++) {
+        metrics_printf(out, "mt_%s %lu\n", metric_counter_names[c], snap->counters[c]);
+    }
+    for (size_t g = 0; g < snap->num_gauges; g++) {
+        metrics_printf(out, "mt_%s %lu\n", metricsRegistry.gauges[g].name, snap->gauges[g]);
+    }
+    for (size_t h = 0; h < METRIC_HISTOGRAMS; h++) {
+        const Histogram* hist = &snap->hists[h];
+        metrics_printf(out, "mt_%s_count %lu\n", metric_histogram_names[h], hist->total);
+        metrics_printf(out, "mt_%s{quantile=\"0.5\"} %lu\n", metric_histogram_names[h], histogram_percentile(hist, 0.5));
+        metrics_printf(out, "mt_%s{quantile=\"0.99\"} %lu\n", metric_histogram_names[h], histogram_percentile(hist, 0.99));
+        metrics_printf(out, "mt_%s{quantile=\"0.999\"} %lu\n", metric_histogram_names[h], histogram_percentile(hist, 0.999));
+        metrics_printf(out, "mt_%s_max %lu\n", metric_histogram_names[h], hist->total ? hist->max : 0);
+    }
+    pthread_mutex_lock(&metricsRegistry.lock);
+    for (MetricsThread* t = metricsRegistry.threads; t; t = t->next) {
+        for (size_t c = 0; c < METRIC_COUNTERS; c++) {
+            uint64_t v = atomic_load_explicit(&t->counters[c], memory_order_relaxed);
+            if (v) metrics_printf(out, "mt_%s{thread=\"%s\"} %lu\n", metric_counter_names[c], t->name, v);
+        }
+    }
+    pthread_mutex_unlock(&metricsRegistry.lock);
+}
+
+#endif // METRICS_H
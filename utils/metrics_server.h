@@ -0,0 +1,187 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "event_loop.h"
+#include "log_error.h"
+#include "metrics.h"
+
+/* Metrics export thread: aggregates every interval_ms, appends one JSON line per
+ * interval to a file, and answers plain HTTP requests on a localhost port:
+ *   GET /metrics       "name value" text
+ *   GET /metrics.json  the latest JSON snapshot
+ * Each request is served inline and the connection closed, which is enough for
+ * a scraper or curl and keeps the exporter to one thread. */
+
+#define METRICS_REQUEST_MAX 1024
+
+typedef struct {
+    int port;                 // Localhost HTTP port, 0 = no endpoint (MT_METRICS_PORT)
+    const char* path;         // JSON lines file, NULL = no dump (MT_METRICS_FILE)
+    int64_t interval_ms;      // Aggregation interval (MT_METRICS_INTERVAL_MS)
+} MetricsServerOptions;
+
+typedef struct {
+    MetricsServerOptions opts;
+    EventLoop loop;               // Serves the listener and the shutdown fd
+    EventHandler listener;        // Listening socket, fd -1 without an endpoint
+    FILE* dump;                   // Open JSON lines file, or NULL
+    MetricsSnapshot current;      // Latest aggregation
+    MetricsSnapshot previous;     // Aggregation before that, for rates
+    MetricsBuffer json;           // Rendered current snapshot
+    uint64_t requests;            // Requests answered
+} MetricsServer;
+
+/* Write all of buf to a blocking socket */
+static void metrics_send_all(int sock, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(sock, buf, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+/* Read one request, answer it and close the connection */
+static void metrics_serve_client(MetricsServer* server, int sock) {
+    char request[METRICS_REQUEST_MAX];
+    size_t len = 0;
+    while (len < sizeof(request) - 1 && !memmem(request, len, "\r\n\r\n", 4)) {
+        if (!(event_wait_fd(sock, POLLIN, -1, 100) & POLLIN)) break;  // Slow clients get 100ms per read
+        ssize_t n = recv(sock, request + len, sizeof(request) - 1 - len, 0);
+        if (n <= 0) break;
+        len += (size_t)n;
+    }
+    request[len] = '\0';
+
+    MetricsBuffer body;
+    metrics_buffer_init(&body);
+    const char* status = "200 OK";
+    const char* type = "text/plain";
+    if (strncmp(request, "GET /metrics.json", 17) == 0) {
+        metrics_printf(&body, "%s", server->json.data);
+        type = "application/json";
+    } else if (strncmp(request, "GET /metrics", 12) == 0 || strncmp(request, "GET / ", 6) == 0) {
+        metrics_render_text(&body, &server->current);
+    } else {
+        status = "404 Not Found";
+        metrics_printf(&body, "try /metrics or /metrics.json\n");
+    }
+    char header[160];
+    int hlen = snprintf(header, sizeof(header),
+                        "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                        status, type, body.len);
+    metrics_send_all(sock, header, (size_t)hlen);
+    metrics_send_all(sock, body.data, body.len);
+    metrics_buffer_destroy(&body);
+    close(sock);
+    server->requests++;
+}
+
+/* Listener readable: serve every pending connection */
+static void metrics_on_listener(void* ctx, uint32_t events) {
+    MetricsServer* server = (MetricsServer*)ctx;
+    (void)events;
+    for (;;) {
+        int sock = accept(server->listener.fd, NULL, NULL);
+        if (sock < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                logError("Metrics accept failed");
+            }
+            return;
+        }
+        metrics_serve_client(server, sock);
+    }
+}
+
+/* Aggregate, render and append to the dump file */
+void metrics_server_update(MetricsServer* server) {
+    server->previous = server->current;
+    metrics_collect(&server->current);
+    server->json.len = 0;
+    metrics_render_json(&server->json, &server->current, &server->previous);
+    if (server->dump) {
+        fwrite(server->json.data, 1, server->json.len, server->dump);
+        fflush(server->dump);
+    }
+}
+
+/* Open the endpoint and dump file. Returns 0 on success */
+int metrics_server_init(MetricsServer* server, const MetricsServerOptions* opts, int shutdown_fd) {
+    memset(server, 0, sizeof(*server));
+    server->opts = *opts;
+    if (server->opts.interval_ms <= 0) server->opts.interval_ms = 1000;
+    server->listener.fd = -1;
+    if (event_loop_init(&server->loop, shutdown_fd) < 0) {
+        return -1;
+    }
+    metrics_buffer_init(&server->json);
+    metrics_collect(&server->current);
+
+    if (opts->path) {
+        server->dump = fopen(opts->path, "a");
+        if (!server->dump) {
+            logError("Metrics file open failed");
+        }
+    }
+    if (opts->port > 0) {
+        int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)opts->port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // Local only
+        if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 16) < 0) {
+            logError("Metrics endpoint bind failed");
+            if (sock >= 0) close(sock);
+        } else {
+            server->listener.fd = sock;
+            server->listener.callback = metrics_on_listener;
+            server->listener.ctx = server;
+            event_loop_add(&server->loop, &server->listener, EPOLLIN);
+        }
+    }
+    return 0;
+}
+
+/* Close the endpoint and dump file */
+void metrics_server_destroy(MetricsServer* server) {
+    if (server->listener.fd >= 0) close(server->listener.fd);
+    if (server->dump) fclose(server->dump);
+    event_loop_destroy(&server->loop);
+    metrics_buffer_destroy(&server->json);
+}
+
+/* Thread function: serve requests and aggregate every interval until the shutdown fd fires.
+ * Call metrics_server_update once more after the other threads are joined for final totals. */
+void* metricsServerThread(void* arg) {
+    MetricsServer* server = (MetricsServer*)arg;
+    int64_t interval_ns = server->opts.interval_ms * NSEC_PER_MSEC;
+    int64_t next_tick = monotonic_ns() + interval_ns;
+    while (!server->loop.stopped) {
+        int64_t remaining = next_tick - monotonic_ns();
+        if (remaining <= 0) {
+            metrics_server_update(server);
+            next_tick += interval_ns;
+            continue;
+        }
+        if (event_loop_run_once(&server->loop, (int)((remaining + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC)) < 0) break;
+    }
+    return NULL;
+}
+
+#endif // METRICS_SERVER_H
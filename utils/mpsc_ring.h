@@ -0,0 +1,192 @@
+#ifndef MPSC_RING_H
+#define MPSC_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "message.h"
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#define MPSC_RING_SPIN 512  // Empty polls before the consumer parks on the futex
+
+/* Hint to the CPU that we are in a spin-wait loop */
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* One ring slot. seq tells producers and the consumer who owns the slot:
+ * seq == pos means free for the producer claiming pos,
+ * seq == pos + 1 means filled and ready for the consumer. */
+typedef struct {
+    _Atomic size_t seq;
+    Message msg;
+    int64_t stamp;  // Enqueue time given by the producer, for queue latency
+} MpscRingSlot;
+
+/* Bounded lock-free multi-producer/single-consumer ring of Messages.
+ * Producer and consumer indices live on separate cache lines. */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t tail;      // Next position claimed by producers
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t head;      // Next position read by the consumer
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t wake_seq; // Futex word bumped to wake the consumer
+    _Atomic uint32_t sleeping;                           // Set while the consumer is parked
+    _Atomic int closed;                                  // Set once no more pushes will come
+    MpscRingSlot* slots;                                 // capacity slots
+    size_t capacity;                                     // Number of slots (power of two)
+    size_t mask;                                         // capacity - 1
+} MpscRing;
+
+/* Create a ring with at least the requested capacity (rounded up to a power of two) */
+MpscRing* mpsc_ring_create(size_t capacity) {
+    size_t cap = 2;
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+    MpscRing* ring = (MpscRing*)aligned_alloc(CACHE_LINE_SIZE, sizeof(MpscRing));
+    ring->slots = (MpscRingSlot*)aligned_alloc(CACHE_LINE_SIZE, cap * sizeof(MpscRingSlot));
+    ring->capacity = cap;
+    ring->mask = cap - 1;
+    for (size_t i = 0; i < cap; i++) {
+        atomic_init(&ring->slots[i].seq, i);
+    }
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->wake_seq, 0);
+    atomic_init(&ring->sleeping, 0);
+    atomic_init(&ring->closed, 0);
+    return ring;
+}
+
+/* Destroy the ring (messages still inside are discarded) */
+void mpsc_ring_destroy(MpscRing* ring) {
+    free(ring->slots);
+    free(ring);
+}
+
+/* Wake the consumer if it is parked on the futex */
+static void mpsc_ring_wake(MpscRing* ring) {
+    atomic_thread_fence(memory_order_seq_cst);  // Order the publish before reading sleeping
+    if (atomic_load_explicit(&ring->sleeping, memory_order_relaxed)) {
+        atomic_fetch_add(&ring->wake_seq, 1);
+        syscall(SYS_futex, &ring->wake_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/* Push a copy of msg with its enqueue time. Safe from any number of threads.
+ * Returns 1 on success, 0 if the ring is full. */
+int mpsc_ring_push(MpscRing* ring, const Message* msg, int64_t stamp) {
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    MpscRingSlot* slot;
+    for (;;) {
+        slot = &ring->slots[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;  // Slot still holds an unread message: ring is full
+        } else {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+    slot->msg = *msg;
+    slot->stamp = stamp;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    mpsc_ring_wake(ring);
+    return 1;
+}
+
+/* Check whether a message is ready for the consumer */
+static inline int mpsc_ring_ready(MpscRing* ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    return atomic_load_explicit(&ring->slots[head & ring->mask].seq, memory_order_acquire) == head + 1;
+}
+
+/* Pop up to max messages without blocking. Consumer thread only. Enqueue times go to
+ * stamps unless it is NULL. Returns the number of messages copied into out. */
+size_t mpsc_ring_pop(MpscRing* ring, Message* out, int64_t* stamps, size_t max) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t count = 0;
+    while (count < max) {
+        MpscRingSlot* slot = &ring->slots[head & ring->mask];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != head + 1) break;
+        if (stamps) stamps[count] = slot->stamp;
+        out[count++] = slot->msg;
+        atomic_store_explicit(&slot->seq, head + ring->capacity, memory_order_release);
+        head++;
+    }
+    atomic_store_explicit(&ring->head, head, memory_order_relaxed);
+    return count;
+}
+
+/* Pop up to max messages, spinning briefly and then parking on a futex while empty.
+ * timeout_ns < 0 waits until a message arrives or the ring is closed.
+ * Returns the number of messages popped; 0 means timeout or closed and drained. */
+size_t mpsc_ring_pop_wait(MpscRing* ring, Message* out, int64_t* stamps, size_t max, int64_t timeout_ns) {
+    for (;;) {
+        for (int spin = 0; spin < MPSC_RING_SPIN; spin++) {
+            size_t count = mpsc_ring_pop(ring, out, stamps, max);
+            if (count > 0) return count;
+            if (atomic_load_explicit(&ring->closed, memory_order_acquire)) {
+                return mpsc_ring_pop(ring, out, stamps, max);  // Drain anything pushed before close
+            }
+            cpu_relax();
+        }
+
+        uint32_t seq = atomic_load(&ring->wake_seq);
+        atomic_store(&ring->sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);  // Publish sleeping before the final check
+        if (mpsc_ring_ready(ring) || atomic_load(&ring->closed)) {
+            atomic_store(&ring->sleeping, 0);
+            continue;
+        }
+        struct timespec ts;
+        struct timespec* tsp = NULL;
+        if (timeout_ns >= 0) {
+            ts.tv_sec = timeout_ns / 1000000000;
+            ts.tv_nsec = timeout_ns % 1000000000;
+            tsp = &ts;
+        }
+        syscall(SYS_futex, &ring->wake_seq, FUTEX_WAIT_PRIVATE, seq, tsp, NULL, 0);
+        atomic_store(&ring->sleeping, 0);
+        if (timeout_ns >= 0) {
+            return mpsc_ring_pop(ring, out, stamps, max);
+        }
+    }
+}
+
+/* Mark the ring closed and wake the consumer so it can drain and exit */
+void mpsc_ring_close(MpscRing* ring) {
+    atomic_store(&ring->closed, 1);
+    atomic_fetch_add(&ring->wake_seq, 1);
+    syscall(SYS_futex, &ring->wake_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* Check whether the ring has been closed and fully drained */
+int mpsc_ring_finished(MpscRing* ring) {
+    return atomic_load(&ring->closed) && !mpsc_ring_ready(ring);
+}
+
+/* Approximate number of queued messages */
+size_t mpsc_ring_size(MpscRing* ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+#endif // MPSC_RING_H
@@ -0,0 +1,82 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sched.h>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+/* Minimal epoch-based RCU for read-mostly pointers such as the routing table.
+ *
+ * Readers bracket each use of a protected pointer with rcu_read_lock/unlock,
+ * which only store the current epoch (or 0) into the reader's own cache line.
+ * A writer publishes a new pointer with an atomic exchange, advances the epoch
+ * and then waits in rcu_synchronize until every reader that might still hold
+ * the old pointer has left its read section; after that the old object can be
+ * freed. Readers never block and never touch shared cache lines. */
+
+/* Per-thread reader state, 0 while outside a read section */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t epoch;
+} RcuReader;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t epoch;  // Current epoch, starts at 1
+    RcuReader* readers;                                // max_readers slots
+    size_t max_readers;
+    _Atomic size_t num_readers;                        // Slots handed out
+} RcuDomain;
+
+int rcu_domain_init(RcuDomain* domain, size_t max_readers) {
+    domain->readers = (RcuReader*)aligned_alloc(CACHE_LINE_SIZE, max_readers * sizeof(RcuReader));
+    if (!domain->readers) return -1;
+    for (size_t i = 0; i < max_readers; i++) {
+        atomic_init(&domain->readers[i].epoch, 0);
+    }
+    domain->max_readers = max_readers;
+    atomic_init(&domain->epoch, 1);
+    atomic_init(&domain->num_readers, 0);
+    return 0;
+}
+
+void rcu_domain_destroy(RcuDomain* domain) {
+    free(domain->readers);
+}
+
+/* Claim a reader slot for the calling thread. Returns NULL when all slots are taken */
+RcuReader* rcu_register(RcuDomain* domain) {
+    size_t slot = atomic_fetch_add(&domain->num_readers, 1);
+    if (slot >= domain->max_readers) return NULL;
+    return &domain->readers[slot];
+}
+
+/* Enter a read section. The seq_cst store orders it before the pointer load that follows */
+static inline void rcu_read_lock(RcuDomain* domain, RcuReader* reader) {
+    atomic_store(&reader->epoch, atomic_load_explicit(&domain->epoch, memory_order_relaxed));
+}
+
+/* Leave a read section; pointers loaded inside it must not be used afterwards */
+static inline void rcu_read_unlock(RcuReader* reader) {
+    atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
+
+/* Wait until no reader can still see a pointer replaced before this call */
+void rcu_synchronize(RcuDomain* domain) {
+    uint64_t target = atomic_fetch_add(&domain->epoch, 1) + 1;
+    size_t count = atomic_load(&domain->num_readers);
+    if (count > domain->max_readers) count = domain->max_readers;
+    for (size_t i = 0; i < count; i++) {
+        for (;;) {
+            uint64_t seen = atomic_load(&domain->readers[i].epoch);
+            if (seen == 0 || seen >= target) break;
+            sched_yield();
+        }
+    }
+}
+
+#endif // RCU_H
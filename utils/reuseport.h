@@ -0,0 +1,41 @@
+#ifndef REUSEPORT_H
+#define REUSEPORT_H
+
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include "log_error.h"
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+/* Allow several sockets to bind the same port so the kernel spreads flows across them.
+ * Must be called before bind(). Returns 0 on success. */
+int reuseport_enable(int sock) {
+    int one = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        logError("SO_REUSEPORT failed");
+        return -1;
+    }
+    return 0;
+}
+
+/* Attach a classic BPF program to a SO_REUSEPORT group that picks the socket
+ * with index (receiving CPU % group_size). Sockets are indexed in bind order,
+ * so the thread owning socket i should run on CPU i to keep each flow on one core.
+ * Any socket of the group can be passed. Returns 0 on success. */
+int reuseport_attach_cpu_steering(int sock, unsigned group_size) {
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, (unsigned)(SKF_AD_OFF + SKF_AD_CPU) },  // A = current CPU
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, group_size },                          // A = A % group_size
+        { BPF_RET | BPF_A, 0, 0, 0 },                                             // Return socket index A
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        logError("SO_ATTACH_REUSEPORT_CBPF failed");
+        return -1;
+    }
+    return 0;
+}
+
+#endif // REUSEPORT_H
@@ -0,0 +1,395 @@
+#ifndef ROUTING_RULES_H
+#define ROUTING_RULES_H
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "load_balancer.h"
+#include "message.h"
+
+/* Forwarding rules: which messages go to which downstream output.
+ *
+ * Rules file format, one directive per line, '#' starts a comment:
+ *
+ *   output <name> <host>:<port>[,<host>:<port>...] [balance=hash|round-robin|least-loaded]
+ *   rule <output> [type=<n>|*] [id=<lo>-<hi>|<n>|*] [data=<lo>-<hi>|<n>|*]
+ *
+ * A message is sent to every output that has at least one matching rule;
+ * omitted fields match anything. Within an output it goes to one of the
+ * endpoints, chosen by the output's balance mode (load_balancer.h). Rules are compiled into a RouteTable: one
+ * table per MessageType that has type-specific rules (all other types share
+ * the wildcard table), and in each of them the ID and data axes are split
+ * into sorted elementary intervals carrying a bitmask of the rules that cover
+ * them. Evaluating a message is two branch-free binary searches and an AND,
+ * whatever the number of rules. */
+
+#define ROUTE_MAX_OUTPUTS 16
+#define ROUTE_MAX_RULES 64      // Rules are tracked as bits of a uint64_t
+#define ROUTE_NAME_LEN 32
+#define ROUTE_HOST_LEN 64
+#define ROUTE_ANY_TYPE (-1)
+
+/* One TCP endpoint of an output */
+typedef struct {
+    char host[ROUTE_HOST_LEN];
+    uint16_t port;
+} RouteEndpoint;
+
+/* A downstream named by rules: one or more endpoints sharing its traffic */
+typedef struct {
+    char name[ROUTE_NAME_LEN];
+    RouteEndpoint endpoints[BALANCE_MAX_ENDPOINTS];
+    size_t num_endpoints;
+    BalanceMode balance;  // How messages are spread over the endpoints (default hash)
+} RouteOutput;
+
+/* One parsed rule; ranges are inclusive */
+typedef struct {
+    int type;            // MessageType, or ROUTE_ANY_TYPE
+    uint64_t id_lo, id_hi;
+    uint64_t data_lo, data_hi;
+    unsigned output;     // Index into RouteConfig.outputs
+} RouteRule;
+
+/* Parsed rules file */
+typedef struct {
+    RouteOutput outputs[ROUTE_MAX_OUTPUTS];
+    size_t num_outputs;
+    RouteRule rules[ROUTE_MAX_RULES];
+    size_t num_rules;
+} RouteConfig;
+
+/* Sorted elementary intervals of one axis: value v falls in interval k where
+ * starts[k] <= v < starts[k + 1], and masks[k] holds the rules covering it */
+typedef struct {
+    uint64_t* starts;
+    uint64_t* masks;
+    size_t count;
+} RouteAxis;
+
+typedef struct {
+    RouteAxis id;
+    RouteAxis data;
+} RouteTypeTable;
+
+/* Compiled, immutable rule set. Published through an RCU pointer */
+typedef struct {
+    const RouteTypeTable* by_type[256];    // Table per MessageType, NULL if no rule can match
+    RouteTypeTable* tables;                // Distinct tables referenced by by_type
+    size_t num_tables;
+    uint8_t rule_output[ROUTE_MAX_RULES];  // Output index of each rule
+    size_t num_rules;
+    int single_value;                      // Set when the only rule is "data=<value>" for every type and ID
+    uint64_t single_data;                  // That value
+    unsigned single_output;                // And its output
+} RouteTable;
+
+/* The built-in configuration: forward MessageData == 10 to one output */
+void route_config_default(RouteConfig* cfg, const char* host, uint16_t port) {
+    memset(cfg, 0, sizeof(*cfg));
+    snprintf(cfg->outputs[0].name, ROUTE_NAME_LEN, "default");
+    snprintf(cfg->outputs[0].endpoints[0].host, ROUTE_HOST_LEN, "%s", host);
+    cfg->outputs[0].endpoints[0].port = port;
+    cfg->outputs[0].num_endpoints = 1;
+    cfg->num_outputs = 1;
+    RouteRule rule = {ROUTE_ANY_TYPE, 0, UINT64_MAX, 10, 10, 0};
+    cfg->rules[0] = rule;
+    cfg->num_rules = 1;
+}
+
+/* Parse "*", "<n>", "<lo>-<hi>" or "<lo>-*" into an inclusive range. Returns 0 on success.
+ * strtoull would accept a sign and wrap "-1" to UINT64_MAX, so each number must start with a digit */
+static int route_parse_range(const char* text, uint64_t* lo, uint64_t* hi) {
+    if (strcmp(text, "*") == 0) {
+        *lo = 0;
+        *hi = UINT64_MAX;
+        return 0;
+    }
+    if (!isdigit((unsigned char)text[0])) return -1;
+    char* end = NULL;
+    errno = 0;
+    *lo = strtoull(text, &end, 0);
+    if (end == text || errno) return -1;
+    if (*end == '\0') {
+        *hi = *lo;
+        return 0;
+    }
+    if (*end != '-') return -1;
+    const char* second = end + 1;
+    if (strcmp(second, "*") == 0) {
+        *hi = UINT64_MAX;
+        return 0;
+    }
+    if (!isdigit((unsigned char)second[0])) return -1;
+    *hi = strtoull(second, &end, 0);
+    if (end == second || *end != '\0' || errno || *hi < *lo) return -1;
+    return 0;
+}
+
+/* Parse "<host>:<port>[,<host>:<port>...]" into the endpoints of out. Returns 0 on success */
+int route_parse_endpoints(const char* list, RouteOutput* out) {
+    out->num_endpoints = 0;
+    while (*list) {
+        const char* end = strchr(list, ',');
+        size_t len = end ? (size_t)(end - list) : strlen(list);
+        const char* colon = NULL;
+        for (const char* c = list; c < list + len; c++) {
+            if (*c == ':') colon = c;
+        }
+        char* port_end = NULL;
+        long port = colon ? strtol(colon + 1, &port_end, 10) : 0;
+        if (!colon || port_end != list + len || port <= 0 || port > 65535 || colon == list ||
+            (size_t)(colon - list) >= ROUTE_HOST_LEN || out->num_endpoints == BALANCE_MAX_ENDPOINTS) {
+            return -1;
+        }
+        RouteEndpoint* endpoint = &out->endpoints[out->num_endpoints++];
+        snprintf(endpoint->host, ROUTE_HOST_LEN, "%.*s", (int)(colon - list), list);
+        endpoint->port = (uint16_t)port;
+        if (!end) break;
+        list = end + 1;
+    }
+    return out->num_endpoints > 0 ? 0 : -1;
+}
+
+static int route_find_output(const RouteConfig* cfg, const char* name) {
+    for (size_t i = 0; i < cfg->num_outputs; i++) {
+        if (strcmp(cfg->outputs[i].name, name) == 0) return (int)i;
+    }
+    return -1;
+}
+
+/* Parse a rules file into cfg. On error returns -1 and describes the problem in err */
+int route_config_load(const char* path, RouteConfig* cfg, char* err, size_t err_size) {
+    memset(cfg, 0, sizeof(*cfg));
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        snprintf(err, err_size, "cannot open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    char line[512];
+    int lineno = 0;
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), file)) {
+        lineno++;
+        char* hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char* tokens[8];
+        size_t ntok = 0;
+        for (char* tok = strtok(line, " \t\r\n"); tok && ntok < 8; tok = strtok(NULL, " \t\r\n")) {
+            tokens[ntok++] = tok;
+        }
+        if (ntok == 0) continue;
+
+        if (strcmp(tokens[0], "output") == 0) {
+            RouteOutput parsed;
+            memset(&parsed, 0, sizeof(parsed));
+            const char* balance = ntok == 4 && strncmp(tokens[3], "balance=", 8) == 0 ? tokens[3] + 8 : NULL;
+            parsed.balance = balance_mode_parse(balance, BALANCE_HASH);
+            int bad_balance = ntok == 4 && (!balance || (parsed.balance == BALANCE_HASH && strcasecmp(balance, "hash") != 0));
+            if ((ntok != 3 && ntok != 4) || bad_balance || strlen(tokens[1]) >= ROUTE_NAME_LEN ||
+                route_parse_endpoints(tokens[2], &parsed) < 0) {
+                snprintf(err, err_size,
+                         "%s:%d: expected 'output <name> <host>:<port>[,<host>:<port>...] [balance=hash|round-robin|least-loaded]'",
+                         path, lineno);
+                result = -1;
+            } else if (route_find_output(cfg, tokens[1]) >= 0 || cfg->num_outputs == ROUTE_MAX_OUTPUTS) {
+                snprintf(err, err_size, "%s:%d: duplicate output or more than %d outputs", path, lineno,
+                         ROUTE_MAX_OUTPUTS);
+                result = -1;
+            } else {
+                snprintf(parsed.name, ROUTE_NAME_LEN, "%s", tokens[1]);
+                cfg->outputs[cfg->num_outputs++] = parsed;
+            }
+        } else if (strcmp(tokens[0], "rule") == 0) {
+            int output = ntok >= 2 ? route_find_output(cfg, tokens[1]) : -1;
+            if (output < 0) {
+                snprintf(err, err_size, "%s:%d: rule needs a previously declared output", path, lineno);
+                result = -1;
+                break;
+            }
+            if (cfg->num_rules == ROUTE_MAX_RULES) {
+                snprintf(err, err_size, "%s:%d: more than %d rules", path, lineno, ROUTE_MAX_RULES);
+                result = -1;
+                break;
+            }
+            RouteRule rule = {ROUTE_ANY_TYPE, 0, UINT64_MAX, 0, UINT64_MAX, (unsigned)output};
+            for (size_t t = 2; t < ntok && result == 0; t++) {
+                char* eq = strchr(tokens[t], '=');
+                if (!eq) {
+                    result = -1;
+                    break;
+                }
+                *eq = '\0';
+                const char* value = eq + 1;
+                uint64_t lo, hi;
+                if (route_parse_range(value, &lo, &hi) < 0) {
+                    result = -1;
+                } else if (strcmp(tokens[t], "type") == 0) {
+                    if (lo != hi && !(lo == 0 && hi == UINT64_MAX)) result = -1;
+                    else if (lo == hi && lo > 255) result = -1;
+                    else rule.type = lo == hi ? (int)lo : ROUTE_ANY_TYPE;
+                } else if (strcmp(tokens[t], "id") == 0) {
+                    rule.id_lo = lo;
+                    rule.id_hi = hi;
+                } else if (strcmp(tokens[t], "data") == 0) {
+                    rule.data_lo = lo;
+                    rule.data_hi = hi;
+                } else {
+                    result = -1;
+                }
+            }
+            if (result < 0) {
+                snprintf(err, err_size, "%s:%d: expected 'rule <output> [type=N|*] [id=A-B] [data=A-B]'",
+                         path, lineno);
+                break;
+            }
+            cfg->rules[cfg->num_rules++] = rule;
+        } else {
+            snprintf(err, err_size, "%s:%d: unknown directive '%s'", path, lineno, tokens[0]);
+            result = -1;
+        }
+    }
+    fclose(file);
+    if (result == 0 && cfg->num_outputs == 0) {
+        snprintf(err, err_size, "%s: no outputs declared", path);
+        result = -1;
+    }
+    return result;
+}
+
+/* Check whether two configurations declare the same outputs, endpoints and balance modes in the same order */
+int route_outputs_equal(const RouteConfig* a, const RouteConfig* b) {
+    if (a->num_outputs != b->num_outputs) return 0;
+    for (size_t i = 0; i < a->num_outputs; i++) {
+        const RouteOutput* x = &a->outputs[i];
+        const RouteOutput* y = &b->outputs[i];
+        if (strcmp(x->name, y->name) != 0 || x->num_endpoints != y->num_endpoints || x->balance != y->balance) {
+            return 0;
+        }
+        for (size_t e = 0; e < x->num_endpoints; e++) {
+            if (strcmp(x->endpoints[e].host, y->endpoints[e].host) != 0 || x->endpoints[e].port != y->endpoints[e].port) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static int route_compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* Split one axis into elementary intervals for the rules in rule_mask */
+static void route_axis_build(RouteAxis* axis, const RouteRule* rules, uint64_t rule_mask, int use_data) {
+    size_t max_points = 1 + 2 * (size_t)__builtin_popcountll(rule_mask);
+    uint64_t* points = (uint64_t*)malloc(max_points * sizeof(uint64_t));
+    size_t n = 0;
+    points[n++] = 0;
+    for (uint64_t m = rule_mask; m; m &= m - 1) {
+        const RouteRule* r = &rules[__builtin_ctzll(m)];
+        uint64_t lo = use_data ? r->data_lo : r->id_lo;
+        uint64_t hi = use_data ? r->data_hi : r->id_hi;
+        points[n++] = lo;
+        if (hi != UINT64_MAX) points[n++] = hi + 1;
+    }
+    qsort(points, n, sizeof(uint64_t), route_compare_u64);
+    size_t unique = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (unique == 0 || points[i] != points[unique - 1]) points[unique++] = points[i];
+    }
+    axis->starts = points;
+    axis->count = unique;
+    axis->masks = (uint64_t*)calloc(unique, sizeof(uint64_t));
+    for (size_t k = 0; k < unique; k++) {
+        for (uint64_t m = rule_mask; m; m &= m - 1) {
+            int idx = __builtin_ctzll(m);
+            uint64_t lo = use_data ? rules[idx].data_lo : rules[idx].id_lo;
+            uint64_t hi = use_data ? rules[idx].data_hi : rules[idx].id_hi;
+            if (points[k] >= lo && points[k] <= hi) axis->masks[k] |= 1ULL << idx;
+        }
+    }
+}
+
+/* Compile parsed rules into an immutable table */
+RouteTable* route_table_compile(const RouteConfig* cfg) {
+    RouteTable* table = (RouteTable*)calloc(1, sizeof(RouteTable));
+    table->num_rules = cfg->num_rules;
+    uint64_t wildcard = 0;
+    uint64_t per_type[256] = {0};
+    for (size_t i = 0; i < cfg->num_rules; i++) {
+        table->rule_output[i] = (uint8_t)cfg->rules[i].output;
+        if (cfg->rules[i].type == ROUTE_ANY_TYPE) wildcard |= 1ULL << i;
+        else per_type[cfg->rules[i].type] |= 1ULL << i;
+    }
+
+    // One table for the wildcard rules plus one per type with its own rules
+    table->tables = (RouteTypeTable*)calloc(257, sizeof(RouteTypeTable));
+    RouteTypeTable* shared = NULL;
+    if (wildcard) {
+        shared = &table->tables[table->num_tables++];
+        route_axis_build(&shared->id, cfg->rules, wildcard, 0);
+        route_axis_build(&shared->data, cfg->rules, wildcard, 1);
+    }
+    for (int t = 0; t < 256; t++) {
+        if (per_type[t]) {
+            RouteTypeTable* own = &table->tables[table->num_tables++];
+            route_axis_build(&own->id, cfg->rules, per_type[t] | wildcard, 0);
+            route_axis_build(&own->data, cfg->rules, per_type[t] | wildcard, 1);
+            table->by_type[t] = own;
+        } else {
+            table->by_type[t] = shared;
+        }
+    }
+
+    // The common "data=<value>" rule can use the vectorized batch filter
+    if (cfg->num_rules == 1) {
+        const RouteRule* r = &cfg->rules[0];
+        table->single_value = r->type == ROUTE_ANY_TYPE && r->id_lo == 0 && r->id_hi == UINT64_MAX &&
+                              r->data_lo == r->data_hi;
+        table->single_data = r->data_lo;
+        table->single_output = r->output;
+    }
+    return table;
+}
+
+void route_table_destroy(RouteTable* table) {
+    for (size_t i = 0; i < table->num_tables; i++) {
+        free(table->tables[i].id.starts);
+        free(table->tables[i].id.masks);
+        free(table->tables[i].data.starts);
+        free(table->tables[i].data.masks);
+    }
+    free(table->tables);
+    free(table);
+}
+
+/* Rules covering v: branch-free search for the last interval starting at or below v */
+static inline uint64_t route_axis_lookup(const RouteAxis* axis, uint64_t v) {
+    const uint64_t* base = axis->starts;
+    size_t n = axis->count;
+    while (n > 1) {
+        size_t half = n / 2;
+        base = base[half] <= v ? base + half : base;
+        n -= half;
+    }
+    return axis->masks[base - axis->starts];
+}
+
+/* Bitmask of the outputs a message is routed to, 0 if none */
+static inline uint32_t route_eval(const RouteTable* table, const Message* msg) {
+    const RouteTypeTable* t = table->by_type[msg->MessageType];
+    if (!t) return 0;
+    uint64_t rules = route_axis_lookup(&t->id, msg->MessageId) & route_axis_lookup(&t->data, msg->MessageData);
+    uint32_t outputs = 0;
+    for (; rules; rules &= rules - 1) {
+        outputs |= 1u << table->rule_output[__builtin_ctzll(rules)];
+    }
+    return outputs;
+}
+
+#endif // ROUTING_RULES_H
@@ -0,0 +1,269 @@
+#ifndef SEQ_WINDOW_H
+#define SEQ_WINDOW_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <strings.h>
+
+/* Lock-free duplicate filter for mostly increasing sequence numbers, as used for
+ * A/B line arbitration where two feeds carry the same IDs.
+ *
+ * The sequence space is cut into blocks of 32 IDs. Each slot of a power-of-two
+ * ring holds one block in a single 64-bit word: the block number in the upper half
+ * and one "seen" bit per ID in the lower half. A slot in use always has a seen bit
+ * set, so a word of 0 means empty and every block number is a valid tag.
+ * Marking an ID is one compare-and-swap on its slot, so every ID is accepted by
+ * exactly one thread whichever line delivers it first. A newer block takes over
+ * the slot of the block num_slots behind it.
+ *
+ * The block that leaves is not forgotten: before the take-over the evicting thread
+ * ORs its seen bits into a larger history ring of the same layout. An ID whose
+ * window slot already holds a newer block is tested and set there instead, so a
+ * gap filled late is still accepted exactly once. Only an ID whose block has left
+ * the history too is reported as SEQ_EXPIRED: it may have been delivered before,
+ * so the caller treats it as a late duplicate rather than let it through unchecked.
+ *
+ * When a slot changes hands, the IDs never seen in the block that leaves, and in any
+ * blocks that never reached the slot, are counted as missed, so the counter
+ * trails the newest ID by one window. Block numbers are kept modulo 2^32, so IDs
+ * must stay within 2^36 of each other. */
+
+#define SEQ_WINDOW_BLOCK 32                // IDs per slot
+#define SEQ_WINDOW_DEFAULT_IDS 65536       // Default window: 2048 slots, 16KB
+#define SEQ_WINDOW_DEFAULT_HISTORY (64 * SEQ_WINDOW_DEFAULT_IDS)  // Default history: 131072 slots, 1MB
+
+/* How the receivers deduplicate */
+typedef enum {
+    DEDUP_MODE_STORE,  // Every ID goes through the sharded hash store
+    DEDUP_MODE_SEQ     // Sequence window first, hash store only outside it
+} DedupMode;
+
+DedupMode dedup_mode_parse(const char* name, DedupMode def) {
+    if (!name) return def;
+    if (strcasecmp(name, "store") == 0 || strcasecmp(name, "hash") == 0) return DEDUP_MODE_STORE;
+    if (strcasecmp(name, "seq") == 0 || strcasecmp(name, "sequence") == 0) return DEDUP_MODE_SEQ;
+    return def;
+}
+
+typedef enum {
+    SEQ_NEW,        // First time seen, now marked
+    SEQ_DUPLICATE,  // Already marked
+    SEQ_EXPIRED,    // In a block that has left the history too: too late to tell, treated as a duplicate
+    SEQ_OUTSIDE     // Below the floor, for the caller to check elsewhere
+} SeqResult;
+
+typedef struct {
+    _Atomic uint64_t* slots;  // Block number << 32 | seen bits, 0 when empty
+    size_t mask;              // Number of slots - 1
+    _Atomic uint64_t* history;  // Blocks evicted from slots, same layout; NULL without history
+    size_t history_mask;        // Number of history slots - 1
+    uint64_t floor;           // IDs below it are always SEQ_OUTSIDE
+    _Atomic uint64_t start;   // Smallest ID marked, UINT64_MAX before the first
+    _Atomic uint64_t high;    // Largest ID marked
+    _Atomic uint64_t missed;  // IDs after start never seen before their block left the window
+} SeqWindow;
+
+/* Allocate an empty ring of at least ids IDs (a power-of-two number of blocks). Returns NULL on failure */
+static _Atomic uint64_t* seq_window_ring(size_t ids, size_t* mask) {
+    size_t slots = 1;
+    while (slots * SEQ_WINDOW_BLOCK < ids) {
+        slots <<= 1;
+    }
+    _Atomic uint64_t* ring = (_Atomic uint64_t*)aligned_alloc(64, (slots * sizeof(uint64_t) + 63) & ~(size_t)63);
+    if (!ring) return NULL;
+    for (size_t i = 0; i < slots; i++) {
+        atomic_init(&ring[i], 0);
+    }
+    *mask = slots - 1;
+    return ring;
+}
+
+/* Create a window covering at least window_ids IDs, and a history of evicted blocks covering
+ * at least history_ids IDs (0 = none), both rounded up to a power-of-two number of blocks.
+ * IDs below floor, e.g. those recovered into the hash store, are always SEQ_OUTSIDE.
+ * Returns 0 on success */
+int seq_window_init(SeqWindow* window, size_t window_ids, size_t history_ids, uint64_t floor) {
+    window->slots = seq_window_ring(window_ids, &window->mask);
+    if (!window->slots) return -1;
+    window->history = NULL;
+    window->history_mask = 0;
+    if (history_ids > 0) {
+        window->history = seq_window_ring(history_ids, &window->history_mask);
+        if (!window->history) {
+            free(window->slots);
+            window->slots = NULL;
+            return -1;
+        }
+    }
+    window->floor = floor;
+    atomic_init(&window->start, UINT64_MAX);
+    atomic_init(&window->high, 0);
+    atomic_init(&window->missed, 0);
+    return 0;
+}
+
+void seq_window_destroy(SeqWindow* window) {
+    free(window->slots);
+    free(window->history);
+    window->slots = NULL;
+    window->history = NULL;
+}
+
+/* IDs the window can hold */
+size_t seq_window_ids(const SeqWindow* window) {
+    return (window->mask + 1) * SEQ_WINDOW_BLOCK;
+}
+
+/* IDs the history can hold, 0 without one */
+size_t seq_window_history_ids(const SeqWindow* window) {
+    return window->history ? (window->history_mask + 1) * SEQ_WINDOW_BLOCK : 0;
+}
+
+/* Seen bits of block that are not before the first marked ID, i.e. that could be gaps */
+static inline uint32_t seq_window_relevant(const SeqWindow* window, uint64_t block) {
+    uint64_t start = atomic_load_explicit(&window->start, memory_order_relaxed);
+    uint64_t first = block * SEQ_WINDOW_BLOCK;
+    if (start <= first) return UINT32_MAX;
+    if (start >= first + SEQ_WINDOW_BLOCK) return 0;
+    return UINT32_MAX << (start - first);
+}
+
+/* Lower *target to value, or raise it when raise is set */
+static inline void seq_window_bound(_Atomic uint64_t* target, uint64_t value, int raise) {
+    uint64_t current = atomic_load_explicit(target, memory_order_relaxed);
+    while (raise ? value > current : value < current) {
+        if (atomic_compare_exchange_weak_explicit(target, &current, value, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+/* Count the IDs missed when block takes over a slot that held old */
+static void seq_window_account(SeqWindow* window, uint64_t block, uint64_t old) {
+    uint64_t slots = window->mask + 1;
+    uint32_t old_tag = (uint32_t)(old >> 32);
+    uint64_t missed = 0;
+    if ((uint32_t)old != 0) {
+        uint64_t evicted = block - (uint32_t)((uint32_t)block - old_tag);
+        missed = (uint64_t)__builtin_popcount(~(uint32_t)old & seq_window_relevant(window, evicted));
+        missed += ((block - evicted) / slots - 1) * SEQ_WINDOW_BLOCK;  // Blocks that never reached the slot
+    } else {
+        // First use of the slot: the blocks before this one that map here were never seen
+        uint64_t start_block = atomic_load_explicit(&window->start, memory_order_relaxed) / SEQ_WINDOW_BLOCK;
+        if (block >= start_block + slots) {
+            uint64_t skipped = (block - start_block) / slots;
+            uint64_t lowest = block - skipped * slots;
+            missed = skipped * SEQ_WINDOW_BLOCK - (uint64_t)__builtin_popcount(~seq_window_relevant(window, lowest));
+        }
+    }
+    if (missed) {
+        atomic_fetch_add_explicit(&window->missed, missed, memory_order_relaxed);
+    }
+}
+
+/* OR the seen bits of a block leaving the window into its history slot, taking the slot
+ * over from an older block. A slot that holds a newer block means this one is past the history */
+static void seq_history_merge(SeqWindow* window, uint64_t block, uint32_t bits) {
+    if (!window->history) return;
+    uint32_t tag = (uint32_t)block;
+    _Atomic uint64_t* slot = &window->history[block & window->history_mask];
+    uint64_t old = atomic_load_explicit(slot, memory_order_relaxed);
+    for (;;) {
+        uint64_t next;
+        if ((uint32_t)old != 0 && (uint32_t)(old >> 32) == tag) {
+            next = old | bits;
+        } else if ((uint32_t)old == 0 || (int32_t)(tag - (uint32_t)(old >> 32)) > 0) {
+            next = ((uint64_t)tag << 32) | bits;
+        } else {
+            return;
+        }
+        if (next == old || atomic_compare_exchange_weak_explicit(slot, &old, next, memory_order_release,
+                                                                 memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+/* Test and set the seen bit of an ID whose block has left the window. A block the history
+ * does not hold yet (an empty or older slot) was never marked, since every marked block
+ * passes through the history when it leaves the window */
+static SeqResult seq_history_mark(SeqWindow* window, uint64_t block, uint64_t bit) {
+    if (!window->history) return SEQ_EXPIRED;
+    uint32_t tag = (uint32_t)block;
+    _Atomic uint64_t* slot = &window->history[block & window->history_mask];
+    uint64_t old = atomic_load_explicit(slot, memory_order_acquire);
+    for (;;) {
+        uint32_t old_tag = (uint32_t)(old >> 32);
+        int empty = (uint32_t)old == 0;
+        uint64_t next;
+        if (!empty && old_tag == tag) {
+            if (old & bit) return SEQ_DUPLICATE;
+            next = old | bit;
+        } else if (empty || (int32_t)(tag - old_tag) > 0) {
+            next = ((uint64_t)tag << 32) | bit;
+        } else {
+            return SEQ_EXPIRED;  // Past the history as well
+        }
+        if (atomic_compare_exchange_weak_explicit(slot, &old, next, memory_order_acq_rel, memory_order_acquire)) {
+            return SEQ_NEW;
+        }
+    }
+}
+
+/* Test and set the seen bit of id. Safe to call from any number of threads */
+static inline SeqResult seq_window_mark(SeqWindow* window, uint64_t id) {
+    if (id < window->floor) return SEQ_OUTSIDE;
+    uint64_t block = id / SEQ_WINDOW_BLOCK;
+    uint32_t tag = (uint32_t)block;
+    uint64_t bit = 1ULL << (id % SEQ_WINDOW_BLOCK);
+    _Atomic uint64_t* slot = &window->slots[block & window->mask];
+    // Acquire/release on the slot: whoever sees a newer block there also sees the history merge
+    uint64_t old = atomic_load_explicit(slot, memory_order_acquire);
+    for (;;) {
+        uint32_t old_tag = (uint32_t)(old >> 32);
+        int empty = (uint32_t)old == 0;
+        uint64_t next;
+        if (!empty && old_tag == tag) {
+            if (old & bit) return SEQ_DUPLICATE;
+            next = old | bit;
+        } else if (empty || (int32_t)(tag - old_tag) > 0) {
+            // Newer block: take over the slot, after handing the old block to the history. If the
+            // CAS fails the merge is repeated with the bits seen then, which only adds bits
+            if (!empty) seq_history_merge(window, block - (uint32_t)(tag - old_tag), (uint32_t)old);
+            next = ((uint64_t)tag << 32) | bit;
+        } else {
+            // The slot already holds a newer block
+            SeqResult result = seq_history_mark(window, block, bit);
+            if (result == SEQ_NEW && id < atomic_load_explicit(&window->start, memory_order_relaxed)) {
+                seq_window_bound(&window->start, id, 0);
+            }
+            return result;
+        }
+        if (atomic_compare_exchange_weak_explicit(slot, &old, next, memory_order_acq_rel, memory_order_acquire)) {
+            break;
+        }
+    }
+    if (id < atomic_load_explicit(&window->start, memory_order_relaxed)) {
+        seq_window_bound(&window->start, id, 0);
+    }
+    if (id > atomic_load_explicit(&window->high, memory_order_relaxed)) {
+        seq_window_bound(&window->high, id, 1);
+    }
+    if ((uint32_t)old == 0 || (uint32_t)(old >> 32) != tag) {
+        seq_window_account(window, block, old);
+    }
+    return SEQ_NEW;
+}
+
+/* Number of IDs from the smallest to the largest marked one, 0 before the first.
+ * Minus the IDs accepted as SEQ_NEW, this is how many never arrived within the window */
+uint64_t seq_window_span(SeqWindow* window) {
+    uint64_t start = atomic_load(&window->start);
+    if (start == UINT64_MAX) return 0;
+    return atomic_load(&window->high) - start + 1;
+}
+
+#endif // SEQ_WINDOW_H
@@ -0,0 +1,549 @@
+#ifndef SHARDED_STORE_H
+#define SHARDED_STORE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bloom_filter.h"
+#include "custom_hash_map.h"
+#include "dedup_window.h"
+#include "message.h"
+#include "mpsc_ring.h"
+#include "rcu.h"
+#include "thread_utils.h"
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#define STORE_EXPIRE_BUDGET 4  // Aged IDs expired per insert, keeps eviction incremental
+#define STORE_MAX_READERS 8    // Threads that may use the lock-free query functions
+#define STORE_NUM_TYPES 256    // One counter per MessageType value
+#define STORE_SCAN_CHUNK 256   // Slots copied per seqlock read section in a range scan
+
+/* Queries never take the shard lock. Writers bracket every change of a shard
+ * with store_write_begin/end, which make the shard's sequence number odd while
+ * the map is inconsistent; readers copy what they need and retry if the number
+ * changed meanwhile. Slot arrays replaced by a resize are not freed at once but
+ * retired, and store_reclaim frees them once no reader in store->rcu can still
+ * be probing them, so a reader racing a resize reads stale memory, never freed
+ * memory. */
+
+/* One independently locked partition of the message store.
+ * Aligned to a cache line so neighbouring shard locks do not false-share. */
+typedef struct {
+    Mutex lock;              // Serializes writers of map, window, evictions and retired
+    _Atomic uint32_t seq;    // Seqlock for lock-free readers, odd while a writer is active
+    CustomHashMap* map;      // Messages whose ID hashes to this shard
+    DedupWindow window;      // Insertion order of IDs for bounded retention
+    uint64_t evictions;      // IDs removed by the retention window
+    void** retired;          // Slot arrays replaced by resizes, freed by store_reclaim
+    size_t num_retired;
+    size_t retired_cap;
+    BloomFilter filter;      // Superset of the stored IDs, num_blocks 0 = no pre-filter
+    size_t filter_capacity;  // IDs the filter was sized for
+    size_t filter_added;     // IDs added to the filter, including those since evicted
+    uint64_t filter_skips;   // Inserts the filter proved new, so the map probe was skipped
+    uint64_t filter_false_positives; // New IDs the filter could not rule out
+    uint64_t filter_rebuilds;
+    _Atomic uint64_t type_counts[STORE_NUM_TYPES];  // Stored messages per MessageType
+} __attribute__((aligned(CACHE_LINE_SIZE))) StoreShard;
+
+/* Message store split into a power-of-two number of shards */
+typedef struct {
+    StoreShard* shards;  // Array of num_shards shards
+    size_t num_shards;   // Number of shards (power of two)
+    unsigned shift;      // 64 - log2(num_shards), selects the top hash bits
+    size_t filter_bits_per_key; // Pre-filter density, 0 = no pre-filter
+    size_t filter_min_keys;     // Smallest per-shard pre-filter capacity
+    RcuDomain rcu;       // Readers of the lock-free query functions
+} ShardedStore;
+
+/* Pre-filter counters summed over all shards */
+typedef struct {
+    uint64_t skips;            // Inserts that skipped the exact probe
+    uint64_t false_positives;  // New IDs the filter answered "maybe" for
+    uint64_t rebuilds;         // Filters rebuilt from their shard's IDs
+    size_t bytes;              // Memory of all filters
+} StoreFilterStats;
+
+/* Pick the shard for a MessageId from the top bits of its hash_function() value.
+ * The shard map uses the low bits of the same hash, so one hash serves both */
+size_t store_shard_index(const ShardedStore* store, uint64_t hash) {
+    if (store->num_shards == 1) return 0;
+    return (size_t)(hash >> store->shift);
+}
+
+/* Retire hook of the shard maps: keep a replaced slot array until store_reclaim */
+static void store_shard_retire(void* ctx, void* ptr) {
+    StoreShard* shard = (StoreShard*)ctx;
+    if (shard->num_retired == shard->retired_cap) {
+        size_t cap = shard->retired_cap ? shard->retired_cap * 2 : 8;
+        void** grown = (void**)realloc(shard->retired, cap * sizeof(void*));
+        if (!grown) {
+            abort();  // Freeing the array now could crash a reader; losing it would leak silently
+        }
+        shard->retired = grown;
+        shard->retired_cap = cap;
+    }
+    shard->retired[shard->num_retired++] = ptr;
+}
+
+/* Start and finish a change of a locked shard. The release fence keeps the odd
+ * sequence number ahead of the changes, the release store the changes ahead of the even one */
+static inline void store_write_begin(StoreShard* shard) {
+    uint32_t seq = atomic_load_explicit(&shard->seq, memory_order_relaxed);
+    atomic_store_explicit(&shard->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void store_write_end(StoreShard* shard) {
+    uint32_t seq = atomic_load_explicit(&shard->seq, memory_order_relaxed);
+    atomic_store_explicit(&shard->seq, seq + 1, memory_order_release);
+}
+
+/* Adjust the per-type count of a locked shard. Only the lock holder writes, so no RMW is needed */
+static inline void store_count_type(StoreShard* shard, uint8_t type, int64_t delta) {
+    uint64_t count = atomic_load_explicit(&shard->type_counts[type], memory_order_relaxed);
+    atomic_store_explicit(&shard->type_counts[type], count + (uint64_t)delta, memory_order_relaxed);
+}
+
+/* Wait for an even sequence number, the start of a consistent read of the shard */
+static inline uint32_t store_read_begin(const StoreShard* shard) {
+    for (;;) {
+        uint32_t seq = atomic_load_explicit(&shard->seq, memory_order_acquire);
+        if (!(seq & 1)) return seq;
+        cpu_relax();
+    }
+}
+
+/* Whether everything read since store_read_begin returned seq is consistent */
+static inline int store_read_valid(const StoreShard* shard, uint32_t seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&shard->seq, memory_order_relaxed) == seq;
+}
+
+/* Create a store with at least num_shards shards (rounded up to a power of two).
+ * window_count > 0 keeps only about the last window_count IDs and window_age_ns > 0
+ * keeps IDs only for that long; with both 0 the store grows without bound. */
+ShardedStore* store_create(size_t num_shards, size_t initial_size, size_t window_count, int64_t window_age_ns) {
+    size_t shards = 1;
+    unsigned bits = 0;
+    while (shards < num_shards) {
+        shards <<= 1;
+        bits++;
+    }
+    ShardedStore* store = (ShardedStore*)aligned_alloc(CACHE_LINE_SIZE, sizeof(ShardedStore));
+    store->num_shards = shards;
+    store->shift = 64 - bits;
+    store->filter_bits_per_key = 0;
+    store->filter_min_keys = 0;
+    store->shards = (StoreShard*)aligned_alloc(CACHE_LINE_SIZE, shards * sizeof(StoreShard));
+    rcu_domain_init(&store->rcu, STORE_MAX_READERS);
+    size_t shard_count = (window_count + shards - 1) / shards;
+    if (shard_count > initial_size) {
+        initial_size = shard_count;  // Size the map for the whole window up front
+    }
+    for (size_t i = 0; i < shards; i++) {
+        mutex_init(&store->shards[i].lock);
+        atomic_init(&store->shards[i].seq, 0);
+        store->shards[i].map = hash_map_create(initial_size);
+        store->shards[i].map->retire = store_shard_retire;
+        store->shards[i].map->retire_ctx = &store->shards[i];
+        dedup_window_init(&store->shards[i].window, shard_count, window_age_ns);
+        store->shards[i].evictions = 0;
+        store->shards[i].retired = NULL;
+        store->shards[i].num_retired = 0;
+        store->shards[i].retired_cap = 0;
+        memset(&store->shards[i].filter, 0, sizeof(BloomFilter));
+        store->shards[i].filter_capacity = 0;
+        store->shards[i].filter_added = 0;
+        store->shards[i].filter_skips = 0;
+        store->shards[i].filter_false_positives = 0;
+        store->shards[i].filter_rebuilds = 0;
+        for (size_t t = 0; t < STORE_NUM_TYPES; t++) {
+            atomic_init(&store->shards[i].type_counts[t], 0);
+        }
+    }
+    return store;
+}
+
+/* Destroy the store and every shard. No reader may be active */
+void store_destroy(ShardedStore* store) {
+    for (size_t i = 0; i < store->num_shards; i++) {
+        for (size_t r = 0; r < store->shards[i].num_retired; r++) {
+            free(store->shards[i].retired[r]);
+        }
+        free(store->shards[i].retired);
+        bloom_destroy(&store->shards[i].filter);
+        hash_map_destroy(store->shards[i].map);
+        dedup_window_destroy(&store->shards[i].window);
+        mutex_destroy(&store->shards[i].lock);
+    }
+    free(store->shards);
+    rcu_domain_destroy(&store->rcu);
+    free(store);
+}
+
+/* (Re)build the filter of a locked shard from the IDs it stores, sized for at least
+ * twice as many, so evicted IDs stop counting against it. Returns 0 on success */
+static int store_shard_build_filter(ShardedStore* store, StoreShard* shard) {
+    size_t capacity = 2 * hash_map_size(shard->map);
+    if (capacity < store->filter_min_keys) capacity = store->filter_min_keys;
+    BloomFilter filter;
+    if (bloom_init(&filter, capacity, store->filter_bits_per_key) < 0) {
+        return -1;
+    }
+    const CustomHashMap* map = shard->map;
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->ctrl[i] != HASH_MAP_CTRL_EMPTY) {
+            bloom_add(&filter, hash_function(map->keys[i]));
+        }
+    }
+    bloom_destroy(&shard->filter);
+    shard->filter = filter;
+    shard->filter_capacity = capacity;
+    shard->filter_added = hash_map_size(shard->map);
+    return 0;
+}
+
+/* Put a Bloom filter of bits_per_key bits per ID in front of every shard map, sized
+ * for expected_ids in total. An insert the filter proves new skips the duplicate probe;
+ * a filter that has taken as many IDs as it was sized for is rebuilt from its shard.
+ * Call before the store is shared. Returns 0 on success */
+int store_enable_filter(ShardedStore* store, size_t expected_ids, size_t bits_per_key) {
+    store->filter_bits_per_key = bits_per_key ? bits_per_key : BLOOM_DEFAULT_BITS_PER_KEY;
+    store->filter_min_keys = expected_ids / store->num_shards + 1;
+    for (size_t i = 0; i < store->num_shards; i++) {
+        if (store_shard_build_filter(store, &store->shards[i]) < 0) {
+            for (size_t j = 0; j < i; j++) {
+                bloom_destroy(&store->shards[j].filter);
+            }
+            store->filter_bits_per_key = 0;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Insert a new message into a locked shard, consulting the pre-filter if there is one.
+ * Returns 1 if the message was new and stored, 0 if it was a duplicate */
+static int store_shard_insert(ShardedStore* store, StoreShard* shard, const Message* msg, uint64_t hash) {
+    if (!shard->filter.num_blocks) {
+        return hash_map_insert_if_absent_hashed(shard->map, msg->MessageId, hash, msg);
+    }
+    if (!bloom_maybe_contains(&shard->filter, hash)) {
+        hash_map_insert_absent_hashed(shard->map, msg->MessageId, hash, msg);
+        shard->filter_skips++;
+    } else if (hash_map_insert_if_absent_hashed(shard->map, msg->MessageId, hash, msg)) {
+        shard->filter_false_positives++;
+    } else {
+        return 0;
+    }
+    bloom_add(&shard->filter, hash);
+    if (++shard->filter_added > shard->filter_capacity) {
+        if (store_shard_build_filter(store, shard) == 0) {
+            shard->filter_rebuilds++;
+        }  // On failure keep the full filter; it only gets less selective
+    }
+    return 1;
+}
+
+/* Expire up to budget aged IDs of a locked shard. Returns the number removed */
+static size_t store_shard_expire(StoreShard* shard, int64_t now_ns, size_t budget) {
+    size_t removed = 0;
+    uint64_t id;
+    Message old;
+    while (removed < budget && dedup_window_expire_one(&shard->window, now_ns, &id)) {
+        if (hash_map_take(shard->map, id, &old)) {
+            store_count_type(shard, old.MessageType, -1);
+        }
+        removed++;
+    }
+    shard->evictions += removed;
+    return removed;
+}
+
+/* Atomically check for and insert a message under its shard lock, with
+ * hash = hash_function(msg->MessageId) precomputed by the caller.
+ * With a retention window, the insert also evicts the oldest IDs of the shard.
+ * Returns 1 if the message was new and stored, 0 if it was a duplicate. */
+int store_insert_if_absent_hashed(ShardedStore* store, const Message* msg, uint64_t hash, int64_t now_ns) {
+    StoreShard* shard = &store->shards[store_shard_index(store, hash)];
+    mutex_lock(&shard->lock);
+    store_write_begin(shard);
+    if (dedup_window_enabled(&shard->window)) {
+        store_shard_expire(shard, now_ns, STORE_EXPIRE_BUDGET);
+    }
+    int inserted = store_shard_insert(store, shard, msg, hash);
+    if (inserted) {
+        store_count_type(shard, msg->MessageType, 1);
+    }
+    if (inserted && dedup_window_enabled(&shard->window)) {
+        uint64_t evicted;
+        Message old;
+        if (dedup_window_push(&shard->window, msg->MessageId, now_ns, &evicted)) {
+            if (hash_map_take(shard->map, evicted, &old)) {
+                store_count_type(shard, old.MessageType, -1);
+            }
+            shard->evictions++;
+        }
+    }
+    store_write_end(shard);
+    mutex_unlock(&shard->lock);
+    return inserted;
+}
+
+/* Atomically check for and insert a message under its shard lock.
+ * Returns 1 if the message was new and stored, 0 if it was a duplicate. */
+int store_insert_if_absent(ShardedStore* store, const Message* msg, int64_t now_ns) {
+    return store_insert_if_absent_hashed(store, msg, hash_function(msg->MessageId), now_ns);
+}
+
+/* Expire aged IDs in every shard, at most budget per shard per call, so IDs
+ * still age out when no new messages arrive. Returns the number removed */
+size_t store_expire(ShardedStore* store, int64_t now_ns, size_t budget) {
+    size_t removed = 0;
+    for (size_t i = 0; i < store->num_shards; i++) {
+        StoreShard* shard = &store->shards[i];
+        if (!shard->window.max_age_ns) continue;
+        mutex_lock(&shard->lock);
+        store_write_begin(shard);
+        removed += store_shard_expire(shard, now_ns, budget);
+        store_write_end(shard);
+        mutex_unlock(&shard->lock);
+    }
+    return removed;
+}
+
+/* Total number of IDs evicted by the retention window */
+uint64_t store_evictions(ShardedStore* store) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < store->num_shards; i++) {
+        mutex_lock(&store->shards[i].lock);
+        total += store->shards[i].evictions;
+        mutex_unlock(&store->shards[i].lock);
+    }
+    return total;
+}
+
+/* Sum the pre-filter counters of every shard */
+void store_filter_stats(ShardedStore* store, StoreFilterStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i = 0; i < store->num_shards; i++) {
+        StoreShard* shard = &store->shards[i];
+        mutex_lock(&shard->lock);
+        stats->skips += shard->filter_skips;
+        stats->false_positives += shard->filter_false_positives;
+        stats->rebuilds += shard->filter_rebuilds;
+        stats->bytes += bloom_bytes(&shard->filter);
+        mutex_unlock(&shard->lock);
+    }
+}
+
+/* Share of new IDs the pre-filter failed to rule out, in parts per million */
+uint64_t store_filter_fp_ppm(const StoreFilterStats* stats) {
+    uint64_t fresh = stats->skips + stats->false_positives;
+    return fresh ? stats->false_positives * 1000000 / fresh : 0;
+}
+
+/* Pre-size every shard for about count IDs in total, e.g. before bulk recovery */
+void store_reserve(ShardedStore* store, size_t count) {
+    size_t per_shard = count / store->num_shards + count / store->num_shards / 8 + 16;  // Slack for uneven hashing
+    for (size_t i = 0; i < store->num_shards; i++) {
+        mutex_lock(&store->shards[i].lock);
+        store_write_begin(&store->shards[i]);
+        hash_map_reserve(store->shards[i].map, per_shard);
+        store_write_end(&store->shards[i]);
+        mutex_unlock(&store->shards[i].lock);
+    }
+}
+
+/* Check if a MessageId is stored */
+int store_contains(ShardedStore* store, uint64_t key) {
+    uint64_t hash = hash_function(key);
+    StoreShard* shard = &store->shards[store_shard_index(store, hash)];
+    mutex_lock(&shard->lock);
+    int found = hash_map_find(shard->map, key, hash) != HASH_MAP_NOT_FOUND;
+    mutex_unlock(&shard->lock);
+    return found;
+}
+
+/* Total number of stored messages across all shards */
+size_t store_size(ShardedStore* store) {
+    size_t total = 0;
+    for (size_t i = 0; i < store->num_shards; i++) {
+        mutex_lock(&store->shards[i].lock);
+        total += hash_map_size(store->shards[i].map);
+        mutex_unlock(&store->shards[i].lock);
+    }
+    return total;
+}
+
+/* Free the slot arrays retired by resizes once no query can still be reading them.
+ * Call periodically from a thread that is not a store reader. Returns the number freed */
+size_t store_reclaim(ShardedStore* store) {
+    void** batch = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+    for (size_t i = 0; i < store->num_shards; i++) {
+        StoreShard* shard = &store->shards[i];
+        mutex_lock(&shard->lock);
+        if (shard->num_retired > 0) {
+            if (count + shard->num_retired > cap) {
+                cap = (count + shard->num_retired) * 2;
+                batch = (void**)realloc(batch, cap * sizeof(void*));
+            }
+            memcpy(batch + count, shard->retired, shard->num_retired * sizeof(void*));
+            count += shard->num_retired;
+            shard->num_retired = 0;
+        }
+        mutex_unlock(&shard->lock);
+    }
+    if (count > 0) {
+        rcu_synchronize(&store->rcu);
+        for (size_t i = 0; i < count; i++) {
+            free(batch[i]);
+        }
+    }
+    free(batch);
+    return count;
+}
+
+/* Register the calling thread as a store reader. Returns NULL when all slots are taken */
+RcuReader* store_register_reader(ShardedStore* store) {
+    return rcu_register(&store->rcu);
+}
+
+/* Look up a message by ID without taking the shard lock, from a thread registered
+ * with store_register_reader. Returns 1 and fills out if the ID is stored, else 0 */
+int store_get(ShardedStore* store, RcuReader* reader, uint64_t key, Message* out) {
+    uint64_t hash = hash_function(key);
+    StoreShard* shard = &store->shards[store_shard_index(store, hash)];
+    Message value;
+    int found;
+    rcu_read_lock(&store->rcu, reader);
+    for (;;) {
+        uint32_t seq = store_read_begin(shard);
+        CustomHashMap view = *shard->map;  // Slot arrays and mask of one version
+        if (!store_read_valid(shard, seq)) continue;
+        size_t index = hash_map_find(&view, key, hash);
+        found = index != HASH_MAP_NOT_FOUND;
+        if (found) value = view.values[index];
+        if (store_read_valid(shard, seq)) break;
+    }
+    rcu_read_unlock(reader);
+    if (found) *out = value;
+    return found;
+}
+
+/* Offer a message to the max-heap of the max smallest IDs seen so far in out */
+static void store_heap_offer(Message* out, size_t* len, size_t max, const Message* msg) {
+    size_t i;
+    if (*len < max) {
+        i = (*len)++;
+        while (i > 0 && out[(i - 1) / 2].MessageId < msg->MessageId) {
+            out[i] = out[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        out[i] = *msg;
+        return;
+    }
+    if (max == 0 || msg->MessageId >= out[0].MessageId) return;
+    i = 0;  // Replace the largest and sift the new entry down
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= max) break;
+        if (child + 1 < max && out[child + 1].MessageId > out[child].MessageId) child++;
+        if (out[child].MessageId <= msg->MessageId) break;
+        out[i] = out[child];
+        i = child;
+    }
+    out[i] = *msg;
+}
+
+static int store_compare_ids(const void* a, const void* b) {
+    uint64_t x = ((const Message*)a)->MessageId;
+    uint64_t y = ((const Message*)b)->MessageId;
+    return (x > y) - (x < y);
+}
+
+/* Find the stored messages with lo <= MessageId <= hi without taking any shard lock,
+ * from a thread registered with store_register_reader. Fills out with the (at most)
+ * max smallest matching IDs in ascending order and returns how many; *matched gets
+ * the number of matches in total.
+ *
+ * Each shard is copied STORE_SCAN_CHUNK slots at a time, so the result is only
+ * weakly consistent: a message stored or removed during the scan may or may not be
+ * reported, and an entry that a concurrent removal moves across the end of its
+ * table may be counted twice. */
+size_t store_scan_range(ShardedStore* store, RcuReader* reader, uint64_t lo, uint64_t hi,
+                        Message* out, size_t max, size_t* matched) {
+    Message chunk[STORE_SCAN_CHUNK];
+    size_t len = 0;
+    size_t total = 0;
+    for (size_t s = 0; s < store->num_shards; s++) {
+        StoreShard* shard = &store->shards[s];
+        rcu_read_lock(&store->rcu, reader);
+        CustomHashMap view;
+        for (;;) {
+            uint32_t seq = store_read_begin(shard);
+            view = *shard->map;
+            if (store_read_valid(shard, seq)) break;
+        }
+        // Once a resize has replaced the pinned arrays they are no longer written,
+        // so the rest of the shard is read from them without validation
+        int frozen = 0;
+        for (size_t pos = 0; pos < view.capacity; pos += STORE_SCAN_CHUNK) {
+            size_t end = pos + STORE_SCAN_CHUNK < view.capacity ? pos + STORE_SCAN_CHUNK : view.capacity;
+            size_t found;
+            for (;;) {
+                uint32_t seq = store_read_begin(shard);
+                int replaced = shard->map->ctrl != view.ctrl;
+                found = 0;
+                for (size_t i = pos; i < end; i++) {
+                    if (view.ctrl[i] == HASH_MAP_CTRL_EMPTY) continue;
+                    uint64_t id = view.keys[i];
+                    if (id >= lo && id <= hi) {
+                        chunk[found++] = view.values[i];
+                    }
+                }
+                if (frozen || store_read_valid(shard, seq)) {
+                    frozen |= replaced;
+                    break;
+                }
+            }
+            total += found;
+            for (size_t i = 0; i < found; i++) {
+                store_heap_offer(out, &len, max, &chunk[i]);
+            }
+        }
+        rcu_read_unlock(reader);
+    }
+    qsort(out, len, sizeof(Message), store_compare_ids);
+    if (matched) *matched = total;
+    return len;
+}
+
+/* Number of stored messages per MessageType, summed over all shards without locking.
+ * Each shard's counters are read as one consistent set */
+void store_type_counts(ShardedStore* store, uint64_t counts[STORE_NUM_TYPES]) {
+    memset(counts, 0, STORE_NUM_TYPES * sizeof(uint64_t));
+    for (size_t s = 0; s < store->num_shards; s++) {
+        StoreShard* shard = &store->shards[s];
+        uint64_t local[STORE_NUM_TYPES];
+        for (;;) {
+            uint32_t seq = store_read_begin(shard);
+            for (size_t t = 0; t < STORE_NUM_TYPES; t++) {
+                local[t] = atomic_load_explicit(&shard->type_counts[t], memory_order_relaxed);
+            }
+            if (store_read_valid(shard, seq)) break;
+        }
+        for (size_t t = 0; t < STORE_NUM_TYPES; t++) {
+            counts[t] += local[t];
+        }
+    }
+}
+
+#endif // SHARDED_STORE_H
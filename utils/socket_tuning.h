@@ -0,0 +1,160 @@
+#ifndef SOCKET_TUNING_H
+#define SOCKET_TUNING_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "log_error.h"
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+#define DEFAULT_SO_RCVBUF (4 * 1024 * 1024)
+
+/* Socket options applied to every socket the programs create. A value of 0
+ * (or -1 for tos/priority) leaves the kernel default in place. Options that do
+ * not apply to a socket type are skipped: SO_RXQ_OVFL only on datagram sockets,
+ * TCP_NODELAY only on stream sockets. */
+typedef struct {
+    int rcvbuf;        // SO_RCVBUF bytes (MT_SO_RCVBUF)
+    int sndbuf;        // SO_SNDBUF bytes (MT_SO_SNDBUF)
+    int busy_poll_us;  // SO_BUSY_POLL: spin this long on the device queue in blocking reads (MT_BUSY_POLL_US)
+    int rxq_ovfl;      // Ask for the kernel drop counter with every datagram (MT_RXQ_OVFL)
+    int tos;           // IP_TOS byte, -1 = unset (MT_IP_TOS)
+    int priority;      // SO_PRIORITY, -1 = unset (MT_SO_PRIORITY)
+    int nodelay;       // TCP_NODELAY on stream sockets (MT_TCP_NODELAY)
+    int cork;          // Hold partial segments with TCP_CORK while the transmitter is busy (MT_TCP_CORK)
+} SocketTuning;
+
+/* Values the kernel actually granted, read back after socket_tuning_apply */
+typedef struct {
+    int rcvbuf;        // Usable receive buffer; the kernel reports twice the usable size
+    int sndbuf;        // Usable send buffer
+    int busy_poll_us;
+    int rxq_ovfl;
+    int tos;
+    int priority;
+    int nodelay;       // -1 on datagram sockets
+    int failed;        // Number of options the kernel refused
+} SocketTuningResult;
+
+/* Read a signed integer from the environment, falling back to a default */
+static int tuning_env_int(const char* name, int def) {
+    const char* value = getenv(name);
+    if (!value || !*value) {
+        return def;
+    }
+    char* end = NULL;
+    long parsed = strtol(value, &end, 10);
+    if (*end != '\0') {
+        return def;  // Ignore malformed values
+    }
+    return (int)parsed;
+}
+
+/* Fill the profile from defaults and MT_* environment overrides */
+void socket_tuning_load(SocketTuning* tuning) {
+    tuning->rcvbuf = tuning_env_int("MT_SO_RCVBUF", DEFAULT_SO_RCVBUF);
+    tuning->sndbuf = tuning_env_int("MT_SO_SNDBUF", 0);
+    tuning->busy_poll_us = tuning_env_int("MT_BUSY_POLL_US", 0);
+    tuning->rxq_ovfl = tuning_env_int("MT_RXQ_OVFL", 1);
+    tuning->tos = tuning_env_int("MT_IP_TOS", -1);
+    tuning->priority = tuning_env_int("MT_SO_PRIORITY", -1);
+    tuning->nodelay = tuning_env_int("MT_TCP_NODELAY", 1);
+    tuning->cork = tuning_env_int("MT_TCP_CORK", 0);
+}
+
+/* setsockopt with an int value; logs and returns -1 when the kernel refuses it */
+static int tuning_set(int sock, int level, int option, int value, const char* what) {
+    if (setsockopt(sock, level, option, &value, sizeof(value)) < 0) {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%s=%d refused", what, value);
+        logError(buffer);
+        return -1;
+    }
+    return 0;
+}
+
+static int tuning_get(int sock, int level, int option) {
+    int value = -1;
+    socklen_t len = sizeof(value);
+    if (getsockopt(sock, level, option, &value, &len) < 0) {
+        return -1;
+    }
+    return value;
+}
+
+/* Set a buffer size, trying the privileged FORCE variant first so that
+ * net.core.rmem_max/wmem_max do not cap it when running with CAP_NET_ADMIN */
+static int tuning_set_buffer(int sock, int force_option, int option, int bytes, const char* what) {
+    if (setsockopt(sock, SOL_SOCKET, force_option, &bytes, sizeof(bytes)) == 0) {
+        return 0;
+    }
+    return tuning_set(sock, SOL_SOCKET, option, bytes, what);
+}
+
+/* Apply the profile to sock. Buffer sizes must be set before connect() or listen()
+ * to take effect on TCP window scaling. If granted is not NULL, the values the
+ * kernel actually uses are read back into it. Returns the number of refused options. */
+int socket_tuning_apply(int sock, const SocketTuning* tuning, SocketTuningResult* granted) {
+    int type = tuning_get(sock, SOL_SOCKET, SO_TYPE);
+    int failed = 0;
+    if (tuning->rcvbuf > 0) {
+        failed += tuning_set_buffer(sock, SO_RCVBUFFORCE, SO_RCVBUF, tuning->rcvbuf, "SO_RCVBUF") < 0;
+    }
+    if (tuning->sndbuf > 0) {
+        failed += tuning_set_buffer(sock, SO_SNDBUFFORCE, SO_SNDBUF, tuning->sndbuf, "SO_SNDBUF") < 0;
+    }
+    if (tuning->busy_poll_us > 0) {
+        failed += tuning_set(sock, SOL_SOCKET, SO_BUSY_POLL, tuning->busy_poll_us, "SO_BUSY_POLL") < 0;
+    }
+    if (tuning->tos >= 0) {
+        failed += tuning_set(sock, IPPROTO_IP, IP_TOS, tuning->tos, "IP_TOS") < 0;
+    }
+    if (tuning->priority >= 0) {
+        failed += tuning_set(sock, SOL_SOCKET, SO_PRIORITY, tuning->priority, "SO_PRIORITY") < 0;
+    }
+    if (type == SOCK_DGRAM && tuning->rxq_ovfl) {
+        failed += tuning_set(sock, SOL_SOCKET, SO_RXQ_OVFL, 1, "SO_RXQ_OVFL") < 0;
+    }
+    if (type == SOCK_STREAM && tuning->nodelay) {
+        failed += tuning_set(sock, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY") < 0;
+    }
+
+    if (granted) {
+        granted->rcvbuf = tuning_get(sock, SOL_SOCKET, SO_RCVBUF) / 2;
+        granted->sndbuf = tuning_get(sock, SOL_SOCKET, SO_SNDBUF) / 2;
+        granted->busy_poll_us = tuning_get(sock, SOL_SOCKET, SO_BUSY_POLL);
+        granted->rxq_ovfl = type == SOCK_DGRAM ? tuning_get(sock, SOL_SOCKET, SO_RXQ_OVFL) : 0;
+        granted->tos = tuning_get(sock, IPPROTO_IP, IP_TOS);
+        granted->priority = tuning_get(sock, SOL_SOCKET, SO_PRIORITY);
+        granted->nodelay = type == SOCK_STREAM ? tuning_get(sock, IPPROTO_TCP, TCP_NODELAY) : -1;
+        granted->failed = failed;
+    }
+    return failed;
+}
+
+/* Check whether the kernel capped a requested buffer size (net.core.rmem_max / wmem_max) */
+int socket_tuning_capped(const SocketTuning* tuning, const SocketTuningResult* granted) {
+    return (tuning->rcvbuf > 0 && granted->rcvbuf < tuning->rcvbuf) ||
+           (tuning->sndbuf > 0 && granted->sndbuf < tuning->sndbuf);
+}
+
+/* One-line description of the granted values, for tools that print to stdout */
+void socket_tuning_describe(const SocketTuningResult* granted, char* out, size_t size) {
+    snprintf(out, size, "rcvbuf=%d sndbuf=%d busy_poll_us=%d rxq_ovfl=%d tos=%d priority=%d nodelay=%d",
+             granted->rcvbuf, granted->sndbuf, granted->busy_poll_us, granted->rxq_ovfl,
+             granted->tos, granted->priority, granted->nodelay);
+}
+
+#endif // SOCKET_TUNING_H
@@ -0,0 +1,59 @@
+#ifndef STREAM_FRAMER_H
+#define STREAM_FRAMER_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+/* Reassembles fixed-size frames from a byte stream. Reads go into one large
+ * buffer; complete frames are handed out in place and any trailing partial
+ * frame is kept for the next read. */
+typedef struct {
+    char* buf;          // Receive buffer
+    size_t len;         // Bytes in buf
+    size_t cap;         // Size of buf
+    size_t frame_size;  // Bytes per frame
+} StreamFramer;
+
+int framer_init(StreamFramer* f, size_t cap, size_t frame_size) {
+    f->buf = (char*)malloc(cap);
+    f->len = 0;
+    f->cap = cap;
+    f->frame_size = frame_size;
+    return f->buf ? 0 : -1;
+}
+
+void framer_destroy(StreamFramer* f) {
+    free(f->buf);
+    f->buf = NULL;
+}
+
+/* One recv() into the free space of the buffer.
+ * Returns bytes read, 0 on EOF, -1 on error (errno EAGAIN when drained). */
+ssize_t framer_read(StreamFramer* f, int fd) {
+    ssize_t n = recv(fd, f->buf + f->len, f->cap - f->len, 0);
+    if (n > 0) f->len += (size_t)n;
+    return n;
+}
+
+/* Number of complete frames in the buffer */
+static inline size_t framer_frames(const StreamFramer* f) {
+    return f->len / f->frame_size;
+}
+
+/* Pointer to complete frame i */
+static inline const char* framer_frame(const StreamFramer* f, size_t i) {
+    return f->buf + i * f->frame_size;
+}
+
+/* Drop the first count frames, keeping any partial frame at the front */
+void framer_consume(StreamFramer* f, size_t count) {
+    size_t used = count * f->frame_size;
+    f->len -= used;
+    if (f->len > 0) memmove(f->buf, f->buf + used, f->len);
+}
+
+#endif // STREAM_FRAMER_H
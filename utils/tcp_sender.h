@@ -0,0 +1,296 @@
+#ifndef TCP_SENDER_H
+#define TCP_SENDER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "async_log.h"
+#include "custom_convectors.h"
+#include "event_loop.h"
+#include "message.h"
+#include "metrics.h"
+#include "socket_tuning.h"
+#include "time_utils.h"
+#include "wire_codec.h"
+
+/* Connection and coalescing settings for a TcpSender */
+typedef struct {
+    const char* host;          // Downstream IPv4 address
+    uint16_t port;             // Downstream TCP port
+    SocketTuning tuning;       // Buffers, TOS/priority, TCP_NODELAY and TCP_CORK of the connection
+    int64_t flush_deadline_ns; // Max time a buffered message may wait before a flush (0 = flush every wakeup)
+    size_t flush_bytes;        // Flush as soon as this many bytes are buffered
+    int64_t backoff_min_ns;    // First reconnect delay
+    int64_t backoff_max_ns;    // Reconnect delay cap
+} TcpSenderOptions;
+
+/* Single owner of a downstream TCP connection.
+ * Messages are encoded into one contiguous buffer and written with one send() per flush. */
+typedef struct {
+    TcpSenderOptions opts;
+    int sock;                  // Connected socket, or -1 while disconnected
+    char* buf;                 // Encoded frames waiting to be written
+    int64_t* stamps;           // Enqueue time of each frame in buf, for the queue-to-send histogram
+    size_t len;                // Bytes in buf
+    size_t cap;                // Allocated size of buf
+    size_t sent;               // Bytes of buf already written to the current connection
+    int64_t first_pending_ns;  // Enqueue time of the oldest unflushed message
+    int64_t backoff_ns;        // Current reconnect delay
+    int64_t next_connect_ns;   // Earliest time of the next connect attempt
+    uint64_t messages;         // Messages fully written
+    uint64_t send_calls;       // send() syscalls issued
+    uint64_t flushes;          // Flushes that wrote at least one byte
+    uint64_t reconnects;       // Successful connects after the first one
+    uint64_t connects;         // Successful connects in total
+    int corked;                // TCP_CORK is set on the current connection
+    SocketTuningResult granted;// Socket options the kernel granted on the latest connection
+    MetricsThread* metrics;    // Counters and histograms of the owning thread, or NULL
+    const char* name;          // Log tag of the owning thread, or NULL
+    LogRateLimit error_log;    // Rate limit of the connect and send failure lines
+} TcpSender;
+
+/* Initialize a disconnected sender */
+void tcp_sender_init(TcpSender* sender, const TcpSenderOptions* opts) {
+    memset(sender, 0, sizeof(*sender));
+    sender->opts = *opts;
+    sender->sock = -1;
+    sender->cap = opts->flush_bytes > 4096 ? opts->flush_bytes : 4096;
+    sender->buf = (char*)malloc(sender->cap);
+    sender->stamps = (int64_t*)malloc(sizeof(int64_t) * (sender->cap / WIRE_FRAME_SIZE + 1));
+    sender->backoff_ns = opts->backoff_min_ns;
+}
+
+/* Close the connection and free the buffer */
+void tcp_sender_destroy(TcpSender* sender) {
+    if (sender->sock >= 0) {
+        close(sender->sock);
+    }
+    free(sender->buf);
+    free(sender->stamps);
+    sender->buf = NULL;
+    sender->stamps = NULL;
+}
+
+/* Check whether the sender currently holds a live connection */
+int tcp_sender_connected(const TcpSender* sender) {
+    return sender->sock >= 0;
+}
+
+/* Log a failure with the current errno through the async logger, at most once per second:
+ * a dead downstream fails on every reconnect and the caller is the transmitter thread */
+static void tcp_sender_log_error(TcpSender* sender, const char* what) {
+    int err = errno;
+    if (alog_rate_allow(&sender->error_log, 1, sender->name)) {
+        alog_write(LOG_LEVEL_ERROR, sender->name, err, what, 0, 0, 0);
+    }
+}
+
+/* Drop the connection and schedule a reconnect with exponential backoff.
+ * Partially written frames are resent from their start on the next connection. */
+static void tcp_sender_disconnect(TcpSender* sender) {
+    close(sender->sock);
+    sender->sock = -1;
+    sender->corked = 0;
+    sender->sent -= sender->sent % WIRE_FRAME_SIZE;
+    sender->next_connect_ns = monotonic_ns() + sender->backoff_ns;
+    sender->backoff_ns *= 2;
+    if (sender->backoff_ns > sender->opts.backoff_max_ns) {
+        sender->backoff_ns = sender->opts.backoff_max_ns;
+    }
+}
+
+/* Try to connect if disconnected and the backoff delay has passed.
+ * Returns 1 if connected afterwards, 0 otherwise. */
+int tcp_sender_connect(TcpSender* sender) {
+    if (sender->sock >= 0) return 1;
+    if (monotonic_ns() < sender->next_connect_ns) return 0;
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        tcp_sender_log_error(sender, "Transmitter socket creation failed");
+        return 0;
+    }
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+    socket_tuning_apply(sock, &sender->opts.tuning, &sender->granted);  // Before connect, for window scaling
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(sender->opts.port);
+    inet_pton(AF_INET, sender->opts.host, &addr.sin_addr);
+
+    int result = connect(sock, (struct sockaddr*)&addr, sizeof(addr));
+    if (result < 0 && errno == EINPROGRESS) {
+        int err = ETIMEDOUT;
+        if (event_wait_fd(sock, POLLOUT, -1, 100) != 0) {  // 100ms connect timeout
+            socklen_t len = sizeof(err);
+            getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len);
+        }
+        errno = err;
+        result = err == 0 ? 0 : -1;
+    }
+    if (result < 0) {
+        tcp_sender_log_error(sender, "TCP connect failed, retrying with backoff");
+        sender->sock = sock;
+        tcp_sender_disconnect(sender);
+        return 0;
+    }
+
+    sender->sock = sock;
+    sender->backoff_ns = sender->opts.backoff_min_ns;
+    if (sender->connects++ > 0) {
+        sender->reconnects++;
+        if (sender->metrics) metrics_add(sender->metrics, METRIC_RECONNECTS, 1);
+    } else {
+        alog_info(NULL, "Transmitter socket granted sndbuf=%lu, nodelay=%lu, tos=%lu",
+                  (uint64_t)sender->granted.sndbuf, (uint64_t)sender->granted.nodelay, (uint64_t)sender->granted.tos);
+    }
+    return 1;
+}
+
+/* Encode a message as a wire frame at the end of the buffer. enqueue_ns is when the
+ * message entered the pipeline; it is only used for the queue-to-send histogram */
+void tcp_sender_append(TcpSender* sender, const Message* msg, int64_t enqueue_ns) {
+    if (sender->len + WIRE_FRAME_SIZE > sender->cap && sender->sent >= WIRE_FRAME_SIZE) {
+        // Reclaim the space of frames that are already written
+        size_t base = sender->sent - sender->sent % WIRE_FRAME_SIZE;
+        memmove(sender->buf, sender->buf + base, sender->len - base);
+        memmove(sender->stamps, sender->stamps + base / WIRE_FRAME_SIZE,
+                sizeof(int64_t) * ((sender->len - base) / WIRE_FRAME_SIZE));
+        sender->len -= base;
+        sender->sent -= base;
+    }
+    if (sender->len + WIRE_FRAME_SIZE > sender->cap) {
+        sender->cap *= 2;
+        sender->buf = (char*)realloc(sender->buf, sender->cap);
+        sender->stamps = (int64_t*)realloc(sender->stamps, sizeof(int64_t) * (sender->cap / WIRE_FRAME_SIZE + 1));
+    }
+    if (sender->len == sender->sent) {
+        sender->first_pending_ns = monotonic_ns();
+    }
+    wire_encode((uint8_t*)sender->buf + sender->len, msg);
+    sender->stamps[sender->len / WIRE_FRAME_SIZE] = enqueue_ns;
+    sender->len += WIRE_FRAME_SIZE;
+}
+
+/* Bytes buffered but not yet written */
+size_t tcp_sender_pending(const TcpSender* sender) {
+    return sender->len - sender->sent;
+}
+
+/* Check whether the buffered data should be flushed now */
+int tcp_sender_flush_due(const TcpSender* sender, int64_t now) {
+    size_t pending = tcp_sender_pending(sender);
+    if (pending == 0) return 0;
+    return pending >= sender->opts.flush_bytes ||
+           now - sender->first_pending_ns >= sender->opts.flush_deadline_ns;
+}
+
+/* Nanoseconds until the oldest buffered message reaches its flush deadline, or -1 if nothing is buffered */
+int64_t tcp_sender_time_to_deadline(const TcpSender* sender, int64_t now) {
+    if (tcp_sender_pending(sender) == 0) return -1;
+    int64_t remaining = sender->first_pending_ns + sender->opts.flush_deadline_ns - now;
+    return remaining > 0 ? remaining : 0;
+}
+
+/* Nanoseconds until the sender needs attention: the flush deadline while connected,
+ * the next reconnect attempt while disconnected, or -1 if nothing is buffered */
+int64_t tcp_sender_next_wakeup(const TcpSender* sender, int64_t now) {
+    if (tcp_sender_pending(sender) == 0) return -1;
+    if (sender->sock < 0) {
+        int64_t remaining = sender->next_connect_ns - now;
+        return remaining > 0 ? remaining : 0;
+    }
+    return tcp_sender_time_to_deadline(sender, now);
+}
+
+/* Nanoseconds until the next connect attempt is allowed, or -1 while connected */
+int64_t tcp_sender_time_to_connect(const TcpSender* sender, int64_t now) {
+    if (sender->sock >= 0) return -1;
+    int64_t remaining = sender->next_connect_ns - now;
+    return remaining > 0 ? remaining : 0;
+}
+
+/* Log every frame that was fully written during the last flush and record its queue-to-send time */
+static void tcp_sender_report(const TcpSender* sender, size_t from, size_t to) {
+    int64_t now = sender->metrics ? monotonic_ns() : 0;
+    for (size_t off = from; off + WIRE_FRAME_SIZE <= to; off += WIRE_FRAME_SIZE) {
+        alog_info(NULL, "Transmitted: ID=%lu", wire_frame_id((const uint8_t*)sender->buf + off), 0, 0);
+        if (sender->metrics) {
+            int64_t waited = now - sender->stamps[off / WIRE_FRAME_SIZE];
+            metrics_record(sender->metrics, METRIC_HIST_QUEUE_TO_SEND, waited > 0 ? (uint64_t)waited : 0);
+        }
+    }
+}
+
+/* Write as much of the buffer as the socket accepts with a single send().
+ * Returns the number of bytes written, 0 if nothing could be written, -1 if the connection dropped. */
+ssize_t tcp_sender_flush(TcpSender* sender) {
+    size_t pending = tcp_sender_pending(sender);
+    if (pending == 0) return 0;
+    if (!tcp_sender_connect(sender)) return 0;
+
+    if (sender->opts.tuning.cork && !sender->corked) {
+        // Corked for the whole busy period, so only full segments leave until tcp_sender_uncork
+        int on = 1;
+        sender->corked = setsockopt(sender->sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) == 0;
+    }
+    ssize_t result = send(sender->sock, sender->buf + sender->sent, pending, MSG_NOSIGNAL);
+    sender->send_calls++;
+    if (sender->metrics) metrics_add(sender->metrics, METRIC_SEND_CALLS, 1);
+    if (result < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (sender->metrics) metrics_add(sender->metrics, METRIC_SEND_EAGAIN, 1);
+            return 0;
+        }
+        tcp_sender_log_error(sender, "TCP send failed, reconnecting");
+        tcp_sender_disconnect(sender);
+        return -1;
+    }
+
+    size_t frames_before = sender->sent / WIRE_FRAME_SIZE;
+    sender->sent += (size_t)result;
+    size_t frames_after = sender->sent / WIRE_FRAME_SIZE;
+    sender->messages += frames_after - frames_before;
+    sender->flushes++;
+    if (sender->metrics) {
+        metrics_add(sender->metrics, METRIC_TX_MESSAGES, frames_after - frames_before);
+        metrics_add(sender->metrics, METRIC_TX_BYTES, (uint64_t)result);
+    }
+    tcp_sender_report(sender, frames_before * WIRE_FRAME_SIZE, frames_after * WIRE_FRAME_SIZE);
+
+    // Compact the buffer once everything has been written
+    if (sender->sent == sender->len) {
+        sender->sent = 0;
+        sender->len = 0;
+    }
+    return result;
+}
+
+/* Check whether a partial segment may be held back by TCP_CORK */
+int tcp_sender_corked(const TcpSender* sender) {
+    return sender->corked;
+}
+
+/* Clear TCP_CORK so the held partial segment goes out. Called once the ring has gone idle */
+void tcp_sender_uncork(TcpSender* sender) {
+    if (!sender->corked) return;
+    int off = 0;
+    setsockopt(sender->sock, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    sender->corked = 0;
+}
+
+/* Wait until the socket can accept more data or timeout_ms elapses */
+void tcp_sender_wait_writable(const TcpSender* sender, int timeout_ms) {
+    if (sender->sock < 0) return;
+    event_wait_fd(sender->sock, POLLOUT, -1, timeout_ms);
+}
+
+#endif // TCP_SENDER_H
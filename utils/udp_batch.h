@@ -0,0 +1,145 @@
+#ifndef UDP_BATCH_H
+#define UDP_BATCH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+
+#define UDP_BATCH_CONTROL_SIZE CMSG_SPACE(sizeof(uint32_t))  // Room for the SO_RXQ_OVFL counter
+
+/* Preallocated buffers for receiving many datagrams with one recvmmsg call */
+typedef struct {
+    struct mmsghdr* msgs;   // One header per datagram slot
+    struct iovec* iovecs;   // One iovec per datagram slot
+    char* buffers;          // Contiguous storage: capacity * frame_size bytes
+    char* control;          // Ancillary data per slot when the drop counter is enabled, else NULL
+    size_t capacity;        // Max datagrams per batch
+    size_t frame_size;      // Size of each datagram slot
+    uint64_t batches;       // Number of recvmmsg calls that returned data
+    uint64_t datagrams;     // Total datagrams received
+    uint32_t kernel_drops;  // Datagrams the kernel dropped on this socket so far (SO_RXQ_OVFL)
+} UdpBatch;
+
+/* Allocate the slots for a batch of up to capacity datagrams */
+int udp_batch_init(UdpBatch* batch, size_t capacity, size_t frame_size) {
+    memset(batch, 0, sizeof(*batch));
+    batch->msgs = (struct mmsghdr*)calloc(capacity, sizeof(struct mmsghdr));
+    batch->iovecs = (struct iovec*)calloc(capacity, sizeof(struct iovec));
+    batch->buffers = (char*)malloc(capacity * frame_size);
+    if (!batch->msgs || !batch->iovecs || !batch->buffers) {
+        free(batch->msgs);
+        free(batch->iovecs);
+        free(batch->buffers);
+        return -1;
+    }
+    batch->capacity = capacity;
+    batch->frame_size = frame_size;
+    for (size_t i = 0; i < capacity; i++) {
+        batch->iovecs[i].iov_base = batch->buffers + i * frame_size;
+        batch->iovecs[i].iov_len = frame_size;
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iovecs[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return 0;
+}
+
+/* Reserve ancillary data space so the SO_RXQ_OVFL drop counter that the kernel attaches
+ * to each datagram is received. The option itself must be enabled on the socket. */
+int udp_batch_enable_drop_counter(UdpBatch* batch) {
+    batch->control = (char*)calloc(batch->capacity, UDP_BATCH_CONTROL_SIZE);
+    if (!batch->control) {
+        return -1;
+    }
+    for (size_t i = 0; i < batch->capacity; i++) {
+        batch->msgs[i].msg_hdr.msg_control = batch->control + i * UDP_BATCH_CONTROL_SIZE;
+    }
+    return 0;
+}
+
+/* Free the batch buffers */
+void udp_batch_destroy(UdpBatch* batch) {
+    free(batch->msgs);
+    free(batch->iovecs);
+    free(batch->buffers);
+    free(batch->control);
+    memset(batch, 0, sizeof(*batch));
+}
+
+/* Read the SO_RXQ_OVFL drop counter from a datagram's ancillary data, if present */
+void udp_batch_parse_drops(UdpBatch* batch, struct msghdr* hdr) {
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(hdr); c; c = CMSG_NXTHDR(hdr, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+            memcpy(&batch->kernel_drops, CMSG_DATA(c), sizeof(uint32_t));
+        }
+    }
+}
+
+/* Receive up to capacity datagrams without blocking.
+ * Returns the number received, 0 if none are pending, -1 on error. */
+int udp_batch_recv(UdpBatch* batch, int sock) {
+    if (batch->control) {
+        // The kernel shrinks msg_controllen to what it wrote, so restore it every call
+        for (size_t i = 0; i < batch->capacity; i++) {
+            batch->msgs[i].msg_hdr.msg_controllen = UDP_BATCH_CONTROL_SIZE;
+        }
+    }
+    int n;
+    do {
+        n = recvmmsg(sock, batch->msgs, (unsigned int)batch->capacity, MSG_DONTWAIT, NULL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    if (n > 0) {
+        batch->batches++;
+        batch->datagrams += (uint64_t)n;
+        if (batch->control) {
+            // The counter is cumulative, so the newest datagram carries the latest value
+            udp_batch_parse_drops(batch, &batch->msgs[n - 1].msg_hdr);
+        }
+    }
+    return n;
+}
+
+/* Put a datagram received by other means (the io_uring backend) into slot i of the
+ * batch being assembled, truncating it to frame_size like recvmmsg would */
+void udp_batch_store(UdpBatch* batch, size_t i, const void* data, size_t len, int flags) {
+    size_t copy = len < batch->frame_size ? len : batch->frame_size;
+    memcpy(batch->buffers + i * batch->frame_size, data, copy);
+    batch->msgs[i].msg_len = (unsigned int)copy;
+    batch->msgs[i].msg_hdr.msg_flags = flags | (len > batch->frame_size ? MSG_TRUNC : 0);
+}
+
+/* Account for a batch of count datagrams assembled with udp_batch_store */
+void udp_batch_commit(UdpBatch* batch, size_t count) {
+    if (count == 0) return;
+    batch->batches++;
+    batch->datagrams += count;
+}
+
+/* Pointer to the payload of datagram i in the last batch */
+const char* udp_batch_data(const UdpBatch* batch, size_t i) {
+    return batch->buffers + i * batch->frame_size;
+}
+
+/* Length of datagram i in the last batch, or 0 if it was truncated */
+size_t udp_batch_len(const UdpBatch* batch, size_t i) {
+    if (batch->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        return 0;
+    }
+    return batch->msgs[i].msg_len;
+}
+
+/* Average number of datagrams returned per non-empty recvmmsg call */
+double udp_batch_avg_fill(const UdpBatch* batch) {
+    return batch->batches ? (double)batch->datagrams / (double)batch->batches : 0.0;
+}
+
+#endif // UDP_BATCH_H
@@ -0,0 +1,307 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* Minimal io_uring wrapper over the raw syscalls, for the optional io_uring
+ * I/O backend (no liburing dependency). It covers what the UDP receive
+ * path needs: one submission/completion ring owned by a single thread,
+ * registered files and provided buffer rings.
+ *
+ * Nothing here is used unless the backend is selected and uring_probe() found
+ * the required operations; callers fall back to the epoll/syscall path otherwise. */
+
+/* I/O backend of the receivers (MT_IO_BACKEND) */
+typedef enum {
+    IO_BACKEND_EPOLL,  // epoll + recvmmsg
+    IO_BACKEND_URING,  // io_uring, falling back to epoll if the kernel lacks it
+    IO_BACKEND_AUTO,   // io_uring when uring_probe() succeeds, else epoll
+} IoBackend;
+
+IoBackend io_backend_parse(const char* name, IoBackend def) {
+    if (!name) return def;
+    if (strcasecmp(name, "epoll") == 0) return IO_BACKEND_EPOLL;
+    if (strcasecmp(name, "uring") == 0 || strcasecmp(name, "io_uring") == 0) return IO_BACKEND_URING;
+    if (strcasecmp(name, "auto") == 0) return IO_BACKEND_AUTO;
+    return def;
+}
+
+const char* io_backend_name(IoBackend backend) {
+    switch (backend) {
+        case IO_BACKEND_URING: return "io_uring";
+        case IO_BACKEND_AUTO: return "auto";
+        default: return "epoll";
+    }
+}
+
+typedef struct {
+    int fd;                          // Ring file descriptor, -1 when not set up
+    unsigned features;               // IORING_FEAT_* reported by the kernel
+    // Submission queue
+    _Atomic unsigned* sq_head;
+    _Atomic unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail;               // Next SQE handed out, published on submit
+    struct io_uring_sqe* sqes;
+    // Completion queue
+    _Atomic unsigned* cq_head;
+    _Atomic unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+    // Mappings
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} Uring;
+
+/* Buffers provided to the kernel for buffer-select receives (IORING_REGISTER_PBUF_RING) */
+typedef struct {
+    struct io_uring_buf_ring* ring;  // Shared ring of buffer descriptors
+    size_t ring_size;                // Bytes mapped for ring
+    char* buffers;                   // entries * buf_size bytes
+    size_t buf_size;                 // Bytes per buffer
+    unsigned entries;                // Number of buffers (power of two)
+    uint16_t bgid;                   // Buffer group ID used in SQEs
+    uint16_t tail;                   // Local tail, published by uring_buf_ring_publish
+} UringBufRing;
+
+static inline int uring_setup_syscall(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int uring_enter_syscall(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int uring_register_syscall(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Create a ring with at least entries SQEs for use by the calling thread only.
+ * Returns 0 on success or a negative errno. */
+int uring_init(Uring* ring, unsigned entries) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // One submitter and completions reaped only in io_uring_enter: no task-work interrupts
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    int fd = uring_setup_syscall(entries, &p);
+    if (fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));  // Older kernel without those flags
+        fd = uring_setup_syscall(entries, &p);
+    }
+    if (fd < 0) return -errno;
+
+    ring->fd = fd;
+    ring->features = p.features;
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) goto fail;
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) goto fail;
+
+    char* sq = (char*)ring->sq_ring;
+    ring->sq_head = (_Atomic unsigned*)(sq + p.sq_off.head);
+    ring->sq_tail = (_Atomic unsigned*)(sq + p.sq_off.tail);
+    ring->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned*)(sq + p.sq_off.ring_entries);
+    ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+    ring->sqe_tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    char* cq = (char*)ring->cq_ring;
+    ring->cq_head = (_Atomic unsigned*)(cq + p.cq_off.head);
+    ring->cq_tail = (_Atomic unsigned*)(cq + p.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return 0;
+
+fail:
+    {
+        int err = errno;
+        if (ring->sq_ring && ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+        if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        close(fd);
+        ring->fd = -1;
+        return -err;
+    }
+}
+
+/* Unmap and close the ring; in-flight requests are cancelled by the kernel */
+void uring_destroy(Uring* ring) {
+    if (ring->fd < 0) return;
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+/* Next free SQE, zeroed, or NULL if the submission queue is full */
+struct io_uring_sqe* uring_get_sqe(Uring* ring) {
+    unsigned head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+    if (ring->sqe_tail - head >= ring->sq_entries) return NULL;
+    unsigned index = ring->sqe_tail & ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+/* Publish queued SQEs and wait for at least wait_nr completions (0 = just submit).
+ * Returns the number submitted or a negative errno. */
+int uring_submit_and_wait(Uring* ring, unsigned wait_nr) {
+    unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    unsigned to_submit = ring->sqe_tail - tail;
+    atomic_store_explicit(ring->sq_tail, ring->sqe_tail, memory_order_release);
+    if (to_submit == 0 && wait_nr == 0) return 0;
+    int n = uring_enter_syscall(ring->fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    return n < 0 ? -errno : n;
+}
+
+/* Oldest unseen completion, or NULL if none is ready */
+static inline struct io_uring_cqe* uring_peek_cqe(Uring* ring) {
+    unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+    if (head == atomic_load_explicit(ring->cq_tail, memory_order_acquire)) return NULL;
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+/* Hand the completion returned by uring_peek_cqe back to the kernel */
+static inline void uring_cqe_seen(Uring* ring) {
+    atomic_store_explicit(ring->cq_head, atomic_load_explicit(ring->cq_head, memory_order_relaxed) + 1,
+                          memory_order_release);
+}
+
+/* Register fds so SQEs can refer to them by index with IOSQE_FIXED_FILE,
+ * skipping the per-request file lookup. Returns 0 or a negative errno. */
+int uring_register_files(Uring* ring, const int* fds, unsigned count) {
+    return uring_register_syscall(ring->fd, IORING_REGISTER_FILES, fds, count) < 0 ? -errno : 0;
+}
+
+/* Allocate entries buffers of buf_size bytes and register them as buffer group bgid.
+ * Every buffer starts out owned by the kernel. Returns 0 or a negative errno. */
+int uring_buf_ring_setup(Uring* ring, UringBufRing* br, uint16_t bgid, unsigned entries, size_t buf_size) {
+    memset(br, 0, sizeof(*br));
+    br->entries = entries;
+    br->buf_size = buf_size;
+    br->bgid = bgid;
+    br->ring_size = entries * sizeof(struct io_uring_buf);
+    void* mem = mmap(NULL, br->ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return -errno;
+    br->ring = (struct io_uring_buf_ring*)mem;
+    br->buffers = (char*)aligned_alloc(64, entries * buf_size);
+    if (!br->buffers) {
+        munmap(mem, br->ring_size);
+        br->ring = NULL;
+        return -ENOMEM;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)mem;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (uring_register_syscall(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int err = errno;
+        free(br->buffers);
+        munmap(mem, br->ring_size);
+        br->ring = NULL;
+        return -err;
+    }
+    for (unsigned i = 0; i < entries; i++) {
+        struct io_uring_buf* buf = &br->ring->bufs[(br->tail + i) & (entries - 1)];
+        buf->addr = (uint64_t)(uintptr_t)(br->buffers + i * buf_size);
+        buf->len = (uint32_t)buf_size;
+        buf->bid = (uint16_t)i;
+    }
+    br->tail = (uint16_t)(br->tail + entries);
+    atomic_store_explicit((_Atomic uint16_t*)&br->ring->tail, br->tail, memory_order_release);
+    return 0;
+}
+
+/* Pointer to buffer bid */
+static inline char* uring_buf_ring_buffer(const UringBufRing* br, unsigned bid) {
+    return br->buffers + (size_t)bid * br->buf_size;
+}
+
+/* Queue buffer bid to be given back to the kernel; call uring_buf_ring_publish afterwards */
+static inline void uring_buf_ring_recycle(UringBufRing* br, unsigned bid) {
+    struct io_uring_buf* buf = &br->ring->bufs[br->tail & (br->entries - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buf_ring_buffer(br, bid);
+    buf->len = (uint32_t)br->buf_size;
+    buf->bid = (uint16_t)bid;
+    br->tail++;
+}
+
+/* Make recycled buffers visible to the kernel */
+static inline void uring_buf_ring_publish(UringBufRing* br) {
+    atomic_store_explicit((_Atomic uint16_t*)&br->ring->tail, br->tail, memory_order_release);
+}
+
+/* Unregister and free a buffer ring. After uring_destroy only the memory is freed */
+void uring_buf_ring_destroy(Uring* ring, UringBufRing* br) {
+    if (!br->ring) return;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = br->bgid;
+    if (ring->fd >= 0) {
+        uring_register_syscall(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    munmap(br->ring, br->ring_size);
+    free(br->buffers);
+    br->ring = NULL;
+}
+
+/* Check that the kernel allows io_uring and supports every opcode the backend uses
+ * plus provided buffer rings. Returns 1 if the backend can be used. */
+int uring_probe(void) {
+    Uring ring;
+    if (uring_init(&ring, 8) < 0) return 0;
+    size_t size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, size);
+    int ok = probe && uring_register_syscall(ring.fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0;
+    static const int needed[] = {IORING_OP_RECVMSG, IORING_OP_POLL_ADD};
+    for (size_t i = 0; ok && i < sizeof(needed) / sizeof(needed[0]); i++) {
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    if (ok) {
+        UringBufRing br;
+        ok = uring_buf_ring_setup(&ring, &br, 0, 8, 64) == 0;
+        if (ok) uring_buf_ring_destroy(&ring, &br);
+    }
+    uring_destroy(&ring);
+    return ok;
+}
+
+#endif // URING_H
@@ -0,0 +1,112 @@
+#ifndef WIRE_CODEC_H
+#define WIRE_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "message.h"
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+/* Explicit wire format of a Message, independent of the in-memory struct layout.
+ *
+ *   offset 0   uint8   version (WIRE_VERSION)
+ *   offset 1   uint8   MessageType
+ *   offset 2   uint64  MessageId, big endian
+ *   offset 10  uint64  MessageData, big endian
+ *
+ * Frames are WIRE_FRAME_SIZE bytes with no padding. MessageSize is implied by the
+ * frame length and is set to WIRE_FRAME_SIZE on decode. The legacy format, the raw
+ * 24-byte struct in network byte order, is still accepted on datagram transports
+ * where the length tells the two apart. */
+
+#define WIRE_VERSION 1
+#define WIRE_FRAME_SIZE 18
+#define WIRE_LEGACY_FRAME_SIZE 24  // sizeof(Message) on LP64 targets
+
+#define WIRE_OFF_VERSION 0
+#define WIRE_OFF_TYPE 1
+#define WIRE_OFF_ID 2
+#define WIRE_OFF_DATA 10
+
+/* Byte order conversion resolved at compile time */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define wire_be64(x) ((uint64_t)(x))
+#define wire_be16(x) ((uint16_t)(x))
+#else
+#define wire_be64(x) __builtin_bswap64((uint64_t)(x))
+#define wire_be16(x) __builtin_bswap16((uint16_t)(x))
+#endif
+
+static inline uint64_t wire_load_be64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return wire_be64(v);
+}
+
+static inline void wire_store_be64(uint8_t* p, uint64_t v) {
+    v = wire_be64(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+/* Encode msg into WIRE_FRAME_SIZE bytes at out */
+static inline void wire_encode(uint8_t* out, const Message* msg) {
+    out[WIRE_OFF_VERSION] = WIRE_VERSION;
+    out[WIRE_OFF_TYPE] = msg->MessageType;
+    wire_store_be64(out + WIRE_OFF_ID, msg->MessageId);
+    wire_store_be64(out + WIRE_OFF_DATA, msg->MessageData);
+}
+
+/* Decode one frame. Returns 1 on success, 0 if the version is unknown */
+static inline int wire_decode(const uint8_t* in, Message* msg) {
+    if (in[WIRE_OFF_VERSION] != WIRE_VERSION) return 0;
+    msg->MessageSize = WIRE_FRAME_SIZE;
+    msg->MessageType = in[WIRE_OFF_TYPE];
+    msg->MessageId = wire_load_be64(in + WIRE_OFF_ID);
+    msg->MessageData = wire_load_be64(in + WIRE_OFF_DATA);
+    return 1;
+}
+
+/* MessageId of a frame without decoding the rest */
+static inline uint64_t wire_frame_id(const uint8_t* in) {
+    return wire_load_be64(in + WIRE_OFF_ID);
+}
+
+/* Decode a legacy 24-byte frame (raw struct, fields in network byte order) */
+static inline void wire_decode_legacy(const uint8_t* in, Message* msg) {
+    memcpy(msg, in, sizeof(Message));
+    msg->MessageSize = wire_be16(msg->MessageSize);
+    msg->MessageId = wire_be64(msg->MessageId);
+    msg->MessageData = wire_be64(msg->MessageData);
+}
+
+/* Decode count frames laid out stride bytes apart, dropping frames with an unknown
+ * version. The id and data words of a frame are adjacent on the wire and in Message,
+ * so with SSSE3 both are swapped by one shuffle and stored with one 16-byte write.
+ * Returns the number of messages written to out. */
+static inline size_t wire_decode_batch(const uint8_t* base, size_t stride, size_t count, Message* out) {
+    _Static_assert(offsetof(Message, MessageData) == offsetof(Message, MessageId) + 8,
+                   "MessageId and MessageData must be adjacent");
+    size_t n = 0;
+#if defined(__SSSE3__) && !(defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    const __m128i swap = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* in = base + i * stride;
+        Message* msg = &out[n];
+        __m128i words = _mm_loadu_si128((const __m128i*)(in + WIRE_OFF_ID));
+        _mm_storeu_si128((__m128i*)&msg->MessageId, _mm_shuffle_epi8(words, swap));
+        msg->MessageSize = WIRE_FRAME_SIZE;
+        msg->MessageType = in[WIRE_OFF_TYPE];
+        n += in[WIRE_OFF_VERSION] == WIRE_VERSION;
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        n += wire_decode(base + i * stride, &out[n]);
+    }
+#endif
+    return n;
+}
+
+#endif // WIRE_CODEC_H